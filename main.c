@@ -1,11 +1,30 @@
+#define _GNU_SOURCE
 #include <assert.h>
 #include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <raylib.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #ifdef BUILD_RELEASE
 #include "build/font.h"
 #endif
@@ -19,8 +38,68 @@
 #define BG_COLOR         BLACK
 #define CURSOR_COLOR     PINK
 #define SELECTION_COLOR  YELLOW
+#define KEYWORD_COLOR    SKYBLUE
+#define STRING_COLOR     GOLD
+#define COMMENT_COLOR    GRAY
+#define NUMBER_COLOR     ORANGE
+#define PREPROC_COLOR    VIOLET
 #define DEFAULT_FONTSIZE 30
 
+// file is read in chunks of this size by the loader thread
+#define LOADER_CHUNK_SIZE (4*1024*1024)
+
+// granularity at which changes on disk are detected
+#define DISK_BLOCK_SIZE (64*1024)
+
+// viewer mode remembers the offset of every N-th line only
+#define VIEWER_CHECKPOINT_LINES 1024
+// longest part of a line the viewer draws
+#define VIEWER_MAX_DRAWN_LINE   4096
+#define VIEWER_LINE_UNKNOWN     SIZE_MAX
+// the find thread of the viewer checks for cancellation after every chunk
+#define VIEWER_FIND_CHUNK       (64*1024*1024)
+
+// memory the undo history may use, see --undo-limit
+#define UNDO_DEFAULT_LIMIT   (64*1024*1024)
+#define UNDO_COALESCE_TIME   1.0
+// deletions at least this big (and of most of the buffer) share the old buffer
+#define UNDO_SHARE_THRESHOLD (16*1024*1024)
+
+// false candidates of the search filter tolerated (on top of one per 16 bytes)
+// before it hands over to memmem
+#define SEARCH_MAX_MISSES 1024
+
+// regex search, see `regex_thread()`
+#define REGEX_CHUNK_SIZE     (1024*1024)    // searched between checks for cancellation
+#define REGEX_MAX_STORED     (4*1024*1024)  // matches kept for jumping and highlighting
+#define REGEX_MAX_INSTS      20000
+#define REGEX_MAX_REPEAT     1000
+#define REGEX_DFA_MAX_STATES 4096           // cached DFA states, about 1 KiB each
+#define REGEX_SKIP_BYTES     4              // the start state is scanned past when this few bytes leave it
+
+// syntax highlighting, see `editor_syntax_update()`
+#define SYNTAX_SYNC_ROWS     4096           // lexed right away after an edit, the rest goes to the background
+#define SYNTAX_PUBLISH_ROWS  1024           // rows the background job lexes between progress updates
+
+// bracket index chunks end at a line end close to this size, see `editor_bracket_match()`
+#define BRACKET_CHUNK_SIZE 4096
+
+// word completion, see `editor_complete()`
+#define WORD_MAX_LEN        64          // longer identifier runs aren't offered
+#define WORDS_SYNC_BYTES    (1 << 20)   // uncounted text counted right away, more goes to the thread
+#define WORDS_CHUNK_BYTES   (1 << 18)   // the thread checks for cancel this often
+#define WORDS_RECENT_MAX    4096        // new words kept unsorted before merging them in
+#define COMPLETION_ITEMS    8
+#define WORD_UNSORTED       UINT32_MAX
+
+// file picker, see `editor_picker_open()`
+#define PICKER_MAX_WORKERS  8       // threads walking the directory tree
+#define PICKER_ROWS         12      // best matches shown
+#define PICKER_STEP         4096    // files checked between looks at the clock
+#define PICKER_FRAME_BUDGET 0.004   // seconds of matching a frame, the rest waits for the next one
+#define PICKER_RESCAN_TIME  10.0    // seconds before opening the picker walks the tree again
+#define PICKER_NO_MATCH     INT_MIN
+
 // TYPES
 typedef struct {
     size_t start;
@@ -43,8 +122,36 @@ typedef struct {
     size_t  start;
     size_t  end;
     bool    exists;
+    bool    block;  // a column block: the rows from start to end, between their columns
 } Selection;
 
+// a cursor besides the main one, selecting [anchor, pos) when they differ
+typedef struct {
+    size_t pos;
+    size_t anchor;
+} Caret;
+
+typedef struct {
+    Caret *items;
+    size_t size;
+    size_t count;
+} Carets;
+
+// buffer[pos, pos+removeLen) replaced by text[0, len)
+// batches of them are sorted by pos and don't overlap, see `editor_buffer_splice_many()`
+typedef struct {
+    size_t pos;
+    size_t removeLen;
+    const char *text;
+    size_t len;
+} Edit;
+
+typedef struct {
+    Edit *items;
+    size_t size;
+    size_t count;
+} Edits;
+
 typedef struct {
     size_t pos; // cursor position in buffer
 
@@ -63,12 +170,676 @@ typedef struct {
     double timer;
 } Notification;
 
+typedef enum {
+    ENCODING_UTF8 = 0,
+    ENCODING_UTF8_BOM,
+    ENCODING_UTF16LE,
+    ENCODING_UTF16LE_BOM,
+    ENCODING_UTF16BE,
+    ENCODING_UTF16BE_BOM,
+    ENCODING_LATIN1,    // fallback for anything that isn't valid utf8
+} Encoding;
+
+// background file loading state
+// the loader thread fills the buffer and line index chunk by chunk,
+// publishing each chunk under `Editor.lock`
+typedef struct {
+    pthread_t thread;
+    bool active;        // thread is running or waiting to be joined
+    atomic_bool done;
+    atomic_bool cancel;
+
+    int fd;
+    bool gzip;          // file is decompressed while loading
+    size_t total;       // bytes expected (compressed size for gzip)
+    size_t loaded;      // bytes published so far (guarded by Editor.lock)
+    size_t consumed;    // bytes of the file read so far, for the progress
+    Encoding encoding;  // detected by the loader thread
+    int error;          // errno of a failed read, 0 otherwise
+    double startTime;
+} Loader;
+
+// hash of every DISK_BLOCK_SIZE block of the file as the buffer last saw it
+typedef struct {
+    uint64_t *items;
+    size_t size;
+    size_t count;
+} BlockHashes;
+
+// inotify based watch of the open file
+typedef struct {
+    int fd;             // inotify instance, -1 when not watching
+    int wd;
+    ino_t ino;          // inode being watched
+    bool gone;          // file was moved or deleted
+
+    double lastEvent;   // time of the last modification event
+    bool pending;       // modified in place, waiting for the writer to finish
+
+    bool follow;        // tail -f: append whatever gets written to the file
+    bool stickToEnd;    // keep the cursor at the end across a reload
+    int fileFd;         // open handle on the watched file
+    size_t followPos;   // bytes of the file reflected in the buffer
+} Watch;
+
+// background writer of the edit journal, see `editor_journal_record()`
+typedef struct {
+    pthread_t thread;
+    bool running;
+    bool disabled;      // journal can't be created, don't keep trying
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool stop;
+    int fd;
+    Buffer pending;     // encoded records waiting for the thread
+    size_t streamPos;   // bytes of records written or queued since the header
+    uint64_t header[2]; // new content size and id for the thread to write
+    bool headerPending;
+    bool checkPending;  // look for a leftover journal and undo history once loading is done
+} Journal;
+
+// one edit in the undo history
+// buffer[pos, pos+removedLen) was replaced by insertedLen bytes
+typedef struct {
+    size_t pos;
+    size_t removedLen;
+    size_t insertedLen;
+    char *data;         // removed bytes followed by the inserted ones
+    size_t cursor;      // cursor position before the edit
+    uint32_t group;     // records of a group are undone together
+    double time;
+    uint64_t fileOffset; // where it's stored in the history file, see `editor_undo_persist()`
+
+    // large deletions keep the whole buffer of the other side instead,
+    // see `editor_buffer_replace_shared()`
+    bool swap;
+    Buffer other;
+} UndoRecord;
+
+typedef struct {
+    UndoRecord *items;
+    size_t size;
+    size_t count;
+} UndoRecords;
+
+// a record on its way to the history file, pointing into the record's data
+typedef struct {
+    uint64_t head[5];   // pos, removedLen, insertedLen, cursor, group
+    const char *removed;
+    const char *inserted;
+    uint64_t offset;
+} UndoWrite;
+
+typedef struct {
+    UndoWrite *items;
+    size_t size;
+    size_t count;
+} UndoWrites;
+
+typedef struct {
+    UndoRecord *items;
+    size_t size;
+    size_t count;
+
+    size_t pos;         // records before pos are applied, the rest can be redone
+    size_t bytes;       // memory held by the records
+    size_t limit;       // oldest groups get dropped past this
+    uint32_t group;
+    bool sealed;        // next edit starts a new group unless it coalesces
+    bool applying;      // edits come from undo/redo, don't record them
+    size_t savedPos;    // pos matching the file on disk, SIZE_MAX if gone
+
+    // history file, records before items[0] are only read when undone
+    int fd;
+    const char *map;
+    size_t mapSize;
+    size_t base;        // records in the file before items[0]
+    size_t persisted;   // items[0, persisted) are in the file too
+    uint64_t fileEnd;
+
+    // the file is written on its own thread after a save, the records it
+    // points into aren't freed or swapped until `undo_writer_wait()`
+    pthread_t writer;
+    bool writing;
+    UndoWrites writes;
+    size_t written;     // of `writes`, by the thread
+    int writeError;
+    uint64_t header[4]; // content size, content id, record count, next group
+} Undo;
+
+// offsets of every VIEWER_CHECKPOINT_LINES-th line start
+typedef struct {
+    size_t *items;
+    size_t size;
+    size_t count;
+} Checkpoints;
+
+// Find in the viewer, searched on its own thread, see `viewer_find_thread()`
+typedef struct {
+    pthread_t thread;
+    bool running;       // thread is running or waiting to be joined
+    atomic_bool done;
+    atomic_bool cancel;
+    const char *data;
+    size_t size;
+    char *needle;
+    size_t len;
+    size_t from;        // searched up to the end, then from the start
+    size_t hit;         // SEARCH_NOT_FOUND when there's none
+} ViewerFind;
+
+// read-only view of a memory mapped file, used instead of `Buffer` + `Lines`
+// for files too big to edit, see `editor_viewer_open()`
+typedef struct {
+    bool active;
+    int fd;
+    const char *data;
+    size_t size;
+
+    // built progressively by the index thread, guarded by Editor.lock
+    pthread_t thread;
+    bool threadRunning;
+    atomic_bool cancel;
+    Checkpoints checkpoints;
+    size_t indexedPos;  // every line starting before this has been counted
+    size_t lineCount;   // lines seen by the index thread so far
+    bool indexed;       // index thread reached the end
+
+    size_t topPos;      // byte offset of the first visible line
+    size_t topLine;     // its line index, VIEWER_LINE_UNKNOWN when not indexed yet
+
+    size_t matchPos;    // last search result
+    size_t matchLen;
+    ViewerFind find;
+
+    size_t gotoLine;
+    bool gotoPending;   // the index thread hasn't got to `gotoLine` yet
+} Viewer;
+
+typedef enum {
+    PROMPT_NONE = 0,
+    PROMPT_GOTO,
+    PROMPT_FIND,
+    PROMPT_REGEX,
+    PROMPT_REPLACE,         // asks for the text to replace
+    PROMPT_REPLACE_WITH,    // then for what to replace it with
+    PROMPT_RECOVER,
+    PROMPT_OPEN,            // file picker, see `editor_picker_open()`
+} PromptKind;
+
+typedef enum {
+    PROMPT_TYPING,      // nothing happened
+    PROMPT_CHANGED,     // text changed
+    PROMPT_SUBMITTED,   // enter pressed
+    PROMPT_CANCELLED,   // escape pressed, prompt closed
+} PromptResult;
+
+// where Ctrl+G or `file:line:col` goes
+typedef struct {
+    bool byOffset;  // to `offset`, otherwise to `line` and `col`, both from 1 (col 0 when not given)
+    size_t line;
+    size_t col;
+    size_t offset;
+} Location;
+
+// single line text input at the bottom of the window
+typedef struct {
+    char *items; // typed text, always null terminated
+    size_t size;
+    size_t count;
+
+    PromptKind kind;
+    const char *label;
+} Prompt;
+
+// set of bytes, 1 bit each
+typedef struct {
+    uint64_t bits[4];
+} ByteClass;
+
+typedef struct {
+    ByteClass *items;
+    size_t size;
+    size_t count;
+} ByteClasses;
+
+typedef enum {
+    RE_CLASS,           // consumes a byte of classes[x]
+    RE_SPLIT,           // continues at both x and y
+    RE_JMP,             // continues at x
+    RE_ASSERT_START,    // only passes at the start of a line (the end, when reversed)
+    RE_ASSERT_END,      // only passes at the end of a line
+    RE_MATCH,
+} RegexOp;
+
+typedef struct {
+    RegexOp op;
+    int x;
+    int y;
+} RegexInst;
+
+// Thompson NFA, a match starts at instruction 0
+typedef struct {
+    RegexInst *items;
+    size_t size;
+    size_t count;
+} RegexProg;
+
+// compiled pattern, see `regex_compile()`
+typedef struct {
+    ByteClasses classes;
+    RegexProg forward;
+    RegexProg reverse;  // for the reversed text, finds where a match starts
+} Regex;
+
+typedef struct {
+    size_t pos;
+    size_t len;
+} RegexMatch;
+
+typedef struct {
+    RegexMatch *items;
+    size_t size;
+    size_t count;
+} RegexMatches;
+
+// bytes that move a DFA out of its mid-line start state, see `regex_skip_update()`
+typedef struct {
+    int32_t state;      // -1 when there are too many of them
+    size_t flushes;     // Dfa.flushes it was worked out at
+    unsigned char bytes[REGEX_SKIP_BYTES];
+    int count;
+} RegexSkip;
+
+// a bit per position of a line, see `regex_match_starts()`
+typedef struct {
+    uint64_t *items;
+    size_t size;
+    size_t count;
+} RegexStarts;
+
+// regex search running on a background thread, see `regex_thread()`
+typedef struct {
+    pthread_t thread;
+    bool running;
+    atomic_bool cancel;
+    Regex re;
+    bool valid;             // re holds a compiled pattern
+    const char *error;      // why the pattern didn't compile
+    const char *data;       // searched text, nothing modifies it while the thread runs
+    size_t size;
+    size_t from;            // the thread starts here, always at a line start
+    bool stale;             // text changed, search again from `from`
+
+    pthread_mutex_t lock;   // guards matches and count
+    RegexMatches matches;   // sorted, only the first REGEX_MAX_STORED are kept
+    size_t count;           // found so far
+    atomic_size_t done;     // text before this has been searched
+    atomic_bool finished;
+} RegexSearch;
+
+// what word motion treats a byte as
+typedef enum {
+    WORD_PUNCT,
+    WORD_SPACE,
+    WORD_BREAK, // '\n' and '\r'
+    WORD_IDENT,
+} WordClass;
+
+// what a byte can start, the lexer looks it up for every byte
+typedef enum {
+    SYNTAX_OTHER,
+    SYNTAX_SPACE,
+    SYNTAX_IDENT,
+    SYNTAX_DIGIT,
+    SYNTAX_DOT,
+    // the ones from here on may start a string or a comment
+    SYNTAX_QUOTE,
+    SYNTAX_SLASH,
+} SyntaxClass;
+
+// lexer state at the start of a line
+typedef enum {
+    LEX_NORMAL,
+    LEX_COMMENT,        // inside /* */
+    LEX_STRING,         // a string continued by a backslash at the end of the line before
+    LEX_LINE_COMMENT,   // same for a // comment
+    LEX_UNKNOWN = 0xff, // not lexed since the line or the one before changed
+} LexState;
+
+typedef enum {
+    TOKEN_TEXT,
+    TOKEN_KEYWORD,
+    TOKEN_NUMBER,
+    TOKEN_STRING,
+    TOKEN_COMMENT,
+    TOKEN_PREPROC,
+} TokenKind;
+
+typedef struct {
+    uint8_t *items;
+    size_t size;
+    size_t count;
+} LexStates;
+
+// syntax highlighting of C-like files, see `editor_syntax_update()`
+typedef struct {
+    bool enabled;           // the file has one of the extensions in `syntax_language_known()`
+    uint8_t classes[256];   // SyntaxClass of every byte
+    LexStates states;       // LexState at the start of every row
+    atomic_size_t known;    // states before this are right, written by the job while it runs
+
+    // rows changed since the last update: the ones before `first` and the last `tail` didn't
+    bool changed;
+    size_t first;
+    size_t tail;
+
+    pthread_t thread;       // lexes what an update didn't get to, see `syntax_thread()`
+    bool running;
+    atomic_bool cancel;
+    const char *data;       // lexed text, nothing modifies it while the thread runs
+    const Line *lines;
+    size_t lineCount;
+
+    Buffer kinds;           // TokenKind of every byte of the row being drawn
+} Syntax;
+
+// brackets of a run of the buffer, per kind: ( [ {
+typedef struct {
+    size_t len;
+    int32_t net[3]; // opening minus closing ones
+    int32_t low[3]; // lowest that gets going through it, at most 0
+} BracketSummary;
+
+typedef struct {
+    BracketSummary *items;
+    size_t size;
+    size_t count;
+} BracketSummaries;
+
+// where the bracket depth goes in the buffer, see `editor_bracket_match()`
+typedef struct {
+    bool built;
+    BracketSummaries chunks;
+    BracketSummaries tree;  // chunk i at leaves + i, every node the two below it joined
+    size_t leaves;
+
+    // bytes changed since the last lookup: the ones before `first` and the last `tail` didn't
+    bool changed;
+    size_t first;
+    size_t tail;
+} BracketIndex;
+
+typedef struct {
+    size_t *items;
+    size_t size;
+    size_t count;
+} Rows;
+
+typedef struct {
+    uint64_t hash;
+    size_t offset;      // of the word in WordIndex.text
+    uint32_t len;
+    uint32_t count;     // occurrences in the buffer, words that drop to 0 stay until the next file
+    uint32_t rank;      // in WordIndex.sorted, WORD_UNSORTED while in `recent`
+    bool touched;       // count changed since the tree was, see `words_tree_refresh()`
+} WordEntry;
+
+typedef struct {
+    WordEntry *items;
+    size_t size;
+    size_t count;
+} WordEntries;
+
+typedef struct {
+    uint32_t *items;
+    size_t size;
+    size_t count;
+} WordIds;
+
+typedef struct {
+    uint64_t prefix;    // see `word_prefix()`
+    uint32_t id;
+} WordKey;
+
+// identifiers in the buffer with how often they appear, see `editor_complete()`
+typedef struct {
+    WordEntries entries;
+    Buffer text;        // the words of the entries back to back
+    uint32_t *slots;    // hash table of entry index + 1, 0 is empty
+    size_t slotCount;   // power of 2, at most half full
+    WordIds sorted;     // entries in byte order, for prefix ranges
+    WordIds recent;     // entries added since the last merge, unsorted
+    uint32_t *best;     // highest count under each node, sorted word i at leaves + i
+    size_t leaves;
+    WordIds touched;    // sorted entries whose count the tree doesn't have yet
+
+    // buffer[first, count - tail) isn't counted, its words start and end inside it
+    bool changed;
+    size_t first;
+    size_t tail;
+
+    // counts it in the background on a big file, guarded like `Syntax`
+    pthread_t thread;
+    bool running;
+    atomic_bool cancel;
+    atomic_bool finished;
+    const uint8_t *classes;
+    const char *data;
+    size_t end;
+} WordIndex;
+
+// the list Ctrl+Space opens under the cursor
+typedef struct {
+    bool active;
+    size_t start;       // of the word being completed
+    uint32_t items[COMPLETION_ITEMS]; // entries, most frequent first
+    size_t count;
+    size_t selected;
+} Completion;
+
+// a line of a .gitignore
+typedef struct {
+    char *pattern;
+    bool negate;    // "!pattern" takes back what an earlier line ignored
+    bool dirOnly;   // "pattern/" only ignores directories
+    bool anchored;  // had a '/', matched against the path from the .gitignore's directory
+    int flags;      // for fnmatch
+} IgnoreRule;
+
+// the lines of one .gitignore, the ones of the directories above in `parent`
+typedef struct IgnoreRules {
+    struct IgnoreRules *parent;
+    size_t dirLen;  // of the path of its directory
+    IgnoreRule *items;
+    size_t size;
+    size_t count;
+} IgnoreRules;
+
+typedef struct {
+    IgnoreRules **items;
+    size_t size;
+    size_t count;
+} IgnoreSets;
+
+// directory waiting to be read
+typedef struct {
+    char *path;     // from the working directory with a trailing '/', "" for itself
+    IgnoreRules *rules;
+} WalkDir;
+
+typedef struct {
+    WalkDir *items;
+    size_t size;
+    size_t count;
+} WalkDirs;
+
+// walks the working directory on a few threads, see `walker_thread()`
+typedef struct {
+    pthread_t threads[PICKER_MAX_WORKERS];
+    int threadCount;
+    bool running;       // threads to be joined
+
+    // guards everything below
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    WalkDirs dirs;
+    int busy;           // threads reading a directory
+    bool done;
+    bool cancel;
+    Buffer found;       // paths found since the picker took them, null terminated
+    IgnoreSets rules;   // freed once the walk is over
+} Walker;
+
+typedef struct {
+    size_t offset;      // in FileList.text and FileList.lower
+    uint32_t len;
+    uint32_t name;      // where the file name starts
+    uint64_t mask;      // see `picker_char_mask()`
+} PickerFile;
+
+typedef struct {
+    PickerFile *items;
+    size_t size;
+    size_t count;
+} PickerFiles;
+
+typedef struct {
+    PickerFiles files;
+    Buffer text;        // the paths back to back, null terminated
+    Buffer lower;       // and lowercased for matching
+} FileList;
+
+typedef struct {
+    uint32_t *items;
+    size_t size;
+    size_t count;
+} FileIds;
+
+typedef struct {
+    uint32_t file;
+    int score;
+} PickerMatch;
+
+// Ctrl+O, see `editor_picker_open()`
+typedef struct {
+    Walker walker;
+    FileList list;
+    FileList next;      // a new walk, `list` is shown until it's done
+    bool streaming;     // the walk adds to `list` directly, there was none yet
+    double walkTime;    // when `list` was walked
+    Buffer taken;       // `Walker.found` swapped out to add to the list
+
+    Buffer query;       // lowercased, what the matches are for
+    uint64_t queryMask;
+    FileIds matches;    // files known to match `query`
+    FileIds candidates; // files that matched less of it, from `candidatePos` on still to check
+    size_t candidatePos;
+    size_t filePos;     // files of the list from here on still to check
+    PickerMatch top[PICKER_ROWS]; // best matches so far, best first
+    size_t topCount;
+    size_t selected;
+
+    char *chosen;       // to be opened once the editor lock is released
+    char *opened;       // path of the file it opened, `Editor.filename` points here
+} Picker;
+
+// rows of the empty lines, sorted, see `editor_cursor_to_next_empty_line()`
+typedef struct {
+    bool built;
+    Rows rows;
+    size_t lineCount; // of the lines the rows were taken from
+
+    // rows changed since the last lookup: the ones before `first` and the last `tail` didn't
+    bool changed;
+    size_t first;
+    size_t tail;
+} BlankLines;
+
+// state of the find bar in the editor, see `editor_find_update()`
+typedef struct {
+    size_t origin;      // cursor when the find bar opened, typing searches from there
+    size_t matchPos;    // current match, selected in the buffer
+    size_t matchLen;    // 0 when there's none
+    Buffer needle;      // text to replace, while asking for the replacement
+} Find;
+
+// a run of the buffer that still matches the original file byte for byte
+typedef struct {
+    size_t pos;     // offset in the buffer
+    size_t origin;  // offset in the original file
+    size_t len;
+} OriginRun;
+
+typedef struct {
+    OriginRun *items;
+    size_t size;
+    size_t count;
+} OriginRuns;
+
+// the file the buffer was loaded from (or last saved to)
+// the fd stays open so its contents survive the file being renamed over
+typedef struct {
+    int fd;
+    off_t size;
+    struct timespec mtime;
+    OriginRuns runs; // sorted by pos, never overlapping
+} Origin;
+
+// piece of the output file: either memory or a range of another file
+typedef struct {
+    const char *data;   // NULL for file spans
+    int fd;
+    off_t offset;
+    size_t len;
+} SaveSpan;
+
+typedef struct {
+    SaveSpan *items;
+    size_t size;
+    size_t count;
+} SaveSpans;
+
+// background save state
+// the save thread writes a frozen snapshot of the buffer while editing
+// continues, see `editor_buffer_make_writable()` for the copy on write
+typedef struct {
+    pthread_t thread;
+    bool active;        // thread is running or waiting to be joined
+    atomic_bool done;
+
+    char *snapshot;     // buffer contents at the time of saving
+    size_t count;
+    bool ownsSnapshot;  // editor moved on to a copy, snapshot is freed after the save
+    char *path;
+    int error;          // errno of a failed save, 0 otherwise
+    double startTime;
+
+    // copy of the origin at the time of saving
+    int originFd;
+    off_t originSize;
+    struct timespec originMtime;
+    OriginRuns runs;
+    size_t copied;      // bytes copied from the original instead of written
+
+    BlockHashes hashes; // of the saved contents
+    size_t journalMark; // journal stream position of the snapshot
+    bool gzip;          // write the file compressed
+    Encoding encoding;  // write the file in this encoding
+    size_t lossy;       // characters the encoding couldn't represent
+} Saver;
+
 typedef struct {
     Color text;
     Color ui;
     Color bg;
     Color cursor;
     Color selection;
+    Color keyword;
+    Color string;
+    Color comment;
+    Color number;
+    Color preproc;
 } Colors;
 
 typedef struct {
@@ -84,6 +855,7 @@ typedef struct {
     bool cursor_file_end;
     bool cursor_prev_empty_line;
     bool cursor_next_empty_line;
+    bool cursor_matching_bracket;
     bool page_up;
     bool page_down;
     bool zoom_in;
@@ -95,6 +867,7 @@ typedef struct {
     bool enter;
     bool tab;
     bool select; // shift held down
+    bool block;  // alt held down, selections become column blocks
     bool select_all;
     bool escape;
     bool copy;
@@ -109,6 +882,38 @@ typedef struct {
     Buffer buffer;
     Lines  lines;
     Selection selection;
+    Carets carets;  // extra cursors, sorted, the edits apply to all of them
+    uint8_t wordClasses[256]; // WordClass of every byte
+
+    // guards buffer and lines while a background thread writes to them
+    pthread_mutex_t lock;
+    Loader loader;
+    Saver saver;
+    Origin origin;
+    BlockHashes diskHashes;
+    size_t diskSize;
+    bool compressed;    // gzip on disk, the buffer holds the decompressed text
+    Encoding encoding;  // of the file on disk, the buffer holds utf8
+    bool crlf;          // file uses "\r\n" line endings, new lines get them too
+    Journal journal;
+    Undo undo;
+    Watch watch;
+    bool modified; // edited since it was loaded or saved
+    Viewer viewer;
+
+    Prompt prompt;
+    Location gotoTarget;
+    bool gotoPending;   // the loader hasn't got to `gotoTarget` yet
+    Find find;
+    RegexSearch regex;
+    Syntax syntax;
+    BracketIndex brackets;
+    BlankLines blankLines;
+    WordIndex words;
+    Completion completion;
+    Picker picker;
+
+    Buffer scratch; // temporary null terminated copies for drawing
 
     int scrollX;
     int scrollY;
@@ -145,18 +950,88 @@ void notification_clear(Notification *n) {
     n->timer = 0.0;
 }
 
-size_t cursor_get_row(Cursor *c, Lines lines) {
+void prompt_open(Prompt *p, PromptKind kind, const char *label) {
+    p->kind = kind;
+    p->label = label;
+    p->count = 0;
+    da_reserve(p, DA_INITIAL_SIZE);
+    p->items[0] = '\0';
+}
+
+void prompt_close(Prompt *p) {
+    p->kind = PROMPT_NONE;
+}
+
+bool prompt_is_open(Prompt *p) {
+    return p->kind != PROMPT_NONE;
+}
+
+// "line[:col]" or "@offset", false for anything else
+bool location_parse(const char *s, Location *loc) {
+    char *end;
+    *loc = (Location) {0};
+    if (*s == '@')
+    {
+        if (!isdigit((unsigned char)s[1])) return false;
+        loc->byOffset = true;
+        loc->offset = strtoull(s + 1, &end, 10);
+        return *end == '\0';
+    }
+    if (!isdigit((unsigned char)*s)) return false;
+    loc->line = strtoull(s, &end, 10);
+    if (*end == ':')
+    {
+        if (!isdigit((unsigned char)end[1])) return false;
+        loc->col = strtoull(end + 1, &end, 10);
+    }
+    return *end == '\0' && loc->line >= 1;
+}
+
+// "file:line[:col]" or "file:@offset" on the command line, cuts the location
+// off `path`. Only when there's no file with the whole name
+bool location_from_path(char *path, Location *loc) {
+    if (access(path, F_OK) == 0) return false;
+    char *colon = strrchr(path, ':');
+    if (colon == NULL || colon == path || !location_parse(colon + 1, loc)) return false;
+    *colon = '\0';
+    if (loc->byOffset) return true;
+
+    Location line;
+    char *prev = strrchr(path, ':');
+    if (prev != NULL && prev != path && location_parse(prev + 1, &line) && line.col == 0)
+    {
+        *prev = '\0';
+        loc->col = loc->line;
+        loc->line = line.line;
+    }
+    return true;
+}
+
+// binary search for the last line starting at or before `pos`
+size_t lines_find_row(Lines lines, size_t pos) {
     assert(lines.count > 0);
-    for (size_t i=0; i<lines.count; i++)
+    size_t lo = 0, hi = lines.count;
+    while (hi - lo > 1)
     {
-        Line line = lines.items[i];
-        if (c->pos >= line.start && c->pos <= line.end)
-            return i;
+        size_t mid = lo + (hi - lo)/2;
+        if (lines.items[mid].start <= pos)
+            lo = mid;
+        else
+            hi = mid;
     }
-    // HACK: might cause bugs later?
-    // - return last line as current row
-    //   if cursor isn't found in any line
-    return lines.count - 1;
+    return lo;
+}
+
+// same as lines_find_row for a `pos` on or after line `row`, walking forward
+size_t lines_find_row_from(Lines lines, size_t row, size_t pos) {
+    while (row + 1 < lines.count && lines.items[row + 1].start <= pos)
+        row++;
+    return row;
+}
+
+size_t cursor_get_row(Cursor *c, Lines lines) {
+    // NOTE: a cursor past the end of the buffer lands on the last line
+    return lines_find_row(lines, c->pos);
 }
 
 size_t cursor_get_col(Cursor *c, Lines lines) {
@@ -181,6 +1056,16 @@ int editor_measure_str(Editor *e, const char *str) {
     return width;
 }
 
+// range of rows currently inside the window: [first, last)
+void editor_visible_rows(Editor *e, size_t *first, size_t *last) {
+    const int top = -e->scrollY / e->fontSize;
+    const int rows = GetScreenHeight() / e->fontSize + 2;
+    *first = top > 0 ? (size_t)top : 0;
+    if (*first > e->lines.count) *first = e->lines.count;
+    *last = *first + rows;
+    if (*last > e->lines.count) *last = e->lines.count;
+}
+
 void editor_cursor_update(Editor *e) {
     // find current row
     e->c.row = cursor_get_row(&e->c, e->lines);
@@ -200,15 +1085,30 @@ void editor_cursor_update(Editor *e) {
     e->c.x = editor_measure_text(e, &e->buffer.items[currentLine.start], requiredSize) + e->leftMargin;
 }
 
+// length of the line ending starting at pos, 0 if there is none
+size_t buffer_newline_at(Buffer *b, size_t pos) {
+    if (pos < b->count && b->items[pos] == '\n') return 1;
+    if (pos + 1 < b->count && b->items[pos] == '\r' && b->items[pos + 1] == '\n') return 2;
+    return 0;
+}
+
+// length of the line ending right before pos, 0 if there is none
+size_t buffer_newline_before(Buffer *b, size_t pos) {
+    if (pos == 0 || b->items[pos - 1] != '\n') return 0;
+    return pos >= 2 && b->items[pos - 2] == '\r' ? 2 : 1;
+}
+
 void editor_cursor_right(Editor *e) {
     if (e->buffer.count == 0) return;
     if (e->c.pos > e->buffer.count - 1) return;
-    e->c.pos++;
+    const size_t newline = buffer_newline_at(&e->buffer, e->c.pos);
+    e->c.pos += newline ? newline : 1;
 }
 
 void editor_cursor_left(Editor *e) {
     if (e->c.pos == 0) return;
-    e->c.pos--;
+    const size_t newline = buffer_newline_before(&e->buffer, e->c.pos);
+    e->c.pos -= newline ? newline : 1;
 }
 
 void editor_cursor_down(Editor *e) {
@@ -235,50 +1135,104 @@ void editor_cursor_up(Editor *e) {
         e->c.pos = prevLine.end;
 }
 
-void editor_cursor_to_next_word(Editor *e) {
-    bool foundWhitespace = false;
-
-    for (size_t i=e->c.pos; i<e->buffer.count; i++)
+void word_classes_init(uint8_t *classes) {
+    for (int c=0; c<256; c++)
     {
-        const char c = e->buffer.items[i];
-        const bool checkWhitespace = c==' ' || c=='\n';
+        WordClass class = WORD_PUNCT;
+        if (isalnum(c) || c == '_' || c >= 0x80) class = WORD_IDENT;
+        else if (c == ' ' || c == '\t' || c == '\v' || c == '\f') class = WORD_SPACE;
+        else if (c == '\n' || c == '\r') class = WORD_BREAK;
+        classes[c] = class;
+    }
+}
 
-        if (checkWhitespace)
-            foundWhitespace = true;
+#ifdef __SSE2__
+// bytes of `a` in [lo, lo + n)
+__m128i bytes_in_range(__m128i a, unsigned char lo, unsigned char n) {
+    const __m128i biased = _mm_add_epi8(_mm_sub_epi8(a, _mm_set1_epi8(lo)), _mm_set1_epi8((char)0x80));
+    return _mm_cmplt_epi8(biased, _mm_set1_epi8((char)(0x80 + n)));
+}
 
-        // check if char is whitespace
-        if (foundWhitespace && ( !checkWhitespace || c=='\n' ))
-        {
-            e->c.pos = i;
-            return;
-        }
+// bit k set when byte k of `a` is of the class, the same as `word_classes_init()` says
+uint32_t word_class_mask(__m128i a, WordClass class) {
+    const __m128i space = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(a, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(a, _mm_set1_epi8('\t'))),
+                                       bytes_in_range(a, '\v', 2));
+    const __m128i lineBreak = _mm_or_si128(_mm_cmpeq_epi8(a, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(a, _mm_set1_epi8('\r')));
+    const __m128i letter = bytes_in_range(_mm_or_si128(a, _mm_set1_epi8(0x20)), 'a', 26);
+    const __m128i ident = _mm_or_si128(_mm_or_si128(letter, bytes_in_range(a, '0', 10)),
+                                       _mm_or_si128(_mm_cmpeq_epi8(a, _mm_set1_epi8('_')), _mm_cmplt_epi8(a, _mm_setzero_si128())));
+    switch (class)
+    {
+    case WORD_SPACE: return _mm_movemask_epi8(space);
+    case WORD_BREAK: return _mm_movemask_epi8(lineBreak);
+    case WORD_IDENT: return _mm_movemask_epi8(ident);
+    case WORD_PUNCT: break;
     }
-    // if no next word found
-    const Line line = e->lines.items[e->c.row];
-    e->c.pos = line.end;
+    return ~_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(space, lineBreak), ident)) & 0xffff;
 }
+#endif
 
-void editor_cursor_to_prev_word(Editor *e) {
-    bool foundWhitespace = false;
-    
-    for (size_t i=e->c.pos; i!=0; i--)
+// end of the run of bytes of the same class as s[i], at most `end`.
+// Long runs, like indentation or a minified line, go 16 bytes at a time
+size_t word_run_end(const uint8_t *classes, const char *s, size_t i, size_t end) {
+    const WordClass class = classes[(unsigned char)s[i]];
+#ifdef __SSE2__
+    for (; i + 16 <= end; i += 16)
     {
-        const char c = e->buffer.items[i-1];
-        const bool checkWhitespace = c==' ' || c=='\n';
-
-        if (checkWhitespace)
-            foundWhitespace = true;
+        const uint32_t other = ~word_class_mask(_mm_loadu_si128((const __m128i *)(s + i)), class) & 0xffff;
+        if (other != 0) return i + __builtin_ctz(other);
+    }
+#endif
+    while (i < end && classes[(unsigned char)s[i]] == class) i++;
+    return i;
+}
 
-        // check if char is whitespace
-        if (foundWhitespace && ( !checkWhitespace || c=='\n' ))
-        {
-            e->c.pos = i;
-            return;
-        }
+// start of the run of bytes of the same class as s[i - 1], at least `start`
+size_t word_run_start(const uint8_t *classes, const char *s, size_t start, size_t i) {
+    const WordClass class = classes[(unsigned char)s[i - 1]];
+#ifdef __SSE2__
+    for (; i >= start + 16; i -= 16)
+    {
+        const uint32_t other = ~word_class_mask(_mm_loadu_si128((const __m128i *)(s + i - 16)), class) & 0xffff;
+        if (other != 0) return i + 16 - __builtin_clz(other);
     }
-    // no prev word found
-    const Line line = e->lines.items[e->c.row];
-    e->c.pos = line.start;
+#endif
+    while (i > start && classes[(unsigned char)s[i - 1]] == class) i--;
+    return i;
+}
+
+// start of the next word, or of the next line at the end of one.
+// Identifiers and runs of punctuation are words of their own
+size_t editor_word_next(Editor *e, size_t pos) {
+    const uint8_t *classes = e->wordClasses;
+    const char *buf = e->buffer.items;
+    const size_t count = e->buffer.count;
+    if (pos == count) return pos;
+    const size_t newline = buffer_newline_at(&e->buffer, pos);
+    if (newline > 0) return pos + newline;
+    if (classes[(unsigned char)buf[pos]] != WORD_SPACE) pos = word_run_end(classes, buf, pos, count);
+    if (pos < count && classes[(unsigned char)buf[pos]] == WORD_SPACE) pos = word_run_end(classes, buf, pos, count);
+    return pos;
+}
+
+// start of the word before, or the end of the line before at the start of one
+size_t editor_word_prev(Editor *e, size_t pos) {
+    const uint8_t *classes = e->wordClasses;
+    const char *buf = e->buffer.items;
+    if (pos == 0) return pos;
+    const size_t newline = buffer_newline_before(&e->buffer, pos);
+    if (newline > 0) return pos - newline;
+    if (classes[(unsigned char)buf[pos - 1]] == WORD_SPACE) pos = word_run_start(classes, buf, 0, pos);
+    if (pos > 0 && classes[(unsigned char)buf[pos - 1]] != WORD_BREAK) pos = word_run_start(classes, buf, 0, pos);
+    return pos;
+}
+
+void editor_cursor_to_next_word(Editor *e) {
+    e->c.pos = editor_word_next(e, e->c.pos);
+}
+
+void editor_cursor_to_prev_word(Editor *e) {
+    e->c.pos = editor_word_prev(e, e->c.pos);
 }
 
 void editor_cursor_to_line_start(Editor *e) {
@@ -304,7 +1258,7 @@ void editor_cursor_to_last_line(Editor *e) {
 // returns if action was successfull or not
 bool editor_cursor_to_line_number(Editor *e, size_t lineNumber) {
     // TODO: for now just move to line start, maybe it is the behaviour i want lol
-    if (lineNumber < 1 || lineNumber >= e->lines.count) return false;
+    if (lineNumber < 1 || lineNumber > e->lines.count) return false;
 
     size_t lineIndex = lineNumber - 1;
     Line requiredLine = e->lines.items[lineIndex];
@@ -312,427 +1266,6970 @@ bool editor_cursor_to_line_number(Editor *e, size_t lineNumber) {
     return true;
 }
 
-void editor_cursor_to_next_empty_line(Editor *e) {
-    for (size_t i=e->c.row+1; i<e->lines.count; i++)
+// fast non-cryptographic 64 bit hash, four independent lanes
+uint64_t hash_bytes(const char *data, size_t len) {
+    const uint64_t k = 0x9E3779B97F4A7C15ull;
+    uint64_t h[4] = { k ^ len, k + 1, k + 2, k + 3 };
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
     {
-        Line line = e->lines.items[i];
-        size_t lineSize = line.end - line.start;
-        if (lineSize == 0)
+        for (int lane=0; lane<4; lane++)
         {
-            e->c.pos = line.start;
-            return;
+            uint64_t w;
+            memcpy(&w, data + i + lane*8, 8);
+            h[lane] = (h[lane] ^ w) * 0xff51afd7ed558ccdull;
+            h[lane] ^= h[lane] >> 29;
         }
     }
-    // move to last line if no next empty line found
-    Line lastLine = e->lines.items[e->lines.count - 1];
-    e->c.pos = lastLine.start;
-    return;
+    uint64_t tail = 0;
+    for (; i<len; i++)
+        tail = (tail ^ (unsigned char)data[i]) * 0x100000001b3ull;
+    uint64_t r = h[0] ^ (h[1] * 3) ^ (h[2] * 5) ^ (h[3] * 7) ^ (tail * k);
+    r ^= r >> 33;
+    r *= 0xc4ceb9fe1a85ec53ull;
+    r ^= r >> 33;
+    return r;
 }
 
-void editor_cursor_to_prev_empty_line(Editor *e) {
-    if (e->c.row == 0 || e->c.row >= e->lines.count) return;
-    for (size_t i=e->c.row-1; i!=0; i--)
+// rehashes the blocks of buf[0, count) starting with the one containing `from`
+void block_hashes_update(BlockHashes *hashes, const char *buf, size_t count, size_t from) {
+    size_t block = from / DISK_BLOCK_SIZE;
+    if (block > hashes->count) block = hashes->count;
+    hashes->count = block;
+    for (size_t pos = block * DISK_BLOCK_SIZE; pos < count; pos += DISK_BLOCK_SIZE)
     {
-        Line line = e->lines.items[i];
-        size_t lineSize = line.end - line.start;
-        if (lineSize == 0)
-        {
-            e->c.pos = line.start;
-            return;
-        }
+        size_t len = count - pos;
+        if (len > DISK_BLOCK_SIZE) len = DISK_BLOCK_SIZE;
+        da_append(hashes, hash_bytes(buf + pos, len));
     }
-    // move to first line if no previous empty line found
-    Line firstLine = e->lines.items[0];
-    e->c.pos = firstLine.start;
-    return;
 }
 
-void editor_calculate_lines(Editor *e) {
-    da_free(&e->lines);
-    Line line = {0};
-    line.start = 0;
-    for (size_t i=0; i<e->buffer.count; i++)
+// appends every line terminated inside buf[from, to) to `lines`
+// `lineStart` is where the currently open line began
+// returns the start of the line left open at `to`
+// NOTE: the '\r' of a "\r\n" line ending is not part of the line
+size_t lines_index_range(Lines *lines, const char *buf, size_t lineStart, size_t from, size_t to) {
+    const char *p = buf + from;
+    const char *end = buf + to;
+    while (p < end && (p = memchr(p, '\n', end - p)) != NULL)
     {
-        char c = e->buffer.items[i];
-        if (c == '\n')
-        {
-            line.end = i;
-            da_append(&e->lines, line);
-            line.start = i+1;
-        }
+        size_t i = p - buf;
+        const size_t lineEnd = i > lineStart && buf[i - 1] == '\r' ? i - 1 : i;
+        da_append(lines, ((Line){ lineStart, lineEnd }));
+        lineStart = i + 1;
+        p++;
     }
+    return lineStart;
+}
+
+void editor_calculate_lines(Editor *e) {
+    da_free(&e->lines);
+    size_t lineStart = lines_index_range(&e->lines, e->buffer.items, 0, 0, e->buffer.count);
 
     // there's always atleast one line 
     // a lot of code depends upon that assumption
     da_append(&e->lines, ((Line){
-        line.start,
+        lineStart,
         e->buffer.count,
     }));
 }
 
-// Initialize Editor struct
-void editor_init(Editor *e) {
-    e->c = (Cursor) {0};
-    e->buffer = (Buffer) {0};
-    da_init(&e->buffer);
-    e->lines = (Lines) {0};
-    da_init(&e->lines);
+// forgets the previous origin and takes ownership of `fd` (or -1 for none)
+// with the first `count` bytes of the buffer matching it
+void editor_origin_reset(Editor *e, int fd, size_t count) {
+    Origin *o = &e->origin;
+    if (o->fd >= 0) close(o->fd);
+    o->fd = fd;
+    o->runs.count = 0;
 
-    e->scrollX = 0;
-    e->scrollY = 0;
-    
-    e->filename = NULL;
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        da_free(&o->runs);
+        return;
+    }
+    o->size = st.st_size;
+    o->mtime = st.st_mtim;
+    if (count > 0)
+        da_append(&o->runs, ((OriginRun){ 0, 0, count }));
+}
 
-    e->inputs = (Inputs) {0};
+// keeps the origin runs in sync with a buffer replace
+// runs overlapping the removed range get trimmed or split, later ones shift
+void origin_runs_replace(OriginRuns *runs, size_t pos, size_t removeLen, size_t len) {
+    const size_t removeEnd = pos + removeLen;
+    OriginRuns out;
+    da_init(&out);
+    for (size_t i=0; i<runs->count; i++)
+    {
+        OriginRun run = runs->items[i];
+        const size_t runEnd = run.pos + run.len;
 
-    e->notif = (Notification) {0};
-    da_init(&e->notif);
+        if (runEnd <= pos)
+        {
+            da_append(&out, run);
+            continue;
+        }
+        if (run.pos < pos)
+            da_append(&out, ((OriginRun){ run.pos, run.origin, pos - run.pos }));
+        if (runEnd > removeEnd)
+        {
+            const size_t skip = run.pos < removeEnd ? removeEnd - run.pos : 0;
+            da_append(&out, ((OriginRun){
+                run.pos + skip - removeLen + len,
+                run.origin + skip,
+                run.len - skip,
+            }));
+        }
+    }
+    da_free(runs);
+    *runs = out;
+}
 
-#ifdef BUILD_RELEASE
-    e->font = LoadFont_Font();
-#else
-    e->font = LoadFont("monogram.ttf");
+// `origin_runs_replace()` for a batch of edits in one pass
+// a byte moves with the edits ending at or before it
+void origin_runs_replace_many(OriginRuns *runs, const Edit *edits, size_t n) {
+    OriginRuns out;
+    da_init(&out);
+    size_t k = 0;
+    size_t shift = 0; // of the bytes after edits[0, k), wraps when negative
+    for (size_t i=0; i<runs->count; i++)
+    {
+        const OriginRun run = runs->items[i];
+        const size_t runEnd = run.pos + run.len;
+        size_t at = run.pos;
+        while (at < runEnd)
+        {
+            for (; k < n && edits[k].pos + edits[k].removeLen <= at; k++)
+                shift = shift - edits[k].removeLen + edits[k].len;
+            if (k < n && edits[k].pos <= at)
+            {
+                at = edits[k].pos + edits[k].removeLen; // removed
+                continue;
+            }
+            const size_t pieceEnd = k < n && edits[k].pos < runEnd ? edits[k].pos : runEnd;
+            da_append(&out, ((OriginRun){ at + shift, run.origin + (at - run.pos), pieceEnd - at }));
+            at = pieceEnd;
+        }
+    }
+    da_free(runs);
+    *runs = out;
+}
+
+// -------------------
+// Text encodings
+// the buffer is always utf8, other encodings are converted on load and save
+
+// number of leading bytes of data[0, len) that are plain ascii
+size_t ascii_prefix(const unsigned char *data, size_t len) {
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 64 <= len; i += 64)
+    {
+        const __m128i a = _mm_loadu_si128((const __m128i *)(data + i));
+        const __m128i b = _mm_loadu_si128((const __m128i *)(data + i + 16));
+        const __m128i c = _mm_loadu_si128((const __m128i *)(data + i + 32));
+        const __m128i d = _mm_loadu_si128((const __m128i *)(data + i + 48));
+        if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d))) != 0) break;
+    }
+    for (; i + 16 <= len; i += 16)
+    {
+        const int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(data + i)));
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
 #endif
-    e->fontSize = DEFAULT_FONTSIZE;
-    e->fontSpacing = 0;
-    SetTextLineSpacing(e->fontSize);
+    while (i < len && data[i] < 0x80) i++;
+    return i;
+}
 
-    e->leftMargin = 0;
-    editor_calculate_lines(e); // NOTE: running this once results in there
-                               // being atleast one `Line`
+// validates data[0, len) as utf8, returns the number of bytes checked
+// it stops early at an invalid sequence (`*invalid` is set) or at a sequence
+// cut off by the end of the data (`*invalid` is not set)
+size_t utf8_validate(const unsigned char *data, size_t len, bool *invalid) {
+    *invalid = false;
+    size_t i = 0;
+    while (i < len)
+    {
+        const unsigned char c = data[i];
+        if (c < 0x80)
+        {
+            // long ascii runs go through the vector loop
+            if (i + 16 <= len && data[i + 1] < 0x80) i += ascii_prefix(data + i, len - i);
+            else i++;
+            continue;
+        }
 
-    { // init colors
-        // default colors
-        e->colors = (Colors) {
-            .text = TEXT_COLOR,
-            .ui = UI_COLOR,
-            .bg = BG_COLOR,
-            .cursor = CURSOR_COLOR,
-            .selection = SELECTION_COLOR,
-        };
+        size_t n;
+        unsigned char lo = 0x80, hi = 0xBF; // range of the second byte
+        if (c >= 0xC2 && c <= 0xDF) n = 2;
+        else if (c >= 0xE0 && c <= 0xEF)
+        {
+            n = 3;
+            if (c == 0xE0) lo = 0xA0;       // overlong
+            if (c == 0xED) hi = 0x9F;       // surrogates
+        }
+        else if (c >= 0xF0 && c <= 0xF4)
+        {
+            n = 4;
+            if (c == 0xF0) lo = 0x90;       // overlong
+            if (c == 0xF4) hi = 0x8F;       // past U+10FFFF
+        }
+        else
+        {
+            *invalid = true;
+            return i;
+        }
+        if (i + n > len) return i; // cut off
+
+        bool ok = data[i + 1] >= lo && data[i + 1] <= hi;
+        if (n > 2) ok &= (data[i + 2] & 0xC0) == 0x80;
+        if (n > 3) ok &= (data[i + 3] & 0xC0) == 0x80;
+        if (!ok)
+        {
+            *invalid = true;
+            return i;
+        }
+        i += n;
     }
+    return i;
 }
 
-void editor_deinit(Editor *e) {
-    da_free(&e->buffer);
-    da_free(&e->lines);
-    da_free(&e->notif);
-#ifndef BUILD_RELEASE
-    UnloadFont(e->font);
+// guesses the encoding from the first bytes of a file
+Encoding encoding_detect(const unsigned char *data, size_t len) {
+    if (len >= 3 && data[0] == 0xEF && data[1] == 0xBB && data[2] == 0xBF) return ENCODING_UTF8_BOM;
+    if (len >= 2 && data[0] == 0xFF && data[1] == 0xFE) return ENCODING_UTF16LE_BOM;
+    if (len >= 2 && data[0] == 0xFE && data[1] == 0xFF) return ENCODING_UTF16BE_BOM;
+
+    // no BOM: mostly-ascii utf16 text has a zero in every other byte
+    size_t zeros[2] = {0};
+    if (len > 4096) len = 4096;
+    for (size_t i=0; i<len; i++)
+        if (data[i] == 0) zeros[i & 1]++;
+    if (len >= 16 && zeros[1] > len / 4 && zeros[0] < len / 64) return ENCODING_UTF16LE;
+    if (len >= 16 && zeros[0] > len / 4 && zeros[1] < len / 64) return ENCODING_UTF16BE;
+    return ENCODING_UTF8;
+}
+
+void utf8_append(Buffer *out, uint32_t cp) {
+    if (cp < 0x80) da_append(out, (char)cp);
+    else if (cp < 0x800)
+    {
+        da_append(out, (char)(0xC0 | cp >> 6));
+        da_append(out, (char)(0x80 | (cp & 0x3F)));
+    }
+    else if (cp < 0x10000)
+    {
+        da_append(out, (char)(0xE0 | cp >> 12));
+        da_append(out, (char)(0x80 | (cp >> 6 & 0x3F)));
+        da_append(out, (char)(0x80 | (cp & 0x3F)));
+    }
+    else
+    {
+        da_append(out, (char)(0xF0 | cp >> 18));
+        da_append(out, (char)(0x80 | (cp >> 12 & 0x3F)));
+        da_append(out, (char)(0x80 | (cp >> 6 & 0x3F)));
+        da_append(out, (char)(0x80 | (cp & 0x3F)));
+    }
+}
+
+// converts data[0, len) in `enc` to utf8, appending to `out`
+void text_decode(Encoding enc, const char *data, size_t len, Buffer *out) {
+    const unsigned char *s = (const unsigned char *)data;
+    switch (enc)
+    {
+    case ENCODING_UTF8:
+    case ENCODING_UTF8_BOM:
+    {
+        const size_t skip = enc == ENCODING_UTF8_BOM && len >= 3 ? 3 : 0;
+        const size_t needed = out->count + len - skip;
+        da_reserve(out, needed);
+        memcpy(out->items + out->count, data + skip, len - skip);
+        out->count += len - skip;
+    } break;
+
+    case ENCODING_LATIN1:
+    {
+        // every byte is its own codepoint, the high half takes two bytes
+        const size_t needed = out->count + len * 2;
+        da_reserve(out, needed);
+        for (size_t i=0; i<len; )
+        {
+            const size_t n = ascii_prefix(s + i, len - i);
+            memcpy(out->items + out->count, s + i, n);
+            out->count += n;
+            i += n;
+            for (; i<len && s[i] >= 0x80; i++)
+            {
+                out->items[out->count++] = (char)(0xC0 | s[i] >> 6);
+                out->items[out->count++] = (char)(0x80 | (s[i] & 0x3F));
+            }
+        }
+    } break;
+
+    case ENCODING_UTF16LE:
+    case ENCODING_UTF16LE_BOM:
+    case ENCODING_UTF16BE:
+    case ENCODING_UTF16BE_BOM:
+    {
+        const bool be = enc == ENCODING_UTF16BE || enc == ENCODING_UTF16BE_BOM;
+        size_t i = (enc == ENCODING_UTF16LE_BOM || enc == ENCODING_UTF16BE_BOM) && len >= 2 ? 2 : 0;
+        const size_t needed = out->count + len / 2 * 3;
+        da_reserve(out, needed);
+        while (i + 1 < len)
+        {
+#ifdef __SSE2__
+            // 8 ascii code units at a time: the high bytes are zero
+            const __m128i highMask = _mm_set1_epi16(be ? 0x00FF : (short)0xFF00);
+            const __m128i asciiMask = _mm_set1_epi16(be ? (short)0x8000 : 0x0080);
+            while (i + 16 <= len)
+            {
+                __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+                if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(v, _mm_or_si128(highMask, asciiMask)), _mm_setzero_si128())) != 0xFFFF)
+                    break;
+                if (be) v = _mm_srli_epi16(v, 8);
+                _mm_storel_epi64((__m128i *)(out->items + out->count), _mm_packus_epi16(v, v));
+                out->count += 8;
+                i += 16;
+            }
+            if (i + 1 >= len) break;
 #endif
+            uint32_t cp = be ? (s[i] << 8 | s[i+1]) : (s[i+1] << 8 | s[i]);
+            i += 2;
+            if (cp >= 0xD800 && cp <= 0xDBFF && i + 1 < len)
+            {
+                const uint32_t lo = be ? (s[i] << 8 | s[i+1]) : (s[i+1] << 8 | s[i]);
+                if (lo >= 0xDC00 && lo <= 0xDFFF)
+                {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                    i += 2;
+                }
+            }
+            if (cp >= 0xD800 && cp <= 0xDFFF) cp = 0xFFFD; // unpaired surrogate
+            utf8_append(out, cp);
+        }
+    } break;
+    }
 }
 
-void editor_insert_char_at_cursor(Editor *e, char c) {
-    da_append(&e->buffer, '\0'); // increases count by one
-    // move memory from cursor to end right by one
-    char *src = e->buffer.items + e->c.pos;
-    char *dest = src + 1;
-    size_t len = e->buffer.count - 1 - e->c.pos;
+// decodes the utf8 sequence at s[0, len), broken ones become U+FFFD
+uint32_t utf8_decode(const unsigned char *s, size_t len, int *size) {
+    *size = 1;
+    if (s[0] < 0x80) return s[0];
+    bool invalid;
+    const size_t n = s[0] >= 0xF0 ? 4 : s[0] >= 0xE0 ? 3 : 2;
+    if (utf8_validate(s, n < len ? n : len, &invalid) != n) return 0xFFFD;
+    *size = n;
+    if (n == 2) return (s[0] & 0x1F) << 6 | (s[1] & 0x3F);
+    if (n == 3) return (s[0] & 0x0F) << 12 | (s[1] & 0x3F) << 6 | (s[2] & 0x3F);
+    return (s[0] & 0x07) << 18 | (s[1] & 0x3F) << 12 | (s[2] & 0x3F) << 6 | (s[3] & 0x3F);
+}
+
+// converts utf8 data[0, len) to `enc`, appending to `out`
+// returns the number of characters `enc` can't represent (written as '?')
+size_t text_encode(Encoding enc, const char *data, size_t len, Buffer *out) {
+    const unsigned char *s = (const unsigned char *)data;
+    size_t lossy = 0;
+    switch (enc)
+    {
+    case ENCODING_UTF8:
+    case ENCODING_UTF8_BOM:
+    {
+        const size_t needed = out->count + len + 3;
+        da_reserve(out, needed);
+        if (enc == ENCODING_UTF8_BOM)
+        {
+            memcpy(out->items + out->count, "\xEF\xBB\xBF", 3);
+            out->count += 3;
+        }
+        memcpy(out->items + out->count, data, len);
+        out->count += len;
+    } break;
+
+    case ENCODING_LATIN1:
+    case ENCODING_UTF16LE:
+    case ENCODING_UTF16LE_BOM:
+    case ENCODING_UTF16BE:
+    case ENCODING_UTF16BE_BOM:
+    {
+        const bool be = enc == ENCODING_UTF16BE || enc == ENCODING_UTF16BE_BOM;
+        const size_t unit = enc == ENCODING_LATIN1 ? 1 : 2;
+        const size_t needed = out->count + (len + 1) * unit;
+        da_reserve(out, needed);
+        if (enc == ENCODING_UTF16LE_BOM || enc == ENCODING_UTF16BE_BOM)
+        {
+            out->items[out->count++] = (char)(be ? 0xFE : 0xFF);
+            out->items[out->count++] = (char)(be ? 0xFF : 0xFE);
+        }
+        for (size_t i=0; i<len; )
+        {
+            if (enc == ENCODING_LATIN1)
+            {
+                const size_t n = ascii_prefix(s + i, len - i);
+                memcpy(out->items + out->count, s + i, n);
+                out->count += n;
+                i += n;
+                if (i == len) break;
+            }
 
-    memmove(dest, src, len);
-    // set the char on cursor pos
-    e->buffer.items[e->c.pos] = c;
+            int size;
+            uint32_t cp = utf8_decode(s + i, len - i, &size);
+            i += size;
 
-    // move cursor right by one character
-    e->c.pos++;
+            if (enc == ENCODING_LATIN1)
+            {
+                if (cp > 0xFF)
+                {
+                    cp = '?';
+                    lossy++;
+                }
+                out->items[out->count++] = (char)cp;
+                continue;
+            }
 
-    editor_calculate_lines(e);
+            uint16_t units[2] = { cp, 0 };
+            int n = 1;
+            if (cp >= 0x10000)
+            {
+                units[0] = 0xD800 + ((cp - 0x10000) >> 10);
+                units[1] = 0xDC00 + ((cp - 0x10000) & 0x3FF);
+                n = 2;
+            }
+            for (int k=0; k<n; k++)
+            {
+                out->items[out->count++] = (char)(be ? units[k] >> 8 : units[k] & 0xFF);
+                out->items[out->count++] = (char)(be ? units[k] & 0xFF : units[k] >> 8);
+            }
+        }
+    } break;
+    }
+    return lossy;
 }
 
-void editor_remove_char_before_cursor(Editor *e) {
-    if (e->c.pos == 0) return;
+const char *encoding_name(Encoding enc) {
+    switch (enc)
+    {
+    case ENCODING_UTF8:         return "UTF-8";
+    case ENCODING_UTF8_BOM:     return "UTF-8 with BOM";
+    case ENCODING_UTF16LE:
+    case ENCODING_UTF16LE_BOM:  return "UTF-16LE";
+    case ENCODING_UTF16BE:
+    case ENCODING_UTF16BE_BOM:  return "UTF-16BE";
+    case ENCODING_LATIN1:       return "Latin-1";
+    }
+    return "?";
+}
 
-    char *src = e->buffer.items + e->c.pos;
-    char *dest = e->buffer.items + e->c.pos - 1;
-    size_t len = e->buffer.count - e->c.pos;
-    memmove(dest, src, len);
-    
-    // set cursor position & buffer count
-    e->c.pos--;
-    e->buffer.count--;
+// -------------------
+// Substring search
+// patterns are found by comparing their first and last byte against 32
+// positions at once and verifying the candidates with memcmp
 
-    editor_calculate_lines(e);
+#define SEARCH_NOT_FOUND SIZE_MAX
+
+// first occurence of needle[0, m) in hay[0, n)
+size_t search_forward(const char *hay, size_t n, const char *needle, size_t m) {
+    if (m == 0 || m > n) return SEARCH_NOT_FOUND;
+    if (m == 1)
+    {
+        const char *p = memchr(hay, needle[0], n);
+        return p != NULL ? (size_t)(p - hay) : SEARCH_NOT_FOUND;
+    }
+
+    size_t i = 0;
+#ifdef __SSE2__
+    size_t misses = 0;
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[m - 1]);
+    for (; i + m - 1 + 32 <= n; i += 32)
+    {
+        const __m128i a0 = _mm_loadu_si128((const __m128i *)(hay + i));
+        const __m128i a1 = _mm_loadu_si128((const __m128i *)(hay + i + 16));
+        const __m128i b0 = _mm_loadu_si128((const __m128i *)(hay + i + m - 1));
+        const __m128i b1 = _mm_loadu_si128((const __m128i *)(hay + i + m - 1 + 16));
+        const __m128i e0 = _mm_and_si128(_mm_cmpeq_epi8(a0, first), _mm_cmpeq_epi8(b0, last));
+        const __m128i e1 = _mm_and_si128(_mm_cmpeq_epi8(a1, first), _mm_cmpeq_epi8(b1, last));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(e0) | (uint32_t)_mm_movemask_epi8(e1) << 16;
+        while (mask != 0)
+        {
+            const size_t at = i + __builtin_ctz(mask);
+            if (memcmp(hay + at + 1, needle + 1, m - 2) == 0) return at;
+            mask &= mask - 1;
+            misses++;
+        }
+        if (misses > SEARCH_MAX_MISSES + i / 16)
+        {
+            // the filter lets too much through (think "aaa...a"), glibc's
+            // memmem is Two-Way and stays linear
+            const char *p = memmem(hay + i + 32, n - i - 32, needle, m);
+            return p != NULL ? (size_t)(p - hay) : SEARCH_NOT_FOUND;
+        }
+    }
+#endif
+    for (; i + m <= n; i++)
+        if (hay[i] == needle[0] && hay[i + m - 1] == needle[m - 1] && memcmp(hay + i + 1, needle + 1, m - 2) == 0)
+            return i;
+    return SEARCH_NOT_FOUND;
 }
 
-void editor_remove_char_at_cursor(Editor *e) {
-    if (e->buffer.count == 0) return;
-    if (e->c.pos > e->buffer.count - 1) return;
+// last occurence of needle[0, m) in hay[0, n) by Knuth-Morris-Pratt over
+// both reversed, linear whatever the text. There's no memrmem to hand over to
+size_t search_backward_kmp(const char *hay, size_t n, const char *needle, size_t m) {
+    // fail[k]: longest proper border of the last k+1 bytes of the needle
+    size_t *fail = malloc(m * sizeof(*fail));
+    assert(fail != NULL);
+    fail[0] = 0;
+    for (size_t k=1, q=0; k<m; k++)
+    {
+        while (q > 0 && needle[m - 1 - k] != needle[m - 1 - q]) q = fail[q - 1];
+        if (needle[m - 1 - k] == needle[m - 1 - q]) q++;
+        fail[k] = q;
+    }
+
+    size_t hit = SEARCH_NOT_FOUND;
+    for (size_t j=n, q=0; j-- > 0;)
+    {
+        while (q > 0 && hay[j] != needle[m - 1 - q]) q = fail[q - 1];
+        if (hay[j] == needle[m - 1 - q]) q++;
+        if (q == m)
+        {
+            hit = j;
+            break;
+        }
+    }
+    free(fail);
+    return hit;
+}
+
+// last occurence of needle[0, m) in hay[0, n)
+size_t search_backward(const char *hay, size_t n, const char *needle, size_t m) {
+    if (m == 0 || m > n) return SEARCH_NOT_FOUND;
+
+    size_t end = n - m + 1; // candidates left to check are [0, end)
+#ifdef __SSE2__
+    size_t misses = 0;
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[m - 1]);
+    for (; end >= 16; end -= 16)
+    {
+        const size_t i = end - 16;
+        const __m128i a = _mm_loadu_si128((const __m128i *)(hay + i));
+        const __m128i b = _mm_loadu_si128((const __m128i *)(hay + i + m - 1));
+        uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask != 0)
+        {
+            const int bit = 31 - __builtin_clz(mask);
+            if (memcmp(hay + i + bit, needle, m) == 0) return i + bit;
+            mask &= ~(1u << bit);
+            misses++;
+        }
+        // same as `search_forward()`, candidates [0, i) are left
+        if (misses > SEARCH_MAX_MISSES + (n - m + 1 - i) / 16)
+            return search_backward_kmp(hay, i + m - 1, needle, m);
+    }
+#endif
+    while (end > 0)
+    {
+        end--;
+        if (hay[end] == needle[0] && memcmp(hay + end, needle, m) == 0) return end;
+    }
+    return SEARCH_NOT_FOUND;
+}
+
+// -------------------
+// Regex search
+// patterns are parsed into a tree, compiled to a Thompson NFA both forwards and
+// backwards and run as DFAs that are built lazily while searching, so there's
+// no backtracking. Matches never span lines, '\n' is in no class.
+
+void byte_class_add(ByteClass *c, unsigned char b) {
+    c->bits[b >> 6] |= 1ull << (b & 63);
+}
+
+bool byte_class_has(const ByteClass *c, unsigned char b) {
+    return (c->bits[b >> 6] >> (b & 63)) & 1;
+}
+
+void byte_class_negate(ByteClass *c) {
+    for (int i=0; i<4; i++) c->bits[i] = ~c->bits[i];
+}
+
+typedef enum {
+    RN_EMPTY,
+    RN_CLASS,       // a is the class
+    RN_CAT,         // a then b
+    RN_ALT,         // a or b
+    RN_REPEAT,      // a, min to max times
+    RN_LINE_START,
+    RN_LINE_END,
+} RegexNodeKind;
+
+typedef struct {
+    RegexNodeKind kind;
+    int a;
+    int b;
+    int min;
+    int max;        // -1 is unbounded
+} RegexNode;
+
+typedef struct {
+    RegexNode *items;
+    size_t size;
+    size_t count;
+} RegexNodes;
+
+// alternatives and concatenation of the group being parsed, -1 while empty
+typedef struct {
+    int alt;
+    int cat;
+} RegexGroup;
+
+typedef struct {
+    RegexGroup *items;
+    size_t size;
+    size_t count;
+} RegexGroups;
+
+typedef struct {
+    const char *s;
+    size_t pos;
+    RegexNodes nodes;
+    ByteClasses *classes;
+    const char *error;
+} RegexParser;
+
+int regex_node(RegexParser *p, RegexNodeKind kind, int a, int b) {
+    da_append(&p->nodes, ((RegexNode){ .kind = kind, .a = a, .b = b }));
+    return p->nodes.count - 1;
+}
+
+int regex_class_node(RegexParser *p, ByteClass cls) {
+    cls.bits['\n' >> 6] &= ~(1ull << ('\n' & 63));
+    da_append(p->classes, cls);
+    return regex_node(p, RN_CLASS, p->classes->count - 1, 0);
+}
+
+// the escape after a '\\', as a class
+bool regex_parse_escape(RegexParser *p, ByteClass *cls) {
+    const char c = p->s[p->pos];
+    if (c == '\0')
+    {
+        p->error = "trailing \\";
+        return false;
+    }
+    p->pos++;
+    *cls = (ByteClass) {0};
+    switch (c)
+    {
+    case 'd': case 'D':
+        for (int b='0'; b<='9'; b++) byte_class_add(cls, b);
+        break;
+    case 'w': case 'W':
+        for (int b=0; b<128; b++) if (isalnum(b) || b == '_') byte_class_add(cls, b);
+        break;
+    case 's': case 'S':
+        for (const char *b=" \t\r\v\f"; *b; b++) byte_class_add(cls, *b);
+        break;
+    case 'n': byte_class_add(cls, '\n'); return true; // never matches, lines are searched separately
+    case 't': byte_class_add(cls, '\t'); return true;
+    case 'r': byte_class_add(cls, '\r'); return true;
+    default:
+        if (isalnum((unsigned char)c))
+        {
+            p->error = "unsupported escape";
+            return false;
+        }
+        byte_class_add(cls, c);
+        return true;
+    }
+    if (isupper((unsigned char)c)) byte_class_negate(cls);
+    return true;
+}
+
+// the class after a '[', up to and including the ']'
+bool regex_parse_bracket(RegexParser *p, ByteClass *cls) {
+    *cls = (ByteClass) {0};
+    const bool negate = p->s[p->pos] == '^';
+    if (negate) p->pos++;
+    for (bool first = true; first || p->s[p->pos] != ']'; first = false)
+    {
+        const unsigned char c = p->s[p->pos++];
+        if (c == '\0')
+        {
+            p->error = "missing ]";
+            return false;
+        }
+        if (c == '\\')
+        {
+            ByteClass escaped;
+            if (!regex_parse_escape(p, &escaped)) return false;
+            for (int i=0; i<4; i++) cls->bits[i] |= escaped.bits[i];
+            continue;
+        }
+        unsigned char hi = c;
+        if (p->s[p->pos] == '-' && p->s[p->pos + 1] != ']' && p->s[p->pos + 1] != '\0')
+        {
+            hi = p->s[p->pos + 1];
+            p->pos += 2;
+            if (hi < c)
+            {
+                p->error = "bad range";
+                return false;
+            }
+        }
+        for (int b=c; b<=hi; b++) byte_class_add(cls, b);
+    }
+    p->pos++;
+    if (negate) byte_class_negate(cls);
+    return true;
+}
+
+// {m}, {m,} or {m,n} after an atom, false (and nothing consumed) if it isn't one
+bool regex_parse_count(RegexParser *p, int *min, int *max) {
+    const char *s = p->s + p->pos + 1;
+    char *end;
+    if (!isdigit((unsigned char)*s)) return false;
+    long lo = strtol(s, &end, 10), hi = lo;
+    if (*end == ',')
+    {
+        s = end + 1;
+        if (*s == '}') hi = -1, end = (char *)s;
+        else if (!isdigit((unsigned char)*s)) return false;
+        else hi = strtol(s, &end, 10);
+    }
+    if (*end != '}') return false;
+    if (lo > REGEX_MAX_REPEAT || hi > REGEX_MAX_REPEAT || (hi >= 0 && hi < lo))
+    {
+        p->error = "bad repeat count";
+        return false;
+    }
+    *min = lo;
+    *max = hi;
+    p->pos = end + 1 - p->s;
+    return true;
+}
+
+int regex_group_finish(RegexParser *p, RegexGroup g) {
+    const int body = g.cat >= 0 ? g.cat : regex_node(p, RN_EMPTY, 0, 0);
+    return g.alt >= 0 ? regex_node(p, RN_ALT, g.alt, body) : body;
+}
+
+// parses the pattern into p->nodes, returns the root or -1 with p->error set
+// groups are kept on a stack instead of recursing, so nesting can't overflow
+int regex_parse(RegexParser *p) {
+    RegexGroups stack;
+    da_init(&stack);
+    RegexGroup g = { -1, -1 };
+    int root = -1;
+    while (p->error == NULL)
+    {
+        const char c = p->s[p->pos];
+        if (c == '\0')
+        {
+            if (stack.count > 0) p->error = "missing )";
+            else root = regex_group_finish(p, g);
+            break;
+        }
+
+        int atom;
+        ByteClass cls = {0};
+        p->pos++;
+        switch (c)
+        {
+        case '(':
+            if (p->s[p->pos] == '?' && p->s[p->pos + 1] == ':') p->pos += 2;
+            da_append(&stack, g);
+            g = (RegexGroup) { -1, -1 };
+            continue;
+        case '|':
+            g.alt = regex_group_finish(p, g);
+            g.cat = -1;
+            continue;
+        case ')':
+            if (stack.count == 0)
+            {
+                p->error = "unmatched )";
+                continue;
+            }
+            atom = regex_group_finish(p, g);
+            g = stack.items[--stack.count];
+            break;
+        case '*': case '+': case '?':
+            p->error = "nothing to repeat";
+            continue;
+        case '^':
+            atom = regex_node(p, RN_LINE_START, 0, 0);
+            break;
+        case '$':
+            atom = regex_node(p, RN_LINE_END, 0, 0);
+            break;
+        case '.':
+            byte_class_negate(&cls);
+            atom = regex_class_node(p, cls);
+            break;
+        case '[':
+            if (!regex_parse_bracket(p, &cls)) continue;
+            atom = regex_class_node(p, cls);
+            break;
+        case '\\':
+            if (!regex_parse_escape(p, &cls)) continue;
+            atom = regex_class_node(p, cls);
+            break;
+        default:
+            byte_class_add(&cls, c);
+            atom = regex_class_node(p, cls);
+        }
+
+        // quantifiers, a lazy '?' after one makes no difference to a DFA
+        for (;;)
+        {
+            const char q = p->s[p->pos];
+            int min, max;
+            if (q == '*') min = 0, max = -1;
+            else if (q == '+') min = 1, max = -1;
+            else if (q == '?') min = 0, max = 1;
+            else if (q != '{' || !regex_parse_count(p, &min, &max)) break;
+            if (q != '{') p->pos++;
+            if (p->s[p->pos] == '?') p->pos++;
+            atom = regex_node(p, RN_REPEAT, atom, 0);
+            p->nodes.items[atom].min = min;
+            p->nodes.items[atom].max = max;
+        }
+        g.cat = g.cat >= 0 ? regex_node(p, RN_CAT, g.cat, atom) : atom;
+    }
+    da_free(&stack);
+    return p->error == NULL ? root : -1;
+}
+
+size_t regex_inst(RegexProg *prog, RegexOp op, int x, int y) {
+    da_append(prog, ((RegexInst){ op, x, y }));
+    return prog->count - 1;
+}
+
+void regex_emit(RegexProg *prog, const RegexNodes *nodes, int n, bool reverse) {
+    if (prog->count > REGEX_MAX_INSTS) return; // reported by `regex_compile()`
+    const RegexNode node = nodes->items[n];
+    switch (node.kind)
+    {
+    case RN_EMPTY:
+        break;
+    case RN_CLASS:
+        regex_inst(prog, RE_CLASS, node.a, 0);
+        break;
+    case RN_CAT:
+        regex_emit(prog, nodes, reverse ? node.b : node.a, reverse);
+        regex_emit(prog, nodes, reverse ? node.a : node.b, reverse);
+        break;
+    case RN_ALT:
+    {
+        const size_t split = regex_inst(prog, RE_SPLIT, prog->count + 1, 0);
+        regex_emit(prog, nodes, node.a, reverse);
+        const size_t jmp = regex_inst(prog, RE_JMP, 0, 0);
+        prog->items[split].y = prog->count;
+        regex_emit(prog, nodes, node.b, reverse);
+        prog->items[jmp].x = prog->count;
+        break;
+    }
+    case RN_REPEAT:
+        for (int i=0; i<node.min; i++) regex_emit(prog, nodes, node.a, reverse);
+        if (node.max < 0)
+        {
+            const size_t split = regex_inst(prog, RE_SPLIT, prog->count + 1, 0);
+            regex_emit(prog, nodes, node.a, reverse);
+            regex_inst(prog, RE_JMP, split, 0);
+            prog->items[split].y = prog->count;
+        }
+        else
+        {
+            // optional copies, each split can skip to the end,
+            // chained through y until the end is known
+            int chain = -1;
+            for (int i=node.min; i<node.max && prog->count <= REGEX_MAX_INSTS; i++)
+            {
+                chain = regex_inst(prog, RE_SPLIT, prog->count + 1, chain);
+                regex_emit(prog, nodes, node.a, reverse);
+            }
+            while (chain >= 0)
+            {
+                const int next = prog->items[chain].y;
+                prog->items[chain].y = prog->count;
+                chain = next;
+            }
+        }
+        break;
+    case RN_LINE_START:
+        regex_inst(prog, reverse ? RE_ASSERT_END : RE_ASSERT_START, 0, 0);
+        break;
+    case RN_LINE_END:
+        regex_inst(prog, reverse ? RE_ASSERT_START : RE_ASSERT_END, 0, 0);
+        break;
+    }
+}
+
+void regex_free(Regex *re) {
+    da_free(&re->classes);
+    da_free(&re->forward);
+    da_free(&re->reverse);
+}
+
+// supports . [] [^] \d \w \s (and upper case) * + ? {m,n} | () ^ $
+// returns false with `*error` set if the pattern is invalid
+bool regex_compile(Regex *re, const char *pattern, const char **error) {
+    *re = (Regex) {0};
+    RegexParser p = { .s = pattern, .classes = &re->classes };
+    da_init(&p.nodes);
+    const int root = regex_parse(&p);
+    if (root >= 0)
+    {
+        regex_emit(&re->forward, &p.nodes, root, false);
+        regex_inst(&re->forward, RE_MATCH, 0, 0);
+        regex_emit(&re->reverse, &p.nodes, root, true);
+        regex_inst(&re->reverse, RE_MATCH, 0, 0);
+        if (re->forward.count > REGEX_MAX_INSTS) p.error = "pattern too big";
+    }
+    da_free(&p.nodes);
+    *error = p.error;
+    if (p.error != NULL) regex_free(re);
+    return p.error == NULL;
+}
+
+// DFA state, a set of NFA instructions, its transitions are filled in on use
+typedef struct {
+    bool accept;        // a match ends here
+    bool acceptEnd;     // a match ends here if it's the end of a line
+    uint32_t first;     // its instructions are Dfa.insts[first, first+count)
+    uint32_t count;     // 0 is the dead state
+    int32_t next[256];  // -1 until needed
+} DfaState;
+
+typedef struct {
+    DfaState *items;
+    size_t size;
+    size_t count;
+} DfaStates;
+
+typedef struct {
+    int *items;
+    size_t size;
+    size_t count;
+} DfaInsts;
+
+typedef struct {
+    const RegexProg *prog;
+    const ByteClass *classes;
+    bool anchored;          // otherwise a match can start at any byte
+    DfaStates states;
+    DfaInsts insts;
+    int32_t *table;         // state ids by instruction set, open addressing, -1 is empty
+    size_t tableSize;
+    int32_t start[2];       // in the middle of a line / at its start, -1 until needed
+    size_t flushes;         // times the states were thrown away
+
+    // instruction set being built, a sparse set
+    int *set;
+    int *index;
+    size_t setCount;
+    int *stack;
+} Dfa;
+
+void dfa_init(Dfa *d, const RegexProg *prog, const ByteClass *classes, bool anchored) {
+    *d = (Dfa) { .prog = prog, .classes = classes, .anchored = anchored, .start = { -1, -1 } };
+    da_init(&d->states);
+    da_init(&d->insts);
+    d->set = calloc(prog->count, sizeof(int));
+    d->index = calloc(prog->count, sizeof(int));
+    d->stack = calloc(prog->count, sizeof(int));
+    assert(d->set != NULL && d->index != NULL && d->stack != NULL);
+}
+
+void dfa_free(Dfa *d) {
+    da_free(&d->states);
+    da_free(&d->insts);
+    free(d->table);
+    free(d->set);
+    free(d->index);
+    free(d->stack);
+}
+
+bool dfa_set_add(Dfa *d, int pc) {
+    const int i = d->index[pc];
+    if ((size_t)i < d->setCount && d->set[i] == pc) return false;
+    d->index[pc] = d->setCount;
+    d->set[d->setCount++] = pc;
+    return true;
+}
+
+// adds pc and every instruction reachable from it without consuming a byte
+void dfa_closure(Dfa *d, int pc, bool atStart, bool atEnd) {
+    if (!dfa_set_add(d, pc)) return;
+    size_t top = 0;
+    d->stack[top++] = pc;
+    while (top > 0)
+    {
+        const int at = d->stack[--top];
+        const RegexInst in = d->prog->items[at];
+        int targets[2], n = 0;
+        if (in.op == RE_SPLIT) targets[n++] = in.y, targets[n++] = in.x;
+        else if (in.op == RE_JMP) targets[n++] = in.x;
+        else if (in.op == RE_ASSERT_START && atStart) targets[n++] = at + 1;
+        else if (in.op == RE_ASSERT_END && atEnd) targets[n++] = at + 1;
+        for (int i=0; i<n; i++)
+            if (dfa_set_add(d, targets[i])) d->stack[top++] = targets[i];
+    }
+}
+
+int int_compare(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+void dfa_table_insert(Dfa *d, uint64_t hash, int32_t id) {
+    size_t i = hash & (d->tableSize - 1);
+    while (d->table[i] >= 0) i = (i + 1) & (d->tableSize - 1);
+    d->table[i] = id;
+}
+
+uint64_t dfa_state_hash(Dfa *d, const DfaState *s) {
+    return hash_bytes((const char *)(d->insts.items + s->first), s->count * sizeof(int));
+}
+
+// throws all states away once there are too many
+void dfa_flush(Dfa *d) {
+    d->states.count = 0;
+    d->insts.count = 0;
+    for (size_t i=0; i<d->tableSize; i++) d->table[i] = -1;
+    d->start[0] = d->start[1] = -1;
+    d->flushes++;
+}
+
+// the state for the instructions in the set, created if it's new
+int32_t dfa_state(Dfa *d) {
+    // only instructions that consume a byte or end a match tell states apart
+    size_t n = 0;
+    for (size_t i=0; i<d->setCount; i++)
+    {
+        const RegexOp op = d->prog->items[d->set[i]].op;
+        if (op == RE_CLASS || op == RE_MATCH || op == RE_ASSERT_END) d->stack[n++] = d->set[i];
+    }
+    qsort(d->stack, n, sizeof(int), int_compare);
+    const uint64_t hash = hash_bytes((const char *)d->stack, n * sizeof(int));
+
+    if (d->tableSize > 0)
+    {
+        for (size_t i = hash & (d->tableSize - 1); d->table[i] >= 0; i = (i + 1) & (d->tableSize - 1))
+        {
+            const DfaState *s = &d->states.items[d->table[i]];
+            if (s->count == n && (n == 0 || memcmp(d->insts.items + s->first, d->stack, n * sizeof(int)) == 0))
+                return d->table[i];
+        }
+    }
+
+    if (d->states.count >= REGEX_DFA_MAX_STATES) dfa_flush(d);
+    if (d->states.count * 2 >= d->tableSize)
+    {
+        // grow the table
+        free(d->table);
+        d->tableSize = d->tableSize == 0 ? 64 : d->tableSize * 2;
+        d->table = malloc(d->tableSize * sizeof(int32_t));
+        assert(d->table != NULL);
+        for (size_t i=0; i<d->tableSize; i++) d->table[i] = -1;
+        for (size_t i=0; i<d->states.count; i++) dfa_table_insert(d, dfa_state_hash(d, &d->states.items[i]), i);
+    }
+
+    DfaState s = { .first = d->insts.count, .count = n };
+    memset(s.next, 0xFF, sizeof(s.next));
+    for (size_t i=0; i<n; i++)
+    {
+        da_append(&d->insts, d->stack[i]);
+        s.accept |= d->prog->items[d->stack[i]].op == RE_MATCH;
+    }
+
+    // does passing the line end checks reach a match
+    d->setCount = 0;
+    for (size_t i=0; i<n; i++)
+    {
+        const int pc = d->insts.items[s.first + i];
+        if (d->prog->items[pc].op == RE_ASSERT_END) dfa_closure(d, pc, false, true);
+    }
+    for (size_t i=0; i<d->setCount && !s.acceptEnd; i++)
+        s.acceptEnd = d->prog->items[d->set[i]].op == RE_MATCH;
+    s.acceptEnd |= s.accept;
+
+    const int32_t id = d->states.count;
+    da_append(&d->states, s);
+    dfa_table_insert(d, hash, id);
+    return id;
+}
+
+int32_t dfa_start(Dfa *d, bool atStart) {
+    if (d->start[atStart] < 0)
+    {
+        d->setCount = 0;
+        dfa_closure(d, 0, atStart, false);
+        const int32_t s = dfa_state(d);
+        d->start[atStart] = s;
+    }
+    return d->start[atStart];
+}
+
+// state after consuming byte c, never called for '\n'
+int32_t dfa_next(Dfa *d, int32_t s, unsigned char c) {
+    const int32_t known = d->states.items[s].next[c];
+    if (known >= 0) return known;
+
+    d->setCount = 0;
+    const DfaState st = d->states.items[s];
+    for (uint32_t i=0; i<st.count; i++)
+    {
+        const int pc = d->insts.items[st.first + i];
+        const RegexInst in = d->prog->items[pc];
+        if (in.op == RE_CLASS && byte_class_has(&d->classes[in.x], c)) dfa_closure(d, pc + 1, false, false);
+    }
+    if (!d->anchored) dfa_closure(d, 0, false, false);
+
+    const size_t flushes = d->flushes;
+    const int32_t next = dfa_state(d);
+    if (d->flushes == flushes) d->states.items[s].next[c] = next;
+    return next;
+}
+
+bool regex_line_start(const char *data, size_t pos) {
+    return pos == 0 || data[pos - 1] == '\n';
+}
+
+bool regex_line_end(const char *data, size_t size, size_t pos) {
+    return pos == size || data[pos] == '\n';
+}
+
+// end of the longest match starting at `start`
+size_t regex_match_end(Dfa *anchored, const char *data, size_t size, size_t start, atomic_bool *cancel) {
+    int32_t s = dfa_start(anchored, regex_line_start(data, start));
+    size_t best = start;
+    for (size_t k=start; ; k++)
+    {
+        const DfaState *st = &anchored->states.items[s];
+        const bool lineEnd = regex_line_end(data, size, k);
+        if (st->accept || (lineEnd && st->acceptEnd)) best = k;
+        if (st->count == 0 || lineEnd) break;
+        if ((k - start) % REGEX_CHUNK_SIZE == REGEX_CHUNK_SIZE - 1 && atomic_load(cancel)) break;
+        s = dfa_next(anchored, s, data[k]);
+    }
+    return best;
+}
+
+// bytes other than '\n' that leave state s, false if there are too many.
+// Makes up to 256 states
+bool regex_exits(Dfa *d, int32_t s, unsigned char *bytes, int *count) {
+    *count = 0;
+    for (int c=0; c<256; c++)
+    {
+        if (c == '\n' || dfa_next(d, s, c) == s) continue;
+        if (*count == REGEX_SKIP_BYTES - 1) return false;
+        bytes[(*count)++] = c;
+    }
+    return true;
+}
+
+// first position in [i, end) holding '\n' or one of bytes[0, count)
+size_t regex_skip(const char *data, size_t i, size_t end, const unsigned char *bytes, int count) {
+#ifdef __SSE2__
+    __m128i wanted[REGEX_SKIP_BYTES];
+    wanted[0] = _mm_set1_epi8('\n');
+    for (int k=0; k<count; k++) wanted[k + 1] = _mm_set1_epi8(bytes[k]);
+    for (; i + 32 <= end; i += 32)
+    {
+        const __m128i a0 = _mm_loadu_si128((const __m128i *)(data + i));
+        const __m128i a1 = _mm_loadu_si128((const __m128i *)(data + i + 16));
+        __m128i e0 = _mm_cmpeq_epi8(a0, wanted[0]);
+        __m128i e1 = _mm_cmpeq_epi8(a1, wanted[0]);
+        for (int k=1; k<=count; k++)
+        {
+            e0 = _mm_or_si128(e0, _mm_cmpeq_epi8(a0, wanted[k]));
+            e1 = _mm_or_si128(e1, _mm_cmpeq_epi8(a1, wanted[k]));
+        }
+        const uint32_t mask = (uint32_t)_mm_movemask_epi8(e0) | (uint32_t)_mm_movemask_epi8(e1) << 16;
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+#endif
+    for (; i < end; i++)
+    {
+        if (data[i] == '\n') return i;
+        for (int k=0; k<count; k++)
+            if ((unsigned char)data[i] == bytes[k]) return i;
+    }
+    return end;
+}
+
+// the last k in [lo, j] that is lo or has one of bytes[0, count) before it
+size_t regex_skip_back(const char *data, size_t lo, size_t j, const unsigned char *bytes, int count) {
+#ifdef __SSE2__
+    __m128i wanted[REGEX_SKIP_BYTES];
+    for (int k=0; k<count; k++) wanted[k] = _mm_set1_epi8(bytes[k]);
+    for (; j >= lo + 32; j -= 32)
+    {
+        const __m128i a0 = _mm_loadu_si128((const __m128i *)(data + j - 32));
+        const __m128i a1 = _mm_loadu_si128((const __m128i *)(data + j - 16));
+        __m128i e0 = _mm_setzero_si128();
+        __m128i e1 = _mm_setzero_si128();
+        for (int k=0; k<count; k++)
+        {
+            e0 = _mm_or_si128(e0, _mm_cmpeq_epi8(a0, wanted[k]));
+            e1 = _mm_or_si128(e1, _mm_cmpeq_epi8(a1, wanted[k]));
+        }
+        const uint32_t mask = (uint32_t)_mm_movemask_epi8(e0) | (uint32_t)_mm_movemask_epi8(e1) << 16;
+        if (mask != 0) return j - 32 + (32 - __builtin_clz(mask));
+    }
+#endif
+    for (; j > lo; j--)
+        for (int k=0; k<count; k++)
+            if ((unsigned char)data[j - 1] == bytes[k]) return j;
+    return lo;
+}
+
+// works the skip bytes out again after the states were thrown away, when
+// there's room for it without throwing away the ones in use
+void regex_skip_update(Dfa *d, RegexSkip *skip) {
+    if (skip->flushes == d->flushes) return;
+    skip->state = -1;
+    skip->flushes = d->flushes;
+    if (d->states.count + 257 >= REGEX_DFA_MAX_STATES) return;
+    const int32_t start = dfa_start(d, false);
+    const DfaState *st = &d->states.items[start];
+    if (!st->accept && !st->acceptEnd && regex_exits(d, start, skip->bytes, &skip->count)) skip->state = start;
+}
+
+// marks every position of data[lo, end] where a match starts, `end` being
+// the end of the line. `rev` runs unanchored over the reversed line, so it
+// accepts wherever a match ending anywhere up to `end` starts. Bit k is lo + k.
+// Returns false when cancelled, a line can be gigabytes long
+bool regex_match_starts(Dfa *rev, RegexSkip *skip, const char *data, size_t size, size_t lo, size_t end, RegexStarts *starts, atomic_bool *cancel) {
+    starts->count = (end - lo) / 64 + 1;
+    da_reserve(starts, starts->count);
+    memset(starts->items, 0, starts->count * sizeof(*starts->items));
+    regex_skip_update(rev, skip);
+    int32_t s = dfa_start(rev, regex_line_end(data, size, end));
+    size_t check = end; // next check for cancellation
+    for (size_t j=end; ; j--)
+    {
+        if (j <= check)
+        {
+            if (atomic_load(cancel)) return false;
+            check = j - lo > REGEX_CHUNK_SIZE ? j - REGEX_CHUNK_SIZE : lo;
+        }
+        if (s == skip->state && rev->flushes == skip->flushes) j = regex_skip_back(data, lo, j, skip->bytes, skip->count);
+        const DfaState *st = &rev->states.items[s];
+        if (st->accept || (st->acceptEnd && regex_line_start(data, j)))
+            starts->items[(j - lo) / 64] |= 1ull << ((j - lo) % 64);
+        if (j == lo) break;
+        const int32_t next = st->next[(unsigned char)data[j - 1]];
+        s = next >= 0 ? next : dfa_next(rev, s, data[j - 1]);
+    }
+    return true;
+}
+
+// first marked position in [at, end], end + 1 when there's none
+size_t regex_next_start(const RegexStarts *starts, size_t lo, size_t at, size_t end) {
+    for (size_t k = (at - lo) / 64; k < starts->count; k++)
+    {
+        uint64_t bits = starts->items[k];
+        if (k == (at - lo) / 64) bits &= ~0ull << ((at - lo) % 64);
+        if (bits != 0) return lo + k*64 + __builtin_ctzll(bits);
+    }
+    return end + 1;
+}
+
+void regex_publish(RegexSearch *rs, RegexMatches *found, size_t done) {
+    pthread_mutex_lock(&rs->lock);
+    for (size_t i=0; i<found->count && rs->matches.count < REGEX_MAX_STORED; i++)
+        da_append(&rs->matches, found->items[i]);
+    rs->count += found->count;
+    pthread_mutex_unlock(&rs->lock);
+    found->count = 0;
+    atomic_store(&rs->done, done);
+}
+
+// searches data[from, size) in chunks, publishing the matches after each.
+// The forward DFA only tells which lines have a match: the earliest match end
+// isn't the end of the leftmost one (`abcd|bc` on "abcd"). On such a line the
+// reverse DFA marks where matches start, see `regex_match_starts()`, and the
+// anchored one extends each from the leftmost as far as it goes. While the
+// forward DFA sits in its start state only a few bytes may move it, so those
+// are scanned for
+void *regex_thread(void *arg) {
+    RegexSearch *rs = arg;
+    const char *data = rs->data;
+    const size_t size = rs->size;
+    Dfa forward, anchored, reverse;
+    dfa_init(&forward, &rs->re.forward, rs->re.classes.items, false);
+    dfa_init(&anchored, &rs->re.forward, rs->re.classes.items, true);
+    dfa_init(&reverse, &rs->re.reverse, rs->re.classes.items, false);
+    RegexMatches found;
+    da_init(&found);
+    RegexStarts starts;
+    da_init(&starts);
+    RegexSkip skip = { .state = -1, .flushes = SIZE_MAX };
+    RegexSkip reverseSkip = { .state = -1, .flushes = SIZE_MAX };
+
+    size_t i = rs->from;
+    size_t lo = i; // where the current run of the forward DFA started
+    int32_t s = dfa_start(&forward, regex_line_start(data, i));
+    while (i <= size && !atomic_load(&rs->cancel))
+    {
+        const size_t chunkEnd = size - i > REGEX_CHUNK_SIZE ? i + REGEX_CHUNK_SIZE : size;
+        while (i <= chunkEnd)
+        {
+            regex_skip_update(&forward, &skip);
+
+            // hot loop: known transitions until something might match
+            const DfaState *states = forward.states.items;
+            while (i < chunkEnd && !states[s].accept)
+            {
+                if (s == skip.state)
+                {
+                    i = regex_skip(data, i, chunkEnd, skip.bytes, skip.count);
+                    if (i == chunkEnd) break;
+                }
+                const int32_t next = states[s].next[(unsigned char)data[i]];
+                if (next < 0) break;
+                s = next;
+                i++;
+            }
+            if (i == chunkEnd && chunkEnd < size) break;
+
+            const DfaState *st = &states[s];
+            if (st->accept || (st->acceptEnd && regex_line_end(data, size, i)))
+            {
+                // every match of the rest of the line, matches never span lines.
+                // The hot loop takes known '\n' transitions without moving `lo`
+                const char *prev = i > lo ? memrchr(data + lo, '\n', i - lo) : NULL;
+                if (prev != NULL) lo = prev - data + 1;
+                const char *nl = memchr(data + i, '\n', size - i);
+                const size_t lineEnd = nl != NULL ? (size_t)(nl - data) : size;
+                const size_t before = found.count;
+                bool cancelled = !regex_match_starts(&reverse, &reverseSkip, data, size, lo, lineEnd, &starts, &rs->cancel);
+                size_t start = cancelled ? lineEnd + 1 : regex_next_start(&starts, lo, lo, lineEnd);
+                while (start <= lineEnd)
+                {
+                    const size_t end = regex_match_end(&anchored, data, size, start, &rs->cancel);
+                    if (atomic_load(&rs->cancel))
+                    {
+                        cancelled = true;
+                        break;
+                    }
+                    if (end > start) da_append(&found, ((RegexMatch){ start, end - start }));
+                    // empty matches are skipped
+                    start = regex_next_start(&starts, lo, end > start ? end : start + 1, lineEnd);
+                }
+                if (cancelled)
+                {
+                    // the line is searched again from its start
+                    found.count = before;
+                    i = lo;
+                    break;
+                }
+                i = lineEnd + 1;
+                lo = i;
+                if (i <= size) s = dfa_start(&forward, true);
+                continue;
+            }
+            if (i == size)
+            {
+                i++;
+                break;
+            }
+
+            const unsigned char c = data[i++];
+            if (c == '\n')
+            {
+                // a line end check may pass on '\n', those states go through here every time
+                const int32_t from = s;
+                const size_t flushes = forward.flushes;
+                s = dfa_start(&forward, true);
+                if (!st->acceptEnd && forward.flushes == flushes) forward.states.items[from].next['\n'] = s;
+                lo = i;
+            }
+            else s = dfa_next(&forward, s, c);
+        }
+        regex_publish(rs, &found, i < size ? i : size);
+    }
+    if (i > size) atomic_store(&rs->finished, true);
+
+    da_free(&found);
+    da_free(&starts);
+    dfa_free(&forward);
+    dfa_free(&anchored);
+    dfa_free(&reverse);
+    return NULL;
+}
+
+void regex_search_stop(RegexSearch *rs) {
+    if (!rs->running) return;
+    atomic_store(&rs->cancel, true);
+    pthread_join(rs->thread, NULL);
+    rs->running = false;
+}
+
+// index of the first kept match at or after `pos`, call with rs->lock held
+size_t regex_search_find(RegexSearch *rs, size_t pos) {
+    size_t lo = 0, hi = rs->matches.count;
+    while (lo < hi)
+    {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (rs->matches.items[mid].pos < pos) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// drops the matches from `from` on and searches data[from, size) on the thread
+void regex_search_start(RegexSearch *rs, const char *data, size_t size, size_t from) {
+    regex_search_stop(rs);
+    rs->stale = false;
+    if (!rs->valid) return;
+
+    pthread_mutex_lock(&rs->lock);
+    if (rs->count > rs->matches.count) from = 0; // the dropped ones can't be told apart
+    rs->matches.count = regex_search_find(rs, from);
+    rs->count = rs->matches.count;
+    pthread_mutex_unlock(&rs->lock);
+
+    rs->data = data;
+    rs->size = size;
+    rs->from = from;
+    atomic_store(&rs->done, from);
+    atomic_store(&rs->finished, false);
+    atomic_store(&rs->cancel, false);
+    if (pthread_create(&rs->thread, NULL, regex_thread, rs) == 0) rs->running = true;
+    else regex_thread(rs);
+}
+
+void regex_search_clear(RegexSearch *rs) {
+    regex_search_stop(rs);
+    if (rs->valid) regex_free(&rs->re);
+    rs->valid = false;
+    rs->stale = false;
+    rs->error = NULL;
+    rs->matches.count = 0;
+    rs->count = 0;
+}
+
+// compiles a new pattern, the search is started by `regex_search_start()`
+void regex_search_set_pattern(RegexSearch *rs, const char *pattern) {
+    regex_search_clear(rs);
+    if (pattern[0] == '\0') return;
+    rs->valid = regex_compile(&rs->re, pattern, &rs->error);
+}
+
+// match count and progress of the regex search
+const char *regex_search_status(RegexSearch *rs) {
+    if (rs->error != NULL) return rs->error;
+    if (!rs->valid) return "";
+    pthread_mutex_lock(&rs->lock);
+    const size_t count = rs->count;
+    pthread_mutex_unlock(&rs->lock);
+    if (atomic_load(&rs->finished)) return TextFormat("%zu matches", count);
+    const size_t done = atomic_load(&rs->done);
+    return TextFormat("Searching %d%%, %zu matches", rs->size > 0 ? (int)(done * 100 / rs->size) : 100, count);
+}
+
+// the buffer is about to change at `pos`: the search stops, and starts again
+// from that line once the UI notices
+void editor_regex_invalidate(Editor *e, size_t pos) {
+    RegexSearch *rs = &e->regex;
+    if (!rs->valid || e->viewer.active) return;
+    regex_search_stop(rs);
+    const size_t done = atomic_load(&rs->done);
+    if (done < pos) pos = done;
+    if (rs->stale && rs->from < pos) pos = rs->from;
+    const char *nl = pos > 0 ? memrchr(e->buffer.items, '\n', pos) : NULL;
+    rs->from = nl != NULL ? (size_t)(nl - e->buffer.items) + 1 : 0;
+    rs->stale = true;
+}
+
+// gzip decompression state of the loader thread
+typedef struct {
+    z_stream z;
+    unsigned char *in;
+    bool inMember;      // in the middle of a gzip member
+} Inflater;
+
+// decompresses the next chunk into the buffer past `count`
+// returns the number of bytes added, 0 at the end of the file, -1 on error
+ssize_t loader_inflate(Editor *e, Inflater *inf, size_t count) {
+    Loader *l = &e->loader;
+    z_stream *z = &inf->z;
+
+    // the decompressed size is only a guess up front, so the buffer may
+    // have to grow, under the lock since the UI may be drawing from it
+    if (e->buffer.size - count < LOADER_CHUNK_SIZE)
+    {
+        size_t newSize = e->buffer.size * 2;
+        if (newSize < count + LOADER_CHUNK_SIZE) newSize = count + LOADER_CHUNK_SIZE;
+        pthread_mutex_lock(&e->lock);
+        da_reserve(&e->buffer, newSize);
+        pthread_mutex_unlock(&e->lock);
+    }
+
+    z->next_out = (unsigned char *)e->buffer.items + count;
+    z->avail_out = LOADER_CHUNK_SIZE;
+    while (z->avail_out > 0)
+    {
+        if (z->avail_in == 0)
+        {
+            ssize_t n = read(l->fd, inf->in, LOADER_CHUNK_SIZE);
+            if (n < 0)
+            {
+                if (errno == EINTR) continue;
+                l->error = errno;
+                return -1;
+            }
+            if (n == 0)
+            {
+                if (inf->inMember) l->error = EBADMSG; // truncated
+                break;
+            }
+            z->next_in = inf->in;
+            z->avail_in = n;
+        }
+
+        const int ret = inflate(z, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END)
+        {
+            // concatenated members (`cat a.gz b.gz`) continue the same file
+            inflateReset(z);
+            inf->inMember = false;
+            continue;
+        }
+        if (ret != Z_OK && ret != Z_BUF_ERROR)
+        {
+            if (!inf->inMember) break; // trailing garbage after the last member
+            l->error = EBADMSG;
+            return -1;
+        }
+        inf->inMember = true;
+    }
+    return LOADER_CHUNK_SIZE - z->avail_out;
+}
+
+// replaces the raw bytes loaded so far with their utf8 conversion
+void loader_decode(Editor *e, size_t count) {
+    Loader *l = &e->loader;
+    Buffer text;
+    da_init(&text);
+    text_decode(l->encoding, e->buffer.items, count, &text);
+
+    Lines lines;
+    da_init(&lines);
+    const size_t lineStart = lines_index_range(&lines, text.items, 0, 0, text.count);
+    da_append(&lines, ((Line){ lineStart, text.count }));
+    BlockHashes hashes;
+    da_init(&hashes);
+    block_hashes_update(&hashes, text.items, text.count, 0);
+
+    pthread_mutex_lock(&e->lock);
+    Buffer raw = e->buffer;
+    e->buffer = text;
+    Lines oldLines = e->lines;
+    e->lines = lines;
+    BlockHashes oldHashes = e->diskHashes;
+    e->diskHashes = hashes;
+    l->loaded = text.count;
+    pthread_mutex_unlock(&e->lock);
+
+    da_free(&raw);
+    da_free(&oldLines);
+    da_free(&oldHashes);
+}
+
+void *loader_thread(void *arg) {
+    Editor *e = arg;
+    Loader *l = &e->loader;
+
+    Inflater inf = {0};
+    if (l->gzip)
+    {
+        inf.in = malloc(LOADER_CHUNK_SIZE);
+        if (inflateInit2(&inf.z, 16 + MAX_WBITS) != Z_OK) l->error = ENOMEM;
+    }
+
+    Lines pending; // lines found in the current chunk
+    da_init(&pending);
+    BlockHashes hashes; // of the blocks completed by the current chunk
+    da_init(&hashes);
+    size_t lineStart = 0;
+    size_t count = 0;
+    size_t hashed = 0;
+    size_t validated = 0;
+
+    while ((l->gzip || count < l->total) && l->error == 0 && !atomic_load(&l->cancel))
+    {
+        ssize_t n;
+        if (l->gzip)
+            n = loader_inflate(e, &inf, count);
+        else
+        {
+            size_t want = l->total - count;
+            if (want > LOADER_CHUNK_SIZE) want = LOADER_CHUNK_SIZE;
+
+            // NOTE: the buffer was reserved up front and nothing else
+            // touches the bytes past buffer.count, so no lock is needed here
+            n = read(l->fd, e->buffer.items + count, want);
+            if (n < 0)
+            {
+                if (errno == EINTR) continue;
+                l->error = errno;
+                break;
+            }
+        }
+        if (n <= 0) break; // end of file, or it got shorter while loading
+
+        // utf8 is shown as it comes in, anything else is converted at the end
+        if (count == 0) l->encoding = encoding_detect((const unsigned char *)e->buffer.items, n);
+        if (l->encoding == ENCODING_UTF8)
+        {
+            bool invalid;
+            validated += utf8_validate((const unsigned char *)e->buffer.items + validated, count + n - validated, &invalid);
+            if (invalid) l->encoding = ENCODING_LATIN1;
+        }
+        const bool publish = l->encoding == ENCODING_UTF8;
+
+        pending.count = 0;
+        if (publish) lineStart = lines_index_range(&pending, e->buffer.items, lineStart, count, count + n);
+        count += n;
+
+        hashes.count = 0;
+        const bool last = !l->gzip && count == l->total;
+        for (; publish && (hashed + DISK_BLOCK_SIZE <= count || (last && hashed < count)); hashed += DISK_BLOCK_SIZE)
+        {
+            size_t len = count - hashed;
+            if (len > DISK_BLOCK_SIZE) len = DISK_BLOCK_SIZE;
+            da_append(&hashes, hash_bytes(e->buffer.items + hashed, len));
+        }
+
+        pthread_mutex_lock(&e->lock);
+        if (publish)
+        {
+            da_remove(&e->lines); // the previously open trailing line
+            da_reserve(&e->lines, e->lines.count + pending.count + 1);
+            memcpy(e->lines.items + e->lines.count, pending.items, pending.count * sizeof(Line));
+            e->lines.count += pending.count;
+            da_append(&e->lines, ((Line){ lineStart, count }));
+            e->buffer.count = count;
+            for (size_t i=0; i<hashes.count; i++)
+                da_append(&e->diskHashes, hashes.items[i]);
+            l->loaded = count;
+        }
+        l->consumed = l->gzip ? inf.z.total_in : count;
+        pthread_mutex_unlock(&e->lock);
+    }
+
+    if (l->encoding != ENCODING_UTF8 && !atomic_load(&l->cancel))
+        loader_decode(e, count);
+
+    if (l->gzip)
+    {
+        inflateEnd(&inf.z);
+        free(inf.in);
+    }
+    da_free(&pending);
+    da_free(&hashes);
+    atomic_store(&l->done, true);
+    return NULL;
+}
+
+// cancels a running load and waits for the loader thread to exit
+void editor_loader_stop(Editor *e) {
+    Loader *l = &e->loader;
+    if (!l->active) return;
+    atomic_store(&l->cancel, true);
+    pthread_join(l->thread, NULL);
+    close(l->fd);
+    l->fd = -1;
+    l->active = false;
+}
+
+// takes over the results of a finished load
+void editor_loader_finish(Editor *e) {
+    Loader *l = &e->loader;
+    e->encoding = l->encoding;
+    if (e->encoding != ENCODING_UTF8)
+    {
+        notification_issue(&e->notif, TextFormat("Opened as %s", encoding_name(e->encoding)), 2);
+        e->watch.follow = false; // appended bytes would need converting too
+    }
+
+    if (l->gzip || l->encoding != ENCODING_UTF8 || l->loaded != l->total)
+    {
+        editor_origin_reset(e, -1, 0); // buffer doesn't cover the whole file
+        block_hashes_update(&e->diskHashes, e->buffer.items, e->buffer.count, e->diskHashes.count * DISK_BLOCK_SIZE);
+    }
+
+    e->diskSize = l->loaded;
+
+    // go with the line ending most lines use, a CRLF line ends 2 bytes before the next starts
+    size_t crlfLines = 0;
+    for (size_t i=0; i+1<e->lines.count; i++)
+        crlfLines += e->lines.items[i+1].start - e->lines.items[i].end == 2;
+    e->crlf = crlfLines > 0 && crlfLines >= (e->lines.count - 1) / 2;
+
+    if (l->error != 0)
+    {
+        notification_issue(&e->notif, TextFormat("Error reading file: %s", strerror(l->error)), 2);
+        return;
+    }
+    e->journal.checkPending = true;
+    double elapsed = GetTime() - l->startTime;
+    LOG("Loaded %zu bytes in %.3fs", l->loaded, elapsed);
+}
+
+// called every frame, finishes up once the loader thread is done
+void editor_loader_poll(Editor *e) {
+    Loader *l = &e->loader;
+    if (!l->active || !atomic_load(&l->done)) return;
+
+    pthread_join(l->thread, NULL);
+    close(l->fd);
+    l->fd = -1;
+    l->active = false;
+    editor_loader_finish(e);
+}
+
+// whether the file on disk holds exactly the bytes of the buffer
+bool editor_file_is_raw(Editor *e) {
+    return !e->compressed && e->encoding == ENCODING_UTF8;
+}
+
+bool editor_is_loading(Editor *e) {
+    return e->loader.active;
+}
+
+// -------------------
+// Syntax highlighting
+// a line is lexed from the state the line before left the lexer in, those
+// states are cached per row. After an edit only the changed rows are lexed
+// again, and the ones after them until a state comes out the same as the
+// cached one. Drawing lexes just the visible rows, from the cached state of
+// the first one
+
+// C and the languages that share its comments, strings and most keywords
+bool syntax_language_known(const char *filename) {
+    if (filename == NULL) return false;
+    const char *dot = strrchr(filename, '.');
+    if (dot == NULL || strchr(dot, '/') != NULL) return false;
+    const char *extensions[] = {
+        "c", "h", "cc", "cpp", "cxx", "hh", "hpp", "hxx", "inl", "m", "mm",
+        "java", "js", "ts", "cs", "glsl", "vert", "frag",
+    };
+    for (size_t i=0; i<sizeof(extensions)/sizeof(extensions[0]); i++)
+        if (strcmp(dot + 1, extensions[i]) == 0) return true;
+    return false;
+}
+
+bool syntax_is_keyword(const char *s, size_t n) {
+    const char *keywords[] = {
+        "auto", "break", "case", "char", "const", "continue", "default", "do",
+        "double", "else", "enum", "extern", "float", "for", "goto", "if",
+        "inline", "int", "long", "register", "restrict", "return", "short",
+        "signed", "sizeof", "static", "struct", "switch", "typedef", "union",
+        "unsigned", "void", "volatile", "while", "bool", "true", "false",
+        "NULL", "_Atomic", "_Bool", "_Static_assert", "class", "namespace",
+        "template", "typename", "public", "private", "protected", "virtual",
+        "override", "new", "delete", "this", "using", "try", "catch", "throw",
+        "operator", "friend", "constexpr", "noexcept", "explicit", "mutable",
+        "nullptr", "static_cast", "dynamic_cast", "reinterpret_cast",
+        "const_cast", "final", "import", "package", "interface", "extends",
+        "implements", "null", "function",
+    };
+    for (size_t i=0; i<sizeof(keywords)/sizeof(keywords[0]); i++)
+        if (strncmp(keywords[i], s, n) == 0 && keywords[i][n] == '\0') return true;
+    return false;
+}
+
+void syntax_init(Syntax *sx) {
+    *sx = (Syntax) {0};
+    for (int c=0; c<256; c++)
+    {
+        SyntaxClass class = SYNTAX_OTHER;
+        if (isalpha(c) || c == '_' || c == '$' || c >= 0x80) class = SYNTAX_IDENT;
+        else if (isdigit(c)) class = SYNTAX_DIGIT;
+        else if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v') class = SYNTAX_SPACE;
+        else if (c == '.') class = SYNTAX_DOT;
+        else if (c == '"' || c == '\'') class = SYNTAX_QUOTE;
+        else if (c == '/') class = SYNTAX_SLASH;
+        sx->classes[c] = class;
+    }
+    da_init(&sx->states);
+    da_init(&sx->kinds);
+}
+
+void token_mark(char *kinds, size_t from, size_t to, TokenKind kind) {
+    if (kinds != NULL) memset(kinds + from, kind, to - from);
+}
+
+// end of a string or char literal opened before `i`, or of the line when it
+// isn't closed. `open` tells whether a backslash continues it on the next line
+size_t syntax_quoted_end(const char *s, size_t n, size_t i, char quote, bool *open) {
+    *open = false;
+    while (i < n)
+    {
+        if (s[i] == '\\')
+        {
+            if (i + 1 == n)
+            {
+                *open = true;
+                return n;
+            }
+            i += 2;
+        }
+        else if (s[i++] == quote) return i;
+    }
+    return n;
+}
+
+// end of a comment after "*/" searched from `i`, SIZE_MAX when it goes on
+size_t syntax_comment_end(const char *s, size_t n, size_t i) {
+    for (; i + 1 < n; i++)
+        if (s[i] == '*' && s[i + 1] == '/') return i + 2;
+    return SIZE_MAX;
+}
+
+// digits, suffixes, exponents and C++ digit separators: 0x1fULL 1'000 1.5e-3f
+size_t syntax_number_end(const uint8_t *classes, const char *s, size_t n, size_t i) {
+    while (i < n)
+    {
+        const char c = s[i];
+        const SyntaxClass class = classes[(unsigned char)c];
+        const char prev = s[i - 1];
+        const bool exponent = (c == '+' || c == '-') && (prev == 'e' || prev == 'E' || prev == 'p' || prev == 'P');
+        if (class != SYNTAX_IDENT && class != SYNTAX_DIGIT && class != SYNTAX_DOT && c != '\'' && !exponent) break;
+        i++;
+    }
+    return i;
+}
+
+// whether the quote at s[i] separates digits, as in 1'000'000, instead of
+// opening a char literal
+bool syntax_digit_separator(const uint8_t *classes, const char *s, size_t i) {
+    size_t t = i;
+    while (t > 0 && (classes[(unsigned char)s[t - 1]] == SYNTAX_IDENT || classes[(unsigned char)s[t - 1]] == SYNTAX_DIGIT ||
+                     s[t - 1] == '.' || s[t - 1] == '\''))
+        t--;
+    return t < i && classes[(unsigned char)s[t]] == SYNTAX_DIGIT;
+}
+
+// marks s[from, to), code without strings or comments, for drawing
+void syntax_mark_code(const uint8_t *classes, const char *s, size_t from, size_t to, char *kinds) {
+    size_t i = from;
+    while (i < to)
+    {
+        const size_t start = i;
+        switch (classes[(unsigned char)s[i]])
+        {
+        case SYNTAX_IDENT:
+            while (i < to && (classes[(unsigned char)s[i]] == SYNTAX_IDENT || classes[(unsigned char)s[i]] == SYNTAX_DIGIT)) i++;
+            token_mark(kinds, start, i, syntax_is_keyword(s + start, i - start) ? TOKEN_KEYWORD : TOKEN_TEXT);
+            break;
+        case SYNTAX_DIGIT:
+            i = syntax_number_end(classes, s, to, i + 1);
+            token_mark(kinds, start, i, TOKEN_NUMBER);
+            break;
+        case SYNTAX_DOT:
+            if (i + 1 < to && classes[(unsigned char)s[i + 1]] == SYNTAX_DIGIT)
+            {
+                i = syntax_number_end(classes, s, to, i + 1);
+                token_mark(kinds, start, i, TOKEN_NUMBER);
+                break;
+            }
+            // fallthrough
+        default:
+            token_mark(kinds, start, ++i, TOKEN_TEXT);
+            break;
+        }
+    }
+}
+
+// lexes the line s[0, n) starting in `state`, returns the state the next line
+// starts in. Only quotes and slashes can change it, the bytes in between are
+// skipped over unless `kinds` wants the TokenKind of every byte for drawing
+LexState syntax_lex_line(const uint8_t *classes, LexState state, const char *s, size_t n, char *kinds) {
+    size_t i = 0;
+    bool open;
+    switch (state)
+    {
+    case LEX_COMMENT:
+        i = syntax_comment_end(s, n, 0);
+        if (i == SIZE_MAX)
+        {
+            token_mark(kinds, 0, n, TOKEN_COMMENT);
+            return LEX_COMMENT;
+        }
+        token_mark(kinds, 0, i, TOKEN_COMMENT);
+        break;
+    case LEX_STRING:
+        i = syntax_quoted_end(s, n, 0, '"', &open);
+        token_mark(kinds, 0, i, TOKEN_STRING);
+        if (open) return LEX_STRING;
+        break;
+    case LEX_LINE_COMMENT:
+        token_mark(kinds, 0, n, TOKEN_COMMENT);
+        return n > 0 && s[n - 1] == '\\' ? LEX_LINE_COMMENT : LEX_NORMAL;
+    default:
+        {
+            // a preprocessor directive: its name, and the file of an #include
+            size_t hash = 0;
+            while (hash < n && classes[(unsigned char)s[hash]] == SYNTAX_SPACE) hash++;
+            if (hash == n || s[hash] != '#') break;
+            token_mark(kinds, 0, hash, TOKEN_TEXT);
+            i = hash + 1;
+            while (i < n && classes[(unsigned char)s[i]] == SYNTAX_SPACE) i++;
+            const size_t name = i;
+            while (i < n && classes[(unsigned char)s[i]] == SYNTAX_IDENT) i++;
+            token_mark(kinds, hash, i, TOKEN_PREPROC);
+            if (i - name != 7 || memcmp(s + name, "include", 7) != 0) break;
+            const size_t spaces = i;
+            while (i < n && classes[(unsigned char)s[i]] == SYNTAX_SPACE) i++;
+            token_mark(kinds, spaces, i, TOKEN_TEXT);
+            const char *close = i < n && s[i] == '<' ? memchr(s + i, '>', n - i) : NULL;
+            if (close == NULL) break;
+            token_mark(kinds, i, close - s + 1, TOKEN_STRING);
+            i = close - s + 1;
+        }
+        break;
+    }
+
+    size_t code = i; // start of the code not marked yet
+    while (true)
+    {
+        while (i < n && classes[(unsigned char)s[i]] < SYNTAX_QUOTE) i++;
+        if (i == n) break;
+        const char c = s[i];
+        const bool comment = c == '/' && i + 1 < n && (s[i + 1] == '/' || s[i + 1] == '*');
+        const bool literal = c != '/' && !(c == '\'' && syntax_digit_separator(classes, s, i));
+        if (!comment && !literal)
+        {
+            i++;
+            continue;
+        }
+        if (kinds != NULL) syntax_mark_code(classes, s, code, i, kinds);
+
+        const size_t start = i;
+        if (comment && s[i + 1] == '/')
+        {
+            token_mark(kinds, start, n, TOKEN_COMMENT);
+            return s[n - 1] == '\\' ? LEX_LINE_COMMENT : LEX_NORMAL;
+        }
+        if (comment)
+        {
+            i = syntax_comment_end(s, n, i + 2);
+            if (i == SIZE_MAX)
+            {
+                token_mark(kinds, start, n, TOKEN_COMMENT);
+                return LEX_COMMENT;
+            }
+            token_mark(kinds, start, i, TOKEN_COMMENT);
+        }
+        else
+        {
+            i = syntax_quoted_end(s, n, i + 1, c, &open);
+            token_mark(kinds, start, i, TOKEN_STRING);
+            if (open && c == '"') return LEX_STRING;
+        }
+        code = i;
+    }
+    if (kinds != NULL) syntax_mark_code(classes, s, code, n, kinds);
+    return LEX_NORMAL;
+}
+
+// lexes rows from the first one whose state isn't known, at most `maxRows`.
+// When a state comes out the same as the cached one the rows after it are
+// still right up to the next unknown one, so lexing goes on from there.
+// Returns true once every state is known
+bool syntax_run(Syntax *sx, const char *data, const Line *lines, size_t count, size_t maxRows) {
+    uint8_t *states = sx->states.items;
+    size_t row = atomic_load(&sx->known) - 1;
+    size_t done = 0;
+    while (row + 1 < count)
+    {
+        if (done == maxRows || (done % SYNTAX_PUBLISH_ROWS == 0 && atomic_load(&sx->cancel)))
+        {
+            // the cached state after it may not follow from the new one
+            states[row + 1] = LEX_UNKNOWN;
+            atomic_store(&sx->known, row + 1);
+            return false;
+        }
+        const Line line = lines[row];
+        const LexState state = syntax_lex_line(sx->classes, states[row], data + line.start, line.end - line.start, NULL);
+        row++;
+        done++;
+        if (states[row] != state)
+        {
+            states[row] = state;
+            if (done % SYNTAX_PUBLISH_ROWS == 0) atomic_store(&sx->known, row + 1);
+            continue;
+        }
+        const uint8_t *unknown = memchr(states + row, LEX_UNKNOWN, count - row);
+        if (unknown == NULL) break;
+        row = unknown - states - 1;
+        atomic_store(&sx->known, row + 1);
+    }
+    atomic_store(&sx->known, count);
+    return true;
+}
+
+void *syntax_thread(void *arg) {
+    Syntax *sx = arg;
+    syntax_run(sx, sx->data, sx->lines, sx->lineCount, SIZE_MAX);
+    return NULL;
+}
+
+void syntax_stop(Syntax *sx) {
+    if (!sx->running) return;
+    atomic_store(&sx->cancel, true);
+    pthread_join(sx->thread, NULL);
+    atomic_store(&sx->cancel, false);
+    sx->running = false;
+}
+
+// lexes the rest of the rows on the thread
+void syntax_start(Syntax *sx, const char *data, const Line *lines, size_t count) {
+    syntax_stop(sx);
+    sx->data = data;
+    sx->lines = lines;
+    sx->lineCount = count;
+    if (pthread_create(&sx->thread, NULL, syntax_thread, sx) == 0) sx->running = true;
+    else syntax_thread(sx);
+}
+
+// rows the loader or the follow mode added are lexed too
+void editor_syntax_grow(Editor *e) {
+    LexStates *states = &e->syntax.states;
+    if (states->count >= e->lines.count) return;
+    da_reserve(states, e->lines.count);
+    memset(states->items + states->count, LEX_UNKNOWN, e->lines.count - states->count);
+    states->count = e->lines.count;
+}
+
+// starts over for a newly opened file
+void editor_syntax_reset(Editor *e) {
+    Syntax *sx = &e->syntax;
+    syntax_stop(sx);
+    sx->enabled = syntax_language_known(e->filename);
+    sx->changed = false;
+    sx->states.count = 0;
+    da_append(&sx->states, LEX_NORMAL);
+    atomic_store(&sx->known, 1);
+}
+
+// buffer[pos, end) is about to change: the thread stops, and the rows get
+// lexed again once the update sees the new line index
+void editor_syntax_invalidate(Editor *e, size_t pos, size_t end) {
+    Syntax *sx = &e->syntax;
+    if (!sx->enabled || e->viewer.active) return;
+    syntax_stop(sx);
+    if (!sx->changed) editor_syntax_grow(e);
+    const size_t first = lines_find_row(e->lines, pos);
+    const size_t tail = e->lines.count - 1 - lines_find_row(e->lines, end);
+    // later edits count rows from the end the same way, so the smaller wins
+    if (!sx->changed || first < sx->first) sx->first = first;
+    if (!sx->changed || tail < sx->tail) sx->tail = tail;
+    sx->changed = true;
+}
+
+// called every frame: lines up the cached states with the edits since the
+// last call and lexes up to SYNTAX_SYNC_ROWS rows, the thread does the rest
+void editor_syntax_update(Editor *e) {
+    Syntax *sx = &e->syntax;
+    if (!sx->enabled || e->viewer.active) return;
+    if (sx->running)
+    {
+        if (atomic_load(&sx->known) < sx->states.count) return;
+        syntax_stop(sx);
+    }
+
+    if (sx->changed)
+    {
+        // the rows at the end move, the state at the start of every changed
+        // row and of the row after them is unknown
+        LexStates *states = &sx->states;
+        const size_t oldCount = states->count;
+        const size_t newCount = e->lines.count;
+        const size_t first = sx->first;
+        size_t keep = sx->tail;
+        if (keep > oldCount - first - 1) keep = oldCount - first - 1;
+        if (keep > newCount - first - 1) keep = newCount - first - 1;
+        da_reserve(states, newCount);
+        memmove(states->items + newCount - keep, states->items + oldCount - keep, keep);
+        const size_t unknownEnd = keep > 0 ? newCount - keep + 1 : newCount;
+        memset(states->items + first + 1, LEX_UNKNOWN, unknownEnd - first - 1);
+        states->count = newCount;
+        if (atomic_load(&sx->known) > first + 1) atomic_store(&sx->known, first + 1);
+        sx->changed = false;
+    }
+    editor_syntax_grow(e);
+
+    if (atomic_load(&sx->known) == sx->states.count) return;
+    // rows keep getting added while loading, the thread waits for the whole file
+    if (!syntax_run(sx, e->buffer.items, e->lines.items, e->lines.count, SYNTAX_SYNC_ROWS) && !editor_is_loading(e))
+        syntax_start(sx, e->buffer.items, e->lines.items, e->lines.count);
+}
+
+// -------------------
+// Bracket matching
+// the buffer is split into chunks of whole lines, and for every kind of
+// bracket each chunk knows how much it changes the depth and how low the depth
+// gets inside it. A segment tree over the chunks sums them up, so finding where
+// the depth drops back below a bracket skips whole subtrees and takes
+// O(log chunks) plus scanning two chunks. An edit only rescans the chunks it
+// touched
+
+// kind of bracket a byte is: 1 to 3 opening, -1 to -3 closing, 0 none
+int bracket_kind(char c) {
+    switch (c)
+    {
+    case '(': return 1;
+    case ')': return -1;
+    case '[': return 2;
+    case ']': return -2;
+    case '{': return 3;
+    case '}': return -3;
+    }
+    return 0;
+}
+
+BracketSummary bracket_summary_join(BracketSummary a, BracketSummary b) {
+    BracketSummary s = { .len = a.len + b.len };
+    for (int k=0; k<3; k++)
+    {
+        s.net[k] = a.net[k] + b.net[k];
+        s.low[k] = a.net[k] + b.low[k] < a.low[k] ? a.net[k] + b.low[k] : a.low[k];
+    }
+    return s;
+}
+
+void bracket_summary_add(BracketSummary *sum, char c) {
+    const int kind = bracket_kind(c);
+    if (kind == 0) return;
+    const int k = abs(kind) - 1;
+    sum->net[k] += kind > 0 ? 1 : -1;
+    if (sum->net[k] < sum->low[k]) sum->low[k] = sum->net[k];
+}
+
+BracketSummary bracket_summarize(const char *s, size_t len) {
+    BracketSummary sum = { .len = len };
+    size_t i = 0;
+#ifdef __SSE2__
+    // only the bytes that are brackets get looked at, found 16 at a time.
+    // ( ) are 0x28 0x29, [ { are 0x5b 0x7b and ] } 0x5d 0x7d
+    const __m128i parenMask = _mm_set1_epi8((char)0xfe), otherMask = _mm_set1_epi8((char)0xdf);
+    const __m128i paren = _mm_set1_epi8(0x28), open = _mm_set1_epi8(0x5b), close = _mm_set1_epi8(0x5d);
+    for (; i + 16 <= len; i += 16)
+    {
+        const __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+        const __m128i other = _mm_and_si128(a, otherMask);
+        const __m128i found = _mm_or_si128(_mm_cmpeq_epi8(_mm_and_si128(a, parenMask), paren),
+                              _mm_or_si128(_mm_cmpeq_epi8(other, open), _mm_cmpeq_epi8(other, close)));
+        for (uint32_t mask = _mm_movemask_epi8(found); mask != 0; mask &= mask - 1)
+            bracket_summary_add(&sum, s[i + __builtin_ctz(mask)]);
+    }
+#endif
+    for (; i < len; i++)
+        bracket_summary_add(&sum, s[i]);
+    return sum;
+}
+
+// splits s[from, to) into chunks ending at a line end near BRACKET_CHUNK_SIZE
+void bracket_chunks_scan(BracketSummaries *out, const char *s, size_t from, size_t to) {
+    while (from < to)
+    {
+        size_t end = to;
+        if (to - from > BRACKET_CHUNK_SIZE)
+        {
+            const char *nl = memrchr(s + from + BRACKET_CHUNK_SIZE/2, '\n', BRACKET_CHUNK_SIZE/2);
+            end = nl != NULL ? (size_t)(nl - s) + 1 : from + BRACKET_CHUNK_SIZE;
+        }
+        da_append(out, bracket_summarize(s + from, end - from));
+        from = end;
+    }
+}
+
+void bracket_tree_update(BracketIndex *bi, size_t chunk) {
+    BracketSummary *tree = bi->tree.items;
+    size_t node = bi->leaves + chunk;
+    tree[node] = bi->chunks.items[chunk];
+    for (node /= 2; node > 0; node /= 2)
+        tree[node] = bracket_summary_join(tree[2*node], tree[2*node + 1]);
+}
+
+void bracket_tree_build(BracketIndex *bi) {
+    bi->leaves = 1;
+    while (bi->leaves < bi->chunks.count) bi->leaves *= 2;
+    bi->tree.count = 0;
+    da_reserve(&bi->tree, 2*bi->leaves);
+    bi->tree.count = 2*bi->leaves;
+    BracketSummary *tree = bi->tree.items;
+    memset(tree, 0, bi->tree.count * sizeof(*tree));
+    memcpy(tree + bi->leaves, bi->chunks.items, bi->chunks.count * sizeof(*tree));
+    for (size_t node=bi->leaves - 1; node > 0; node--)
+        tree[node] = bracket_summary_join(tree[2*node], tree[2*node + 1]);
+}
+
+// chunk holding `pos`, the last one for the end of the buffer, and where it starts
+size_t bracket_chunk_at(BracketIndex *bi, size_t pos, size_t *start) {
+    const BracketSummary *tree = bi->tree.items;
+    *start = 0;
+    size_t node = 1;
+    while (node < bi->leaves)
+    {
+        const size_t left = tree[2*node].len;
+        const bool right = pos >= left && tree[2*node + 1].len > 0;
+        if (right)
+        {
+            pos -= left;
+            *start += left;
+        }
+        node = 2*node + right;
+    }
+    return node - bi->leaves;
+}
+
+size_t bracket_chunk_start(BracketIndex *bi, size_t chunk) {
+    const BracketSummary *tree = bi->tree.items;
+    size_t start = 0;
+    for (size_t node = bi->leaves + chunk; node > 1; node /= 2)
+        if (node % 2 == 1) start += tree[node - 1].len;
+    return start;
+}
+
+// first chunk in [from, hi) of the subtree at `node` where `depth` drops below
+// 0, SIZE_MAX if there is none. The chunks skipped over are added to `depth`
+size_t bracket_tree_forward(BracketIndex *bi, int k, size_t node, size_t lo, size_t hi, size_t from, int32_t *depth) {
+    if (hi <= from) return SIZE_MAX;
+    const BracketSummary *s = &bi->tree.items[node];
+    if (from <= lo && *depth + s->low[k] >= 0)
+    {
+        *depth += s->net[k];
+        return SIZE_MAX;
+    }
+    if (hi - lo == 1) return lo;
+    const size_t mid = lo + (hi - lo)/2;
+    const size_t found = bracket_tree_forward(bi, k, 2*node, lo, mid, from, depth);
+    if (found != SIZE_MAX) return found;
+    return bracket_tree_forward(bi, k, 2*node + 1, mid, hi, from, depth);
+}
+
+// same going backwards from chunk `to` - 1, the depth counts closing brackets
+size_t bracket_tree_backward(BracketIndex *bi, int k, size_t node, size_t lo, size_t hi, size_t to, int32_t *depth) {
+    if (lo >= to) return SIZE_MAX;
+    const BracketSummary *s = &bi->tree.items[node];
+    // the highest a suffix of it gets is its net minus its lowest prefix
+    if (hi <= to && *depth - (s->net[k] - s->low[k]) >= 0)
+    {
+        *depth -= s->net[k];
+        return SIZE_MAX;
+    }
+    if (hi - lo == 1) return lo;
+    const size_t mid = lo + (hi - lo)/2;
+    const size_t found = bracket_tree_backward(bi, k, 2*node + 1, mid, hi, to, depth);
+    if (found != SIZE_MAX) return found;
+    return bracket_tree_backward(bi, k, 2*node, lo, mid, to, depth);
+}
+
+// the index is built on first use and dropped with the file
+void editor_brackets_reset(Editor *e) {
+    e->brackets.built = false;
+    e->brackets.changed = false;
+}
+
+// buffer[pos, end) is about to change, the chunks over it get rescanned on the next lookup
+void editor_brackets_invalidate(Editor *e, size_t pos, size_t end) {
+    BracketIndex *bi = &e->brackets;
+    if (!bi->built) return;
+    const size_t tail = e->buffer.count - end;
+    if (!bi->changed || pos < bi->first) bi->first = pos;
+    if (!bi->changed || tail < bi->tail) bi->tail = tail;
+    bi->changed = true;
+}
+
+// builds the index or catches it up with the edits since the last lookup
+void editor_brackets_update(Editor *e) {
+    BracketIndex *bi = &e->brackets;
+    if (!bi->built)
+    {
+        bi->chunks.count = 0;
+        bracket_chunks_scan(&bi->chunks, e->buffer.items, 0, e->buffer.count);
+        if (bi->chunks.count == 0) da_append(&bi->chunks, ((BracketSummary){0}));
+        bracket_tree_build(bi);
+        bi->built = true;
+        bi->changed = false;
+        return;
+    }
+    if (!bi->changed) return;
+    bi->changed = false;
+
+    // the chunks from the one holding `first` to the one holding the last
+    // changed byte get scanned again
+    const size_t oldSize = bi->tree.items[1].len;
+    const size_t newSize = e->buffer.count;
+    const size_t lastByte = oldSize - bi->tail > bi->first ? oldSize - bi->tail - 1 : bi->first;
+    size_t start, lastStart;
+    const size_t a = bracket_chunk_at(bi, bi->first, &start);
+    const size_t b = bracket_chunk_at(bi, lastByte, &lastStart);
+    const size_t end = lastStart + bi->chunks.items[b].len + newSize - oldSize;
+
+    BracketSummaries fresh;
+    da_init(&fresh);
+    bracket_chunks_scan(&fresh, e->buffer.items, start, end);
+    if (fresh.count == 0 && bi->chunks.count == b - a + 1) da_append(&fresh, ((BracketSummary){0}));
+
+    BracketSummaries *chunks = &bi->chunks;
+    const size_t oldCount = chunks->count;
+    const size_t newCount = oldCount - (b - a + 1) + fresh.count;
+    da_reserve(chunks, newCount);
+    memmove(chunks->items + a + fresh.count, chunks->items + b + 1, (oldCount - b - 1) * sizeof(*chunks->items));
+    memcpy(chunks->items + a, fresh.items, fresh.count * sizeof(*chunks->items));
+    chunks->count = newCount;
+    da_free(&fresh);
+
+    if (newCount != oldCount) bracket_tree_build(bi);
+    else for (size_t i=a; i<=b; i++) bracket_tree_update(bi, i);
+}
+
+// where `depth` drops below 0 in buf[from, to), counting the brackets of kind
+// k+1 and adding them to `depth`. SIZE_MAX if it doesn't
+size_t bracket_scan_forward(const char *buf, size_t from, size_t to, int k, int32_t *depth) {
+    for (size_t i=from; i<to; i++)
+    {
+        const int kind = bracket_kind(buf[i]);
+        if (abs(kind) != k + 1) continue;
+        *depth += kind > 0 ? 1 : -1;
+        if (*depth < 0) return i;
+    }
+    return SIZE_MAX;
+}
+
+// same going backwards from `to` - 1, the depth counts closing brackets
+size_t bracket_scan_backward(const char *buf, size_t from, size_t to, int k, int32_t *depth) {
+    for (size_t i=to; i-- > from;)
+    {
+        const int kind = bracket_kind(buf[i]);
+        if (abs(kind) != k + 1) continue;
+        *depth += kind < 0 ? 1 : -1;
+        if (*depth < 0) return i;
+    }
+    return SIZE_MAX;
+}
+
+// position of the bracket matching the one at `pos`, SIZE_MAX if it has none.
+// Brackets of the other kinds and in strings or comments count all the same
+size_t editor_bracket_match(Editor *e, size_t pos) {
+    if (pos >= e->buffer.count || editor_is_loading(e) || e->viewer.active) return SIZE_MAX;
+    const int kind = bracket_kind(e->buffer.items[pos]);
+    if (kind == 0) return SIZE_MAX;
+    editor_brackets_update(e);
+    BracketIndex *bi = &e->brackets;
+    const char *buf = e->buffer.items;
+    const int k = abs(kind) - 1;
+    size_t start;
+    const size_t chunk = bracket_chunk_at(bi, pos, &start);
+
+    // the rest of its own chunk, then the chunk the depth drops in
+    int32_t depth = 0;
+    size_t found, next;
+    if (kind > 0)
+    {
+        found = bracket_scan_forward(buf, pos + 1, start + bi->chunks.items[chunk].len, k, &depth);
+        if (found != SIZE_MAX) return found;
+        next = bracket_tree_forward(bi, k, 1, 0, bi->leaves, chunk + 1, &depth);
+        if (next == SIZE_MAX) return SIZE_MAX;
+        const size_t nextStart = bracket_chunk_start(bi, next);
+        return bracket_scan_forward(buf, nextStart, nextStart + bi->chunks.items[next].len, k, &depth);
+    }
+    found = bracket_scan_backward(buf, start, pos, k, &depth);
+    if (found != SIZE_MAX) return found;
+    next = bracket_tree_backward(bi, k, 1, 0, bi->leaves, chunk, &depth);
+    if (next == SIZE_MAX) return SIZE_MAX;
+    const size_t nextStart = bracket_chunk_start(bi, next);
+    return bracket_scan_backward(buf, nextStart, nextStart + bi->chunks.items[next].len, k, &depth);
+}
+
+// the bracket at the cursor, or else the one before it, and its match
+bool editor_bracket_at_cursor(Editor *e, size_t *pos, size_t *match) {
+    *pos = e->c.pos;
+    *match = editor_bracket_match(e, *pos);
+    if (*match == SIZE_MAX && *pos > 0) *match = editor_bracket_match(e, --*pos);
+    return *match != SIZE_MAX;
+}
+
+// moves to the same side of the matching bracket
+void editor_cursor_to_matching_bracket(Editor *e) {
+    size_t pos, match;
+    if (!editor_bracket_at_cursor(e, &pos, &match)) return;
+    e->c.pos = pos == e->c.pos ? match : match + 1;
+}
+
+// -------------------
+// Blank lines
+// the rows of the empty lines are kept sorted, so Ctrl+Up/Down find the next
+// one with a binary search. An edit only rescans the rows it changed
+
+void blank_rows_scan(Rows *rows, const Line *lines, size_t from, size_t to) {
+    for (size_t i=from; i<to; i++)
+        if (lines[i].start == lines[i].end) da_append(rows, i);
+}
+
+// index of the first of the rows that is >= `row`
+size_t rows_lower_bound(Rows rows, size_t row) {
+    size_t lo = 0, hi = rows.count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo)/2;
+        if (rows.items[mid] < row)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// the index is built on first use and dropped with the file
+void editor_blank_lines_reset(Editor *e) {
+    e->blankLines.built = false;
+    e->blankLines.changed = false;
+}
+
+// buffer[pos, end) is about to change, its rows get looked at again on the next lookup
+void editor_blank_lines_invalidate(Editor *e, size_t pos, size_t end) {
+    BlankLines *bl = &e->blankLines;
+    if (!bl->built) return;
+    const size_t first = lines_find_row(e->lines, pos);
+    const size_t tail = e->lines.count - 1 - lines_find_row(e->lines, end);
+    if (!bl->changed || first < bl->first) bl->first = first;
+    if (!bl->changed || tail < bl->tail) bl->tail = tail;
+    bl->changed = true;
+}
+
+// builds the index or catches it up with the edits since the last lookup
+void editor_blank_lines_update(Editor *e) {
+    BlankLines *bl = &e->blankLines;
+    const Lines lines = e->lines;
+    // the loader keeps adding rows, the index is kept once it's done
+    if (!bl->built || editor_is_loading(e))
+    {
+        bl->rows.count = 0;
+        blank_rows_scan(&bl->rows, lines.items, 0, lines.count);
+        bl->lineCount = lines.count;
+        bl->built = !editor_is_loading(e);
+        bl->changed = false;
+        return;
+    }
+    if (!bl->changed) return;
+    bl->changed = false;
+
+    // rows [first, oldEnd) became [first, newEnd), the ones after moved by the difference
+    const size_t oldEnd = bl->lineCount - bl->tail;
+    const size_t newEnd = lines.count - bl->tail;
+    Rows *rows = &bl->rows;
+    const size_t a = rows_lower_bound(*rows, bl->first);
+    const size_t b = rows_lower_bound(*rows, oldEnd);
+
+    Rows fresh;
+    da_init(&fresh);
+    blank_rows_scan(&fresh, lines.items, bl->first, newEnd);
+    const size_t oldCount = rows->count;
+    const size_t newCount = oldCount - (b - a) + fresh.count;
+    da_reserve(rows, newCount);
+    // both can be empty with NULL items, which memmove/memcpy don't allow
+    if (oldCount > b) memmove(rows->items + a + fresh.count, rows->items + b, (oldCount - b) * sizeof(*rows->items));
+    if (fresh.count > 0) memcpy(rows->items + a, fresh.items, fresh.count * sizeof(*rows->items));
+    for (size_t i=a + fresh.count; i<newCount; i++)
+        rows->items[i] = rows->items[i] + newEnd - oldEnd;
+    rows->count = newCount;
+    da_free(&fresh);
+    bl->lineCount = lines.count;
+}
+
+void editor_cursor_to_next_empty_line(Editor *e) {
+    editor_blank_lines_update(e);
+    const Rows rows = e->blankLines.rows;
+    const size_t i = rows_lower_bound(rows, e->c.row + 1);
+    // move to last line if no next empty line found
+    const size_t row = i < rows.count ? rows.items[i] : e->lines.count - 1;
+    e->c.pos = e->lines.items[row].start;
+}
+
+void editor_cursor_to_prev_empty_line(Editor *e) {
+    editor_blank_lines_update(e);
+    const Rows rows = e->blankLines.rows;
+    const size_t i = rows_lower_bound(rows, e->c.row);
+    // move to first line if no previous empty line found
+    const size_t row = i > 0 ? rows.items[i - 1] : 0;
+    e->c.pos = e->lines.items[row].start;
+}
+
+// -------------------
+// Word index
+// every identifier of the buffer with how often it appears, in a hash table.
+// Completions are the most frequent words with the typed prefix, see `words_complete()`
+
+const char *word_text(const WordIndex *wi, uint32_t id) {
+    return wi->text.items + wi->entries.items[id].offset;
+}
+
+// byte order, a word sorts right after its prefixes
+int word_compare(const WordIndex *wi, uint32_t a, uint32_t b) {
+    const WordEntry *x = &wi->entries.items[a], *y = &wi->entries.items[b];
+    const int c = memcmp(word_text(wi, a), word_text(wi, b), x->len < y->len ? x->len : y->len);
+    if (c != 0) return c;
+    return (x->len > y->len) - (x->len < y->len);
+}
+
+// first 8 bytes big endian, zero padded: orders like `word_compare()` unless equal
+uint64_t word_prefix(const WordIndex *wi, uint32_t id) {
+    const unsigned char *text = (const unsigned char *)word_text(wi, id);
+    const size_t len = wi->entries.items[id].len;
+    uint64_t prefix = 0;
+    for (size_t i=0; i<8; i++) prefix = (prefix << 8) | (i < len ? text[i] : 0);
+    return prefix;
+}
+
+bool word_key_less(const WordIndex *wi, WordKey a, WordKey b) {
+    if (a.prefix != b.prefix) return a.prefix < b.prefix;
+    return word_compare(wi, a.id, b.id) < 0;
+}
+
+// bottom-up merge sort, the words themselves are only looked at when their prefixes match
+void word_ids_sort(const WordIndex *wi, uint32_t *ids, size_t n) {
+    if (n < 2) return;
+    WordKey *keys = malloc(2 * n * sizeof(*keys));
+    assert(keys != NULL);
+    for (size_t i=0; i<n; i++) keys[i] = (WordKey){ word_prefix(wi, ids[i]), ids[i] };
+    WordKey *from = keys, *to = keys + n;
+    for (size_t width = 1; width < n; width *= 2)
+    {
+        for (size_t lo = 0; lo < n; lo += 2*width)
+        {
+            const size_t mid = lo + width < n ? lo + width : n;
+            const size_t hi = lo + 2*width < n ? lo + 2*width : n;
+            size_t i = lo, j = mid, k = lo;
+            while (i < mid && j < hi) to[k++] = word_key_less(wi, from[j], from[i]) ? from[j++] : from[i++];
+            while (i < mid) to[k++] = from[i++];
+            while (j < hi) to[k++] = from[j++];
+        }
+        WordKey *swap = from; from = to; to = swap;
+    }
+    for (size_t i=0; i<n; i++) ids[i] = from[i].id;
+    free(keys);
+}
+
+// first of the sorted words that comes after `prefix`, or with `past` set
+// after the words starting with it too
+size_t words_bound(const WordIndex *wi, const char *prefix, size_t len, bool past) {
+    size_t lo = 0, hi = wi->sorted.count;
+    while (lo < hi)
+    {
+        const size_t mid = lo + (hi - lo)/2;
+        const uint32_t id = wi->sorted.items[mid];
+        const size_t wlen = wi->entries.items[id].len;
+        const int c = memcmp(word_text(wi, id), prefix, wlen < len ? wlen : len);
+        if (c < 0 || (c == 0 && (past || wlen < len))) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+void words_tree_set(WordIndex *wi, size_t rank, uint32_t count) {
+    uint32_t *best = wi->best;
+    size_t node = wi->leaves + rank;
+    best[node] = count;
+    for (node /= 2; node > 0; node /= 2)
+        best[node] = best[2*node] > best[2*node + 1] ? best[2*node] : best[2*node + 1];
+}
+
+void words_tree_build(WordIndex *wi) {
+    const WordIds sorted = wi->sorted;
+    for (size_t i=0; i<wi->touched.count; i++) wi->entries.items[wi->touched.items[i]].touched = false;
+    wi->touched.count = 0;
+
+    size_t leaves = 1;
+    while (leaves < sorted.count) leaves *= 2;
+    if (leaves != wi->leaves)
+    {
+        free(wi->best);
+        wi->best = malloc(2 * leaves * sizeof(*wi->best));
+        assert(wi->best != NULL);
+        wi->leaves = leaves;
+    }
+    uint32_t *best = wi->best;
+    for (size_t i=0; i<sorted.count; i++) best[leaves + i] = wi->entries.items[sorted.items[i]].count;
+    memset(best + leaves + sorted.count, 0, (leaves - sorted.count) * sizeof(*best));
+    for (size_t node = leaves - 1; node > 0; node--)
+        best[node] = best[2*node] > best[2*node + 1] ? best[2*node] : best[2*node + 1];
+}
+
+// counts of sorted words changed since the last query go up the tree
+void words_tree_refresh(WordIndex *wi) {
+    if (wi->touched.count > wi->sorted.count / 8)
+    {
+        words_tree_build(wi);
+        return;
+    }
+    for (size_t i=0; i<wi->touched.count; i++)
+    {
+        WordEntry *w = &wi->entries.items[wi->touched.items[i]];
+        w->touched = false;
+        words_tree_set(wi, w->rank, w->count);
+    }
+    wi->touched.count = 0;
+}
+
+// sorts the recent words into the sorted ones, a binary search each
+void words_merge(WordIndex *wi) {
+    WordIds *recent = &wi->recent, *sorted = &wi->sorted;
+    if (recent->count == 0) return;
+    word_ids_sort(wi, recent->items, recent->count);
+    const size_t n = sorted->count + recent->count;
+    uint32_t *merged = malloc(n * sizeof(*merged));
+    assert(merged != NULL);
+    size_t from = 0, k = 0;
+    for (size_t j=0; j<recent->count; j++)
+    {
+        const uint32_t id = recent->items[j];
+        size_t lo = from, hi = sorted->count;
+        while (lo < hi)
+        {
+            const size_t mid = lo + (hi - lo)/2;
+            if (word_compare(wi, sorted->items[mid], id) < 0) lo = mid + 1;
+            else hi = mid;
+        }
+        memcpy(merged + k, sorted->items + from, (lo - from) * sizeof(*merged));
+        k += lo - from;
+        from = lo;
+        merged[k++] = id;
+    }
+    memcpy(merged + k, sorted->items + from, (sorted->count - from) * sizeof(*merged));
+    free(sorted->items);
+    sorted->items = merged;
+    sorted->count = sorted->size = n;
+    recent->count = 0;
+
+    for (size_t i=0; i<n; i++) wi->entries.items[merged[i]].rank = i;
+    words_tree_build(wi);
+}
+
+void words_table_grow(WordIndex *wi) {
+    const size_t count = wi->slotCount ? wi->slotCount*2 : 1024;
+    uint32_t *slots = calloc(count, sizeof(*slots));
+    assert(slots != NULL);
+    for (size_t i=0; i<wi->entries.count; i++)
+    {
+        size_t s = wi->entries.items[i].hash & (count - 1);
+        while (slots[s] != 0) s = (s + 1) & (count - 1);
+        slots[s] = i + 1;
+    }
+    free(wi->slots);
+    wi->slots = slots;
+    wi->slotCount = count;
+}
+
+// `hash_bytes()` is made for blocks, words are short
+uint64_t word_hash(const char *word, size_t len) {
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ len;
+    for (size_t i=0; i<len; i+=8)
+    {
+        uint64_t w = 0;
+        memcpy(&w, word + i, len - i < 8 ? len - i : 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+    return h;
+}
+
+void words_add(WordIndex *wi, const char *word, size_t len, int delta) {
+    if (len > WORD_MAX_LEN || isdigit((unsigned char)word[0])) return;
+    if (2*(wi->entries.count + 1) > wi->slotCount) words_table_grow(wi);
+    const uint64_t hash = word_hash(word, len);
+    size_t s = hash & (wi->slotCount - 1);
+    for (; wi->slots[s] != 0; s = (s + 1) & (wi->slotCount - 1))
+    {
+        WordEntry *w = &wi->entries.items[wi->slots[s] - 1];
+        if (w->hash == hash && w->len == len && memcmp(wi->text.items + w->offset, word, len) == 0)
+        {
+            w->count += delta;
+            if (w->rank != WORD_UNSORTED && !w->touched)
+            {
+                w->touched = true;
+                da_append(&wi->touched, wi->slots[s] - 1);
+            }
+            return;
+        }
+    }
+    if (delta <= 0) return;
+
+    const uint32_t id = wi->entries.count;
+    da_append(&wi->entries, ((WordEntry){ hash, wi->text.count, len, delta, WORD_UNSORTED, false }));
+    if (wi->text.count + len > wi->text.size) da_reserve(&wi->text, 2*wi->text.size + len);
+    memcpy(wi->text.items + wi->text.count, word, len);
+    wi->text.count += len;
+    wi->slots[s] = id + 1;
+    da_append(&wi->recent, id);
+}
+
+// adds `delta` to the count of every word in buf[from, to), which doesn't cut words
+void words_count(WordIndex *wi, const uint8_t *classes, const char *buf, size_t from, size_t to, int delta) {
+    size_t i = from;
+#ifdef __SSE2__
+    // where identifier runs start and end, from a mask of 64 bytes at a time
+    bool inWord = false;
+    size_t start = 0;
+    for (; i + 64 <= to; i += 64)
+    {
+        uint64_t ident = 0;
+        for (int k=0; k<4; k++)
+            ident |= (uint64_t)word_class_mask(_mm_loadu_si128((const __m128i *)(buf + i + 16*k)), WORD_IDENT) << (16*k);
+        uint64_t edges = ident ^ ((ident << 1) | inWord);
+        for (; edges != 0; edges &= edges - 1)
+        {
+            const size_t at = i + __builtin_ctzll(edges);
+            if (!inWord) start = at;
+            else words_add(wi, buf + start, at - start, delta);
+            inWord = !inWord;
+        }
+    }
+    if (inWord)
+    {
+        const size_t end = i < to && classes[(unsigned char)buf[i]] == WORD_IDENT ? word_run_end(classes, buf, i, to) : i;
+        words_add(wi, buf + start, end - start, delta);
+        i = end;
+    }
+#endif
+    while (i < to)
+    {
+        const size_t end = word_run_end(classes, buf, i, to);
+        if (classes[(unsigned char)buf[i]] == WORD_IDENT) words_add(wi, buf + i, end - i, delta);
+        i = end;
+    }
+}
+
+void *words_thread(void *arg) {
+    WordIndex *wi = arg;
+    while (wi->first < wi->end && !atomic_load(&wi->cancel))
+    {
+        // chunks end after a non word byte, so `first` stays on a word start
+        size_t cut = wi->first + WORDS_CHUNK_BYTES;
+        if (cut >= wi->end) cut = wi->end;
+        else if (wi->classes[(unsigned char)wi->data[cut - 1]] == WORD_IDENT)
+        {
+            cut = word_run_end(wi->classes, wi->data, cut - 1, wi->end);
+            if (cut < wi->end) cut++;
+        }
+        words_count(wi, wi->classes, wi->data, wi->first, cut, 1);
+        wi->first = cut;
+    }
+    if (wi->first >= wi->end)
+    {
+        wi->changed = false;
+        words_merge(wi);
+    }
+    atomic_store(&wi->finished, true);
+    return NULL;
+}
+
+void words_stop(WordIndex *wi) {
+    if (!wi->running) return;
+    atomic_store(&wi->cancel, true);
+    pthread_join(wi->thread, NULL);
+    atomic_store(&wi->cancel, false);
+    wi->running = false;
+}
+
+// the thread hasn't counted everything yet, the index can't be looked at
+bool words_counting(WordIndex *wi) {
+    return wi->running && !atomic_load(&wi->finished);
+}
+
+// counts data[first, end) on the thread
+void words_start(WordIndex *wi, const uint8_t *classes, const char *data, size_t end) {
+    wi->classes = classes;
+    wi->data = data;
+    wi->end = end;
+    atomic_store(&wi->finished, false);
+    if (pthread_create(&wi->thread, NULL, words_thread, wi) == 0) wi->running = true;
+    else words_thread(wi);
+}
+
+// starts over for a newly opened file, the whole of it is uncounted
+void editor_words_reset(Editor *e) {
+    WordIndex *wi = &e->words;
+    words_stop(wi);
+    wi->entries.count = 0;
+    wi->text.count = 0;
+    wi->sorted.count = 0;
+    wi->recent.count = 0;
+    wi->touched.count = 0;
+    if (wi->slots != NULL) memset(wi->slots, 0, wi->slotCount * sizeof(*wi->slots));
+    wi->changed = true;
+    wi->first = 0;
+    wi->tail = 0;
+    e->completion.active = false;
+}
+
+// buffer[pos, end) is about to change: the words around it are taken out of
+// the counts now, while their text is still there, and counted again once changed
+void editor_words_invalidate(Editor *e, size_t pos, size_t end) {
+    WordIndex *wi = &e->words;
+    if (e->viewer.active) return;
+    words_stop(wi);
+    const uint8_t *classes = e->wordClasses;
+    const char *buf = e->buffer.items;
+    const size_t count = e->buffer.count;
+    size_t lo = pos, hi = end;
+    if (lo > 0 && classes[(unsigned char)buf[lo - 1]] == WORD_IDENT) lo = word_run_start(classes, buf, 0, lo);
+    if (hi < count && classes[(unsigned char)buf[hi]] == WORD_IDENT) hi = word_run_end(classes, buf, hi, count);
+
+    // the uncounted text stays one range, so whatever is between the two gets uncounted too
+    if (!wi->changed)
+        words_count(wi, classes, buf, lo, hi, -1);
+    else
+    {
+        const size_t first = wi->first, last = count - wi->tail;
+        if (lo < first) words_count(wi, classes, buf, lo, first, -1);
+        else lo = first;
+        if (hi > last) words_count(wi, classes, buf, last, hi, -1);
+        else hi = last;
+    }
+    wi->first = lo;
+    wi->tail = count - hi;
+    wi->changed = true;
+}
+
+// called every frame: counts the changed text, a big file on the thread
+void editor_words_update(Editor *e) {
+    WordIndex *wi = &e->words;
+    if (e->viewer.active) return;
+    if (wi->running)
+    {
+        if (!atomic_load(&wi->finished)) return;
+        words_stop(wi);
+    }
+    // the loader doesn't say what it added, the file is counted once it's done
+    if (!wi->changed || editor_is_loading(e))
+        return;
+
+    const size_t end = e->buffer.count - wi->tail;
+    if (end - wi->first > WORDS_SYNC_BYTES)
+    {
+        words_start(wi, e->wordClasses, e->buffer.items, end);
+        return;
+    }
+    words_count(wi, e->wordClasses, e->buffer.items, wi->first, end, 1);
+    wi->changed = false;
+    if (wi->recent.count > WORDS_RECENT_MAX) words_merge(wi);
+}
+
+void words_heap_push(const uint32_t *best, uint32_t *heap, size_t *count, uint32_t node) {
+    size_t i = (*count)++;
+    for (; i > 0 && best[heap[(i - 1)/2]] < best[node]; i = (i - 1)/2) heap[i] = heap[(i - 1)/2];
+    heap[i] = node;
+}
+
+uint32_t words_heap_pop(const uint32_t *best, uint32_t *heap, size_t *count) {
+    const uint32_t top = heap[0];
+    const uint32_t last = heap[--(*count)];
+    size_t i = 0;
+    for (;;)
+    {
+        size_t child = 2*i + 1;
+        if (child >= *count) break;
+        if (child + 1 < *count && best[heap[child + 1]] > best[heap[child]]) child++;
+        if (best[heap[child]] <= best[last]) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+    return top;
+}
+
+// up to `max` words in the buffer starting with `prefix` and longer than it,
+// the most frequent first. The tree is walked best first, so only the paths to
+// those words and the edges of the prefix range get looked at
+size_t words_complete(WordIndex *wi, const char *prefix, size_t len, uint32_t *out, size_t max) {
+    size_t n = 0;
+    words_tree_refresh(wi);
+    const size_t lo = words_bound(wi, prefix, len, false);
+    const size_t hi = words_bound(wi, prefix, len, true);
+
+    uint32_t heap[1024];
+    size_t heapCount = 0;
+    if (lo < hi) words_heap_push(wi->best, heap, &heapCount, 1);
+    while (heapCount > 0 && n < max)
+    {
+        const uint32_t node = words_heap_pop(wi->best, heap, &heapCount);
+        if (wi->best[node] == 0) break;
+        if (node >= wi->leaves)
+        {
+            const uint32_t id = wi->sorted.items[node - wi->leaves];
+            if (wi->entries.items[id].len > len) out[n++] = id;
+            continue;
+        }
+        // children overlapping the range, nodes at one depth cover equal spans
+        const int depth = 63 - __builtin_clzll(2*node);
+        const size_t span = wi->leaves >> depth;
+        for (uint32_t child = 2*node; child <= 2*node + 1; child++)
+        {
+            const size_t start = (child - ((size_t)1 << depth)) * span;
+            if (start < hi && start + span > lo && heapCount < sizeof(heap)/sizeof(heap[0]))
+                words_heap_push(wi->best, heap, &heapCount, child);
+        }
+    }
+
+    // and the words added since the last merge
+    for (size_t i=0; i<wi->recent.count; i++)
+    {
+        const uint32_t id = wi->recent.items[i];
+        const WordEntry *w = &wi->entries.items[id];
+        if (w->len <= len || w->count == 0 || memcmp(word_text(wi, id), prefix, len) != 0) continue;
+        if (n == max && w->count <= wi->entries.items[out[n - 1]].count) continue;
+
+        size_t k = n < max ? n++ : n - 1;
+        for (; k > 0 && wi->entries.items[out[k - 1]].count < w->count; k--) out[k] = out[k - 1];
+        out[k] = id;
+    }
+    return n;
+}
+
+// buffer[pos, end) is about to be replaced, whatever is derived from the text
+// after `pos` gets redone
+void editor_buffer_changing(Editor *e, size_t pos, size_t end) {
+    editor_regex_invalidate(e, pos);
+    editor_syntax_invalidate(e, pos, end);
+    editor_brackets_invalidate(e, pos, end);
+    editor_blank_lines_invalidate(e, pos, end);
+    editor_words_invalidate(e, pos, end);
+}
+
+// Initialize Editor struct
+void editor_init(Editor *e) {
+    e->c = (Cursor) {0};
+    e->buffer = (Buffer) {0};
+    da_init(&e->buffer);
+    e->lines = (Lines) {0};
+    da_init(&e->lines);
+
+    e->scrollX = 0;
+    e->scrollY = 0;
+    
+    e->filename = NULL;
+
+    e->inputs = (Inputs) {0};
+    word_classes_init(e->wordClasses);
+
+    e->notif = (Notification) {0};
+    da_init(&e->notif);
+
+#ifdef BUILD_RELEASE
+    e->font = LoadFont_Font();
+#else
+    e->font = LoadFont("monogram.ttf");
+#endif
+    e->fontSize = DEFAULT_FONTSIZE;
+    e->fontSpacing = 0;
+    SetTextLineSpacing(e->fontSize);
+
+    pthread_mutex_init(&e->lock, NULL);
+    e->loader = (Loader) {0};
+    e->loader.fd = -1;
+    e->saver = (Saver) {0};
+    e->origin = (Origin) {0};
+    e->origin.fd = -1;
+    e->watch = (Watch) {0};
+    e->watch.fd = -1;
+    e->watch.fileFd = -1;
+    e->journal = (Journal) {0};
+    e->journal.fd = -1;
+    e->undo = (Undo) {0};
+    da_init(&e->undo);
+    e->undo.fd = -1;
+    e->undo.limit = UNDO_DEFAULT_LIMIT;
+    e->undo.sealed = true;
+    e->viewer = (Viewer) {0};
+    e->prompt = (Prompt) {0};
+    da_init(&e->prompt);
+    e->regex = (RegexSearch) {0};
+    da_init(&e->regex.matches);
+    da_init(&e->carets);
+    pthread_mutex_init(&e->regex.lock, NULL);
+    syntax_init(&e->syntax);
+    editor_syntax_reset(e);
+    e->brackets = (BracketIndex) {0};
+    da_init(&e->brackets.chunks);
+    da_init(&e->brackets.tree);
+    e->blankLines = (BlankLines) {0};
+    da_init(&e->blankLines.rows);
+    e->words = (WordIndex) {0};
+    e->completion = (Completion) {0};
+    editor_words_reset(e);
+    e->picker = (Picker) {0};
+    pthread_mutex_init(&e->picker.walker.lock, NULL);
+    pthread_cond_init(&e->picker.walker.wake, NULL);
+    da_init(&e->scratch);
+
+    e->leftMargin = 0;
+    editor_calculate_lines(e); // NOTE: running this once results in there
+                               // being atleast one `Line`
+
+    { // init colors
+        // default colors
+        e->colors = (Colors) {
+            .text = TEXT_COLOR,
+            .ui = UI_COLOR,
+            .bg = BG_COLOR,
+            .cursor = CURSOR_COLOR,
+            .selection = SELECTION_COLOR,
+            .keyword = KEYWORD_COLOR,
+            .string = STRING_COLOR,
+            .comment = COMMENT_COLOR,
+            .number = NUMBER_COLOR,
+            .preproc = PREPROC_COLOR,
+        };
+    }
+}
+
+// the buffer may still be shared with a background save,
+// in which case it gets copied before the first modification
+bool editor_buffer_in_save(Editor *e) {
+    const Saver *sv = &e->saver;
+    return sv->active && !sv->ownsSnapshot && sv->snapshot == e->buffer.items;
+}
+
+void editor_buffer_make_writable(Editor *e) {
+    Saver *sv = &e->saver;
+    if (!editor_buffer_in_save(e)) return;
+
+    char *copy = malloc(e->buffer.size);
+    assert(copy != NULL);
+    memcpy(copy, e->buffer.items, e->buffer.count);
+    e->buffer.items = copy;
+    // the save thread keeps the old memory, freed once it is done
+    sv->ownsSnapshot = true;
+    LOG("Buffer detached from the save snapshot");
+}
+
+// patches the line index after buffer[pos, pos+removeLen) was replaced by `len` bytes
+// only the touched lines get rescanned, the ones after them just shift
+void lines_splice(Lines *lines, const char *buf, size_t pos, size_t removeLen, size_t len) {
+    const size_t first = lines_find_row(*lines, pos);
+    const size_t last = lines_find_row(*lines, pos + removeLen);
+    const size_t start = lines->items[first].start;
+
+    // rescan through the line ending of the last touched line, since the
+    // edit may have been inside a "\r\n", new offsets
+    const bool terminated = last + 1 < lines->count;
+    const size_t end = (terminated ? lines->items[last + 1].start : lines->items[last].end) - removeLen + len;
+
+    Lines fresh;
+    da_init(&fresh);
+    size_t lineStart = lines_index_range(&fresh, buf, start, start, end);
+    if (!terminated) da_append(&fresh, ((Line){ lineStart, end }));
+
+    // swap rows [first, last] for the fresh ones
+    const size_t oldRows = last - first + 1;
+    const size_t tailRows = lines->count - (last + 1);
+    da_reserve(lines, lines->count - oldRows + fresh.count);
+    memmove(&lines->items[first + fresh.count], &lines->items[last + 1], tailRows * sizeof(Line));
+    memcpy(&lines->items[first], fresh.items, fresh.count * sizeof(Line));
+    lines->count = lines->count - oldRows + fresh.count;
+
+    if (len != removeLen)
+    {
+        for (size_t i=first + fresh.count; i<lines->count; i++)
+        {
+            lines->items[i].start = lines->items[i].start - removeLen + len;
+            lines->items[i].end   = lines->items[i].end   - removeLen + len;
+        }
+    }
+    da_free(&fresh);
+}
+
+// `lines_splice()` for a batch of edits in one pass over the index, buf
+// already holds the result. Edits touching the same rows get rescanned together
+void lines_splice_many(Lines *lines, const char *buf, const Edit *edits, size_t n) {
+    Lines out;
+    da_init(&out);
+    const size_t capacity = lines->count + 1;
+    da_reserve(&out, capacity);
+
+    size_t row = 0;     // next row to copy over
+    size_t shift = 0;   // how far the text before edits[k] moved, wraps when negative
+    size_t k = 0;
+    // the edits are sorted, so their rows are found walking forward
+    size_t first = 0;
+    while (k < n)
+    {
+        first = lines_find_row_from(*lines, first, edits[k].pos);
+        size_t last = lines_find_row_from(*lines, first, edits[k].pos + edits[k].removeLen);
+        size_t shiftAfter = shift - edits[k].removeLen + edits[k].len;
+        for (k++; k < n; k++)
+        {
+            if (lines_find_row_from(*lines, last, edits[k].pos) > last) break;
+            last = lines_find_row_from(*lines, last, edits[k].pos + edits[k].removeLen);
+            shiftAfter = shiftAfter - edits[k].removeLen + edits[k].len;
+        }
+
+        for (; row < first; row++)
+            da_append(&out, ((Line){ lines->items[row].start + shift, lines->items[row].end + shift }));
+
+        const bool terminated = last + 1 < lines->count;
+        const size_t start = lines->items[first].start + shift;
+        const size_t end = (terminated ? lines->items[last + 1].start : lines->items[last].end) + shiftAfter;
+        const size_t lineStart = lines_index_range(&out, buf, start, start, end);
+        if (!terminated) da_append(&out, ((Line){ lineStart, end }));
+        row = last + 1;
+        first = last;
+        shift = shiftAfter;
+    }
+    for (; row < lines->count; row++)
+        da_append(&out, ((Line){ lines->items[row].start + shift, lines->items[row].end + shift }));
+
+    da_free(lines);
+    *lines = out;
+}
+
+// replaces buffer[pos, pos+removeLen) with text[0, len)
+// and keeps the line index and origin runs in sync
+// NOTE: use editor_buffer_replace() for edits made by the user
+void editor_buffer_splice(Editor *e, size_t pos, size_t removeLen, const char *text, size_t len) {
+    assert(pos + removeLen <= e->buffer.count);
+    editor_buffer_changing(e, pos, pos + removeLen);
+    editor_buffer_make_writable(e);
+
+    const size_t newCount = e->buffer.count - removeLen + len;
+    if (newCount > e->buffer.size)
+    {
+        const size_t newSize = newCount > e->buffer.size*2 ? newCount : e->buffer.size*2;
+        da_reserve(&e->buffer, newSize);
+    }
+
+    // move everything after the replaced range to its new place
+    char *tail = e->buffer.items + pos + removeLen;
+    size_t tailLen = e->buffer.count - (pos + removeLen);
+    memmove(e->buffer.items + pos + len, tail, tailLen);
+    if (len > 0) memcpy(e->buffer.items + pos, text, len);
+    e->buffer.count = newCount;
+
+    if (e->origin.runs.count > 0)
+        origin_runs_replace(&e->origin.runs, pos, removeLen, len);
+
+    lines_splice(&e->lines, e->buffer.items, pos, removeLen, len);
+}
+
+// applies a batch of edits, sorted and not overlapping, with their positions
+// from before any of them. The text between them moves once: in place when
+// the edits all grow or all shrink it, which is the case when every cursor
+// does the same thing, otherwise into a new buffer
+void editor_buffer_splice_many(Editor *e, const Edit *edits, size_t n) {
+    if (n == 0) return;
+    editor_buffer_changing(e, edits[0].pos, edits[n - 1].pos + edits[n - 1].removeLen);
+    editor_buffer_make_writable(e);
+
+    bool grows = true, shrinks = true;
+    size_t newCount = e->buffer.count;
+    for (size_t k=0; k<n; k++)
+    {
+        assert(edits[k].pos + edits[k].removeLen <= e->buffer.count);
+        assert(k == 0 || edits[k - 1].pos + edits[k - 1].removeLen <= edits[k].pos);
+        newCount = newCount - edits[k].removeLen + edits[k].len;
+        grows = grows && newCount >= e->buffer.count;
+        shrinks = shrinks && newCount <= e->buffer.count;
+    }
+    const size_t shiftAll = newCount - e->buffer.count;
+
+    char *buf = e->buffer.items;
+    if (grows)
+    {
+        if (newCount > e->buffer.size)
+        {
+            const size_t newSize = newCount > e->buffer.size*2 ? newCount : e->buffer.size*2;
+            da_reserve(&e->buffer, newSize);
+            buf = e->buffer.items;
+        }
+        // back to front, everything moves right
+        size_t shift = shiftAll;
+        size_t segmentEnd = e->buffer.count;
+        for (size_t k=n; k-- > 0;)
+        {
+            const Edit *ed = &edits[k];
+            const size_t segment = ed->pos + ed->removeLen;
+            memmove(buf + segment + shift, buf + segment, segmentEnd - segment);
+            shift = shift - ed->len + ed->removeLen;
+            if (ed->len > 0) memcpy(buf + ed->pos + shift, ed->text, ed->len);
+            segmentEnd = ed->pos;
+        }
+    }
+    else if (shrinks)
+    {
+        // front to back, everything moves left
+        size_t shift = 0;
+        for (size_t k=0; k<n; k++)
+        {
+            const Edit *ed = &edits[k];
+            if (ed->len > 0) memcpy(buf + ed->pos + shift, ed->text, ed->len);
+            const size_t segment = ed->pos + ed->removeLen;
+            const size_t segmentEnd = k + 1 < n ? edits[k + 1].pos : e->buffer.count;
+            shift = shift - ed->removeLen + ed->len;
+            memmove(buf + segment + shift, buf + segment, segmentEnd - segment);
+        }
+    }
+    else
+    {
+        Buffer fresh;
+        da_init(&fresh);
+        const size_t capacity = newCount > 0 ? newCount : 1;
+        da_reserve(&fresh, capacity);
+        size_t from = 0;
+        for (size_t k=0; k<n; k++)
+        {
+            memcpy(fresh.items + fresh.count, buf + from, edits[k].pos - from);
+            fresh.count += edits[k].pos - from;
+            if (edits[k].len > 0) memcpy(fresh.items + fresh.count, edits[k].text, edits[k].len);
+            fresh.count += edits[k].len;
+            from = edits[k].pos + edits[k].removeLen;
+        }
+        memcpy(fresh.items + fresh.count, buf + from, e->buffer.count - from);
+        da_free(&e->buffer);
+        e->buffer = fresh;
+    }
+    e->buffer.count = newCount;
+
+    if (e->origin.runs.count > 0)
+        origin_runs_replace_many(&e->origin.runs, edits, n);
+    lines_splice_many(&e->lines, e->buffer.items, edits, n);
+}
+
+// -------------------
+// File picker
+// the working directory is walked by a few threads sharing a stack of
+// directories, what .gitignore files ignore is left out. The list is kept for
+// the next time the picker opens. Typing more only checks the files that
+// matched before, and checking is spread over frames, see `picker_rank()`
+
+void buffer_push(Buffer *b, const char *data, size_t len) {
+    if (b->count + len > b->size) da_reserve(b, 2*b->size + len);
+    memcpy(b->items + b->count, data, len);
+    b->count += len;
+}
+
+// rules of `dir`.gitignore on top of `parent`, `parent` itself when it has none
+IgnoreRules *ignore_rules_read(const char *dir, size_t dirLen, IgnoreRules *parent) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s.gitignore", dir);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return parent;
+
+    IgnoreRules *rules = malloc(sizeof(*rules));
+    assert(rules != NULL);
+    *rules = (IgnoreRules) { .parent = parent, .dirLen = dirLen };
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n;
+    while ((n = getline(&line, &cap, f)) >= 0)
+    {
+        while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r' || line[n - 1] == ' ')) n--;
+        line[n] = '\0';
+        char *p = line;
+        if (*p == '\0' || *p == '#') continue;
+
+        IgnoreRule r = {0};
+        if (*p == '!')
+        {
+            r.negate = true;
+            p++;
+        }
+        else if (*p == '\\') p++; // "\#" and "\!"
+        size_t len = strlen(p);
+        if (len > 0 && p[len - 1] == '/')
+        {
+            r.dirOnly = true;
+            p[--len] = '\0';
+        }
+        // "**/name" is the same as "name"
+        if (strncmp(p, "**/", 3) == 0 && strchr(p + 3, '/') == NULL) p += 3;
+        if (*p == '/')
+        {
+            r.anchored = true;
+            p++;
+        }
+        else if (strchr(p, '/') != NULL) r.anchored = true;
+        if (*p == '\0') continue;
+        // without FNM_PATHNAME "*" crosses '/' too, close enough to "**"
+        r.flags = strstr(p, "**") != NULL ? 0 : FNM_PATHNAME;
+        r.pattern = strdup(p);
+        da_append(rules, r);
+    }
+    free(line);
+    fclose(f);
+    if (rules->count > 0) return rules;
+    da_free(rules);
+    free(rules);
+    return parent;
+}
+
+// whether `path` (relative to the working directory) is ignored. Like git the
+// last matching line of the deepest .gitignore decides
+bool ignore_match(const IgnoreRules *rules, const char *path, const char *name, bool isDir) {
+    for (; rules != NULL; rules = rules->parent)
+    {
+        for (size_t i = rules->count; i-- > 0;)
+        {
+            const IgnoreRule *r = &rules->items[i];
+            if (r->dirOnly && !isDir) continue;
+            if (fnmatch(r->pattern, r->anchored ? path + rules->dirLen : name, r->flags) == 0)
+                return !r->negate;
+        }
+    }
+    return false;
+}
+
+// lists `dir`: its files go to `found` null terminated, the directories to
+// walk to `subdirs`. Returns the rules of its .gitignore, NULL without one
+IgnoreRules *walker_read_dir(WalkDir dir, Buffer *found, WalkDirs *subdirs) {
+    const size_t dirLen = strlen(dir.path);
+    IgnoreRules *rules = ignore_rules_read(dir.path, dirLen, dir.rules);
+    IgnoreRules *own = rules != dir.rules ? rules : NULL;
+    DIR *d = opendir(dirLen > 0 ? dir.path : ".");
+    if (d == NULL) return own;
+
+    char path[PATH_MAX];
+    memcpy(path, dir.path, dirLen);
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL)
+    {
+        const char *name = ent->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || strcmp(name, ".git") == 0) continue;
+        const size_t nameLen = strlen(name);
+        if (dirLen + nameLen + 2 > sizeof(path)) continue;
+        memcpy(path + dirLen, name, nameLen + 1);
+
+        bool isDir = ent->d_type == DT_DIR;
+        if (ent->d_type == DT_UNKNOWN || ent->d_type == DT_LNK)
+        {
+            struct stat st;
+            if (fstatat(dirfd(d), name, &st, 0) != 0) continue;
+            // linked directories aren't followed, they can loop
+            if (S_ISDIR(st.st_mode) && ent->d_type == DT_LNK) continue;
+            isDir = S_ISDIR(st.st_mode);
+            if (!isDir && !S_ISREG(st.st_mode)) continue;
+        }
+        else if (!isDir && ent->d_type != DT_REG) continue;
+        if (ignore_match(rules, path, name, isDir)) continue;
+
+        if (isDir)
+        {
+            memcpy(path + dirLen + nameLen, "/", 2);
+            da_append(subdirs, ((WalkDir){ strdup(path), rules }));
+        }
+        else buffer_push(found, path, dirLen + nameLen + 1);
+    }
+    closedir(d);
+    return own;
+}
+
+void *walker_thread(void *arg) {
+    Walker *w = arg;
+    Buffer found;
+    WalkDirs subdirs;
+    da_init(&found);
+    da_init(&subdirs);
+
+    pthread_mutex_lock(&w->lock);
+    for (;;)
+    {
+        while (w->dirs.count == 0 && w->busy > 0 && !w->cancel) pthread_cond_wait(&w->wake, &w->lock);
+        if (w->dirs.count == 0 || w->cancel) break;
+        const WalkDir dir = w->dirs.items[--w->dirs.count];
+        w->busy++;
+        pthread_mutex_unlock(&w->lock);
+
+        IgnoreRules *rules = walker_read_dir(dir, &found, &subdirs);
+        free(dir.path);
+
+        pthread_mutex_lock(&w->lock);
+        if (rules != NULL) da_append(&w->rules, rules);
+        for (size_t i=0; i<subdirs.count; i++) da_append(&w->dirs, subdirs.items[i]);
+        buffer_push(&w->found, found.items, found.count);
+        w->busy--;
+        if (subdirs.count > 0 || w->busy == 0) pthread_cond_broadcast(&w->wake);
+        found.count = 0;
+        subdirs.count = 0;
+    }
+    // nothing left to read and nobody reading
+    if (!w->cancel) w->done = true;
+    pthread_mutex_unlock(&w->lock);
+    da_free(&found);
+    da_free(&subdirs);
+    return NULL;
+}
+
+// walks the working directory, the paths show up in `Walker.found`
+void walker_start(Walker *w) {
+    w->busy = 0;
+    w->done = false;
+    w->cancel = false;
+    w->found.count = 0;
+    da_append(&w->dirs, ((WalkDir){ strdup(""), NULL }));
+
+    // mostly waiting on the filesystem, a couple more than the cores is fine
+    const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    const int wanted = cores < 2 ? 2 : cores > PICKER_MAX_WORKERS ? PICKER_MAX_WORKERS : (int)cores;
+    w->threadCount = 0;
+    while (w->threadCount < wanted && pthread_create(&w->threads[w->threadCount], NULL, walker_thread, w) == 0)
+        w->threadCount++;
+    w->running = true;
+    if (w->threadCount == 0) walker_thread(w); // no threads, walk right here
+}
+
+// waits for the threads, with `cancel` they stop at the next directory
+void walker_stop(Walker *w, bool cancel) {
+    if (!w->running) return;
+    pthread_mutex_lock(&w->lock);
+    w->cancel = cancel;
+    pthread_cond_broadcast(&w->wake);
+    pthread_mutex_unlock(&w->lock);
+    for (int i=0; i<w->threadCount; i++) pthread_join(w->threads[i], NULL);
+    w->running = false;
+
+    for (size_t i=0; i<w->dirs.count; i++) free(w->dirs.items[i].path);
+    w->dirs.count = 0;
+    for (size_t i=0; i<w->rules.count; i++)
+    {
+        IgnoreRules *rules = w->rules.items[i];
+        for (size_t j=0; j<rules->count; j++) free(rules->items[j].pattern);
+        da_free(rules);
+        free(rules);
+    }
+    w->rules.count = 0;
+}
+
+// one bit per letter and digit, the rest of the bytes share the other 28 bits.
+// A file can only match when it has all the bits of the query
+uint64_t picker_char_mask(unsigned char c) {
+    if (c >= 'a' && c <= 'z') return 1ull << (c - 'a');
+    if (c >= '0' && c <= '9') return 1ull << (26 + c - '0');
+    return 1ull << (36 + c % 28);
+}
+
+void file_list_add(FileList *l, const char *path, size_t len) {
+    PickerFile f = { l->text.count, len, 0, 0 };
+    buffer_push(&l->text, path, len + 1);
+    if (l->lower.size < l->text.size) da_reserve(&l->lower, l->text.size);
+    char *lower = l->lower.items + f.offset;
+    for (size_t i=0; i<len; i++)
+    {
+        lower[i] = tolower((unsigned char)path[i]);
+        f.mask |= picker_char_mask(lower[i]);
+        if (path[i] == '/') f.name = i + 1;
+    }
+    lower[len] = '\0';
+    l->lower.count = l->text.count;
+    da_append(&l->files, f);
+}
+
+void file_list_clear(FileList *l) {
+    l->files.count = 0;
+    l->text.count = 0;
+    l->lower.count = 0;
+}
+
+void file_list_free(FileList *l) {
+    da_free(&l->files);
+    da_free(&l->text);
+    da_free(&l->lower);
+}
+
+// a match right after a separator or at a lower to upper case step
+bool picker_word_start(const char *path, size_t i) {
+    if (i == 0) return true;
+    const char c = path[i - 1];
+    if (c == '/' || c == '_' || c == '-' || c == '.' || c == ' ') return true;
+    return islower((unsigned char)c) && isupper((unsigned char)path[i]);
+}
+
+// scores `query` as a subsequence of the path from `from` on, PICKER_NO_MATCH
+// when it isn't one. The shortest window ending where the first match ends is
+// scored, matches at word starts and runs of matches count most
+int picker_score_from(const FileList *l, const PickerFile *f, const char *query, size_t len, size_t from) {
+    const char *s = l->lower.items + f->offset;
+    size_t pos = from;
+    for (size_t i=0; i<len; i++)
+    {
+        const char *hit = memchr(s + pos, query[i], f->len - pos);
+        if (hit == NULL) return PICKER_NO_MATCH;
+        pos = hit - s + 1;
+    }
+    size_t start = pos;
+    for (size_t i = len; i > 0;)
+        if (s[--start] == query[i - 1]) i--;
+
+    const char *path = l->text.items + f->offset;
+    int score = 0;
+    size_t prev = start;
+    for (size_t i=0; i<len; i++)
+    {
+        const size_t at = (const char *)memchr(s + prev, query[i], f->len - prev) - s;
+        score += 16;
+        if (i > 0 && at == prev) score += 24;
+        if (picker_word_start(path, at)) score += 32;
+        if (i > 0) score -= at - prev < 16 ? at - prev : 16;
+        prev = at + 1;
+    }
+    return score;
+}
+
+// matches inside the file name beat the ones spread over the directories
+int picker_score(const FileList *l, const PickerFile *f, const char *query, size_t len) {
+    const int inName = picker_score_from(l, f, query, len, f->name);
+    if (inName != PICKER_NO_MATCH) return inName + 64;
+    return f->name > 0 ? picker_score_from(l, f, query, len, 0) : PICKER_NO_MATCH;
+}
+
+// -------------------
+// Edit journal
+// every user edit is appended to a small binary file next to the document,
+// written and fsynced in batches by the journal thread, so a crash loses
+// at most JOURNAL_FLUSH_INTERVAL worth of typing
+//
+// layout: header | record*
+// header: "BCJ1" u32(0) u64(size of the file the edits apply to) u64(disk id)
+// record: u8('R') varint(pos) varint(removeLen) varint(len) bytes[len]
+
+#define JOURNAL_MAGIC "BCJ1"
+#define JOURNAL_HEADER_SIZE 24
+#define JOURNAL_FLUSH_INTERVAL 0.2
+
+// ".name<suffix>" next to `filename`, must be freed
+char *sidecar_path(const char *filename, const char *suffix) {
+    const char *slash = strrchr(filename, '/');
+    const int dirLen = slash == NULL ? 0 : (int)(slash - filename) + 1;
+    const char *name = filename + dirLen;
+    char *path = malloc(strlen(filename) + strlen(suffix) + 2);
+    sprintf(path, "%.*s.%s%s", dirLen, filename, name, suffix);
+    return path;
+}
+
+// identifies the file contents the buffer was last synced with
+uint64_t editor_disk_id(Editor *e) {
+    return hash_bytes((const char *)e->diskHashes.items, e->diskHashes.count * sizeof(uint64_t)) ^ e->diskSize;
+}
+
+void varint_append(Buffer *b, uint64_t v) {
+    while (v >= 0x80)
+    {
+        da_append(b, (char)(v | 0x80));
+        v >>= 7;
+    }
+    da_append(b, (char)v);
+}
+
+// returns false when the data runs out
+bool varint_read(const char **p, const char *end, uint64_t *v) {
+    *v = 0;
+    for (int shift=0; *p < end && shift < 64; shift += 7)
+    {
+        const unsigned char byte = *(*p)++;
+        *v |= (uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+void *journal_thread(void *arg) {
+    Journal *j = arg;
+    Buffer batch;
+    da_init(&batch);
+
+    pthread_mutex_lock(&j->lock);
+    while (true)
+    {
+        while (j->pending.count == 0 && !j->headerPending && !j->stop)
+            pthread_cond_wait(&j->wake, &j->lock);
+        if (j->pending.count == 0 && !j->headerPending && j->stop) break;
+
+        // give the batch a moment to fill up, bounded by the flush interval
+        if (!j->stop)
+        {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += (long)(JOURNAL_FLUSH_INTERVAL * 1e9);
+            deadline.tv_sec += deadline.tv_nsec / 1000000000;
+            deadline.tv_nsec %= 1000000000;
+            while (!j->stop && pthread_cond_timedwait(&j->wake, &j->lock, &deadline) == 0);
+        }
+
+        Buffer tmp = batch;
+        batch = j->pending;
+        j->pending = tmp;
+        j->pending.count = 0;
+        const bool headerPending = j->headerPending;
+        uint64_t header[2];
+        memcpy(header, j->header, sizeof(header));
+        j->headerPending = false;
+        pthread_mutex_unlock(&j->lock);
+
+        if (headerPending) pwrite(j->fd, header, sizeof(header), 8);
+
+        for (size_t done=0; done<batch.count; )
+        {
+            ssize_t n = write(j->fd, batch.items + done, batch.count - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break; // nothing sensible to do, the journal is best effort
+            done += n;
+        }
+        fdatasync(j->fd);
+
+        pthread_mutex_lock(&j->lock);
+    }
+    pthread_mutex_unlock(&j->lock);
+    da_free(&batch);
+    return NULL;
+}
+
+// starts the journal thread appending to the already open `fd`
+void journal_start(Journal *j, int fd) {
+    j->fd = fd;
+    j->stop = false;
+    j->headerPending = false;
+    da_init(&j->pending);
+    pthread_mutex_init(&j->lock, NULL);
+    pthread_cond_init(&j->wake, NULL);
+    j->running = pthread_create(&j->thread, NULL, journal_thread, j) == 0;
+    if (!j->running)
+    {
+        close(fd);
+        j->fd = -1;
+    }
+}
+
+// flushes whatever is queued and stops the journal thread
+void editor_journal_close(Editor *e) {
+    Journal *j = &e->journal;
+    if (!j->running) return;
+    pthread_mutex_lock(&j->lock);
+    j->stop = true;
+    pthread_cond_signal(&j->wake);
+    pthread_mutex_unlock(&j->lock);
+    pthread_join(j->thread, NULL);
+    pthread_mutex_destroy(&j->lock);
+    pthread_cond_destroy(&j->wake);
+    da_free(&j->pending);
+    close(j->fd);
+    j->fd = -1;
+    j->running = false;
+}
+
+// the edits are safe on disk, the journal is not needed anymore
+void editor_journal_discard(Editor *e) {
+    editor_journal_close(e);
+    if (e->filename == NULL) return;
+    char *path = sidecar_path(e->filename, ".bjournal");
+    unlink(path);
+    free(path);
+    e->journal.streamPos = 0;
+}
+
+// creates a fresh journal for edits on top of the current disk contents
+bool editor_journal_open(Editor *e) {
+    Journal *j = &e->journal;
+    char *path = sidecar_path(e->filename, ".bjournal");
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    free(path);
+    if (fd < 0) return false;
+
+    char header[JOURNAL_HEADER_SIZE] = JOURNAL_MAGIC;
+    const uint64_t size = e->diskSize;
+    const uint64_t id = editor_disk_id(e);
+    memcpy(header + 8, &size, 8);
+    memcpy(header + 16, &id, 8);
+    if (write(fd, header, sizeof(header)) != sizeof(header))
+    {
+        close(fd);
+        return false;
+    }
+    j->streamPos = 0;
+    journal_start(j, fd);
+    return j->running;
+}
+
+// queues a user edit, called by editor_buffer_replace()
+void editor_journal_record(Editor *e, size_t pos, size_t removeLen, const char *text, size_t len) {
+    Journal *j = &e->journal;
+    if (e->filename == NULL || j->disabled) return;
+    if (!j->running && !editor_journal_open(e))
+    {
+        j->disabled = true; // e.g. read-only directory, don't retry on every key
+        return;
+    }
+
+    pthread_mutex_lock(&j->lock);
+    const size_t before = j->pending.count;
+    da_append(&j->pending, 'R');
+    varint_append(&j->pending, pos);
+    varint_append(&j->pending, removeLen);
+    varint_append(&j->pending, len);
+    da_reserve(&j->pending, j->pending.count + len);
+    if (len > 0) memcpy(j->pending.items + j->pending.count, text, len);
+    j->pending.count += len;
+    j->streamPos += j->pending.count - before;
+    if (before == 0) pthread_cond_signal(&j->wake); // otherwise it's already batching
+    pthread_mutex_unlock(&j->lock);
+}
+
+// the followed file grew at its end. The records apply to it as they are,
+// only the header has to say which contents they are for now, the journal
+// thread writes it with the next batch
+void editor_journal_retarget(Editor *e) {
+    Journal *j = &e->journal;
+    if (!j->running) return;
+    pthread_mutex_lock(&j->lock);
+    j->header[0] = e->diskSize;
+    j->header[1] = editor_disk_id(e);
+    if (j->pending.count == 0 && !j->headerPending) pthread_cond_signal(&j->wake);
+    j->headerPending = true;
+    pthread_mutex_unlock(&j->lock);
+}
+
+// the file on disk now holds the snapshot taken when the stream was at `mark`,
+// so only the records after it are kept, on top of the new disk contents
+void editor_journal_rebase(Editor *e, size_t mark) {
+    Journal *j = &e->journal;
+    if (!j->running) return;
+    const size_t streamPos = j->streamPos;
+    editor_journal_close(e);
+
+    char *path = sidecar_path(e->filename, ".bjournal");
+    Buffer tail;
+    da_init(&tail);
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0 && streamPos > mark)
+    {
+        da_reserve(&tail, streamPos - mark);
+        ssize_t n = pread(fd, tail.items, streamPos - mark, JOURNAL_HEADER_SIZE + mark);
+        tail.count = n > 0 ? n : 0;
+    }
+    if (fd >= 0) close(fd);
+    free(path);
+
+    if (editor_journal_open(e) && tail.count > 0)
+    {
+        pthread_mutex_lock(&j->lock);
+        da_reserve(&j->pending, tail.count);
+        memcpy(j->pending.items, tail.items, tail.count);
+        j->pending.count = tail.count;
+        j->streamPos = tail.count;
+        pthread_cond_signal(&j->wake);
+        pthread_mutex_unlock(&j->lock);
+    }
+    da_free(&tail);
+}
+
+// applies the records in data[0, size) to the buffer
+// a gap buffer keeps long runs of nearby edits cheap: each record only moves
+// the bytes between it and the previous one instead of the whole tail
+// returns the length of the valid records, `records` is set to their number
+size_t editor_journal_apply(Editor *e, const char *data, size_t size, size_t *records) {
+    // first pass: validate and size the gap
+    const char *p = data, *end = data + size;
+    size_t inserted = 0;
+    *records = 0;
+    size_t length = e->buffer.count;
+    const char *validEnd = data;
+    while (p < end)
+    {
+        uint64_t pos, removeLen, len;
+        if (*p++ != 'R') break;
+        if (!varint_read(&p, end, &pos) || !varint_read(&p, end, &removeLen) || !varint_read(&p, end, &len)) break;
+        if (len > (size_t)(end - p) || pos + removeLen > length) break; // torn write at the end
+        p += len;
+        inserted += len;
+        length = length - removeLen + len;
+        (*records)++;
+        validEnd = p;
+    }
+    if (*records == 0) return 0;
+
+    const size_t origSize = e->buffer.count;
+    const size_t cap = e->buffer.count + inserted;
+    char *gap = malloc(cap);
+    assert(gap != NULL);
+    size_t gapStart = e->buffer.count, gapEnd = cap;
+    memcpy(gap, e->buffer.items, e->buffer.count);
+
+    size_t lo = SIZE_MAX, tail = origSize; // untouched prefix and suffix
+    for (p = data; p < validEnd; )
+    {
+        uint64_t pos, removeLen, len;
+        p++;
+        varint_read(&p, end, &pos);
+        varint_read(&p, end, &removeLen);
+        varint_read(&p, end, &len);
+
+        // move the gap to pos
+        if (pos < gapStart)
+        {
+            const size_t n = gapStart - pos;
+            memmove(gap + gapEnd - n, gap + pos, n);
+            gapStart -= n;
+            gapEnd -= n;
+        }
+        else if (pos > gapStart)
+        {
+            const size_t n = pos - gapStart;
+            memmove(gap + gapStart, gap + gapEnd, n);
+            gapStart += n;
+            gapEnd += n;
+        }
+        gapEnd += removeLen;
+        memcpy(gap + gapStart, p, len);
+        gapStart += len;
+        p += len;
+
+        const size_t count = gapStart + (cap - gapEnd);
+        if (pos < lo) lo = pos;
+        if (count - gapStart < tail) tail = count - gapStart;
+    }
+
+    // close the gap
+    memmove(gap + gapStart, gap + gapEnd, cap - gapEnd);
+    const size_t count = gapStart + (cap - gapEnd);
+    editor_buffer_changing(e, lo, e->buffer.count);
+    editor_buffer_make_writable(e);
+    free(e->buffer.items);
+    e->buffer.items = gap;
+    e->buffer.size = cap;
+    e->buffer.count = count;
+    editor_calculate_lines(e);
+
+    // only the untouched ends still match the original
+    OriginRuns *runs = &e->origin.runs;
+    const bool wholeFile = runs->count == 1 && runs->items[0].pos == 0 && runs->items[0].len == origSize;
+    runs->count = 0;
+    if (wholeFile)
+    {
+        if (lo > 0) da_append(runs, ((OriginRun){ 0, 0, lo }));
+        if (tail > 0 && count - tail >= lo) da_append(runs, ((OriginRun){ count - tail, origSize - tail, tail }));
+    }
+    return validEnd - data;
+}
+
+// -------------------
+// Undo history
+// edits are kept as compact records, typing is coalesced into word sized groups
+
+size_t undo_record_bytes(const UndoRecord *r) {
+    return sizeof(*r) + (r->swap ? r->other.size + r->insertedLen : r->removedLen + r->insertedLen);
+}
+
+void undo_record_free(UndoRecord *r) {
+    free(r->data);
+    da_free(&r->other);
+}
+
+// -------------------
+// Persistent undo history
+// on save, the history up to the saved state is appended to a file next to
+// the document, so reopening the same contents can keep undoing
+//
+// layout: header | record*
+// header: "BCU1" u32(0) u64(content size) u64(content id) u64(record count) u64(next group)
+// record: u64 pos, removedLen, insertedLen, cursor | u32 group, u32(0) | removed | inserted | u64 record size
+// the size at the end of each record lets the history be walked backwards
+// through a mapping of the file, touching only the records that get undone
+
+#define UNDO_FILE_MAGIC "BCU1"
+#define UNDO_FILE_HEADER_SIZE 40
+#define UNDO_FILE_RECORD_HEADER 40
+#define UNDO_FILE_BATCH 256 // records read from the history file at once
+
+// writes the queued records and then the header, no TextFormat() here
+void *undo_writer_thread(void *arg) {
+    Undo *u = arg;
+    for (; u->written < u->writes.count; u->written++)
+    {
+        const UndoWrite *w = &u->writes.items[u->written];
+        uint64_t recordSize = UNDO_FILE_RECORD_HEADER + w->head[1] + w->head[2] + 8;
+        struct iovec iov[4] = {
+            { (void *)w->head, UNDO_FILE_RECORD_HEADER },
+            { (void *)w->removed, w->head[1] },
+            { (void *)w->inserted, w->head[2] },
+            { &recordSize, 8 },
+        };
+        if (pwritev(u->fd, iov, 4, w->offset) != (ssize_t)recordSize)
+        {
+            u->writeError = errno;
+            break;
+        }
+    }
+
+    char header[UNDO_FILE_HEADER_SIZE] = UNDO_FILE_MAGIC;
+    u->header[2] += u->written;
+    memcpy(header + 8, u->header, sizeof(u->header));
+    if (pwrite(u->fd, header, sizeof(header), 0) != sizeof(header) && u->writeError == 0)
+        u->writeError = errno;
+    fdatasync(u->fd);
+    return NULL;
+}
+
+// records that didn't make it into the file are written on the next save
+void undo_writer_finish(Undo *u) {
+    u->writing = false;
+    if (u->writeError != 0) LOG("Cannot write undo history: %s", strerror(u->writeError));
+    const size_t failed = u->writes.count - u->written;
+    if (failed > 0)
+    {
+        u->persisted -= failed;
+        u->fileEnd = u->writes.items[u->written].offset;
+    }
+    u->writes.count = 0;
+}
+
+// joins the history write, if one is running
+void undo_writer_wait(Undo *u) {
+    if (!u->writing) return;
+    pthread_join(u->writer, NULL);
+    undo_writer_finish(u);
+}
+
+void undo_file_close(Undo *u) {
+    undo_writer_wait(u);
+    if (u->map != NULL) munmap((void *)u->map, u->mapSize);
+    if (u->fd >= 0) close(u->fd);
+    u->map = NULL;
+    u->mapSize = 0;
+    u->fd = -1;
+    u->base = 0;
+    u->persisted = 0;
+    u->fileEnd = 0;
+}
+
+// makes sure file[0, end) is mapped
+bool undo_file_map(Undo *u, size_t end) {
+    if (end <= u->mapSize) return true;
+    struct stat st;
+    if (fstat(u->fd, &st) < 0 || (size_t)st.st_size < end) return false;
+    if (u->map != NULL) munmap((void *)u->map, u->mapSize);
+    u->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, u->fd, 0);
+    if (u->map == MAP_FAILED)
+    {
+        u->map = NULL;
+        u->mapSize = 0;
+        return false;
+    }
+    u->mapSize = st.st_size;
+    return true;
+}
+
+// picks up the history saved for the current contents of the file, if any
+void editor_undo_open(Editor *e) {
+    Undo *u = &e->undo;
+    undo_file_close(u);
+    char *path = sidecar_path(e->filename, ".bundo");
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    free(path);
+    if (fd < 0) return;
+
+    char header[UNDO_FILE_HEADER_SIZE];
+    uint64_t size, id, count, nextGroup;
+    struct stat st;
+    if (pread(fd, header, sizeof(header), 0) != sizeof(header) || memcmp(header, UNDO_FILE_MAGIC, 4) != 0 || fstat(fd, &st) < 0)
+    {
+        close(fd);
+        return;
+    }
+    memcpy(&size, header + 8, 8);
+    memcpy(&id, header + 16, 8);
+    memcpy(&count, header + 24, 8);
+    memcpy(&nextGroup, header + 32, 8);
+    if (size != e->diskSize || id != editor_disk_id(e))
+    {
+        LOG("Ignoring undo history, it was saved for different file contents");
+        close(fd);
+        return;
+    }
+
+    u->fd = fd;
+    u->base = count;
+    u->fileEnd = st.st_size;
+    if (nextGroup > u->group) u->group = nextGroup;
+    LOG("Found %zu records of undo history", (size_t)count);
+}
+
+// reads the record of the history file ending at `end`
+bool undo_file_read(Undo *u, size_t end, UndoRecord *r) {
+    if (end < UNDO_FILE_HEADER_SIZE + UNDO_FILE_RECORD_HEADER + 8 || !undo_file_map(u, end)) return false;
+
+    uint64_t recordSize, fields[4];
+    uint32_t group;
+    memcpy(&recordSize, u->map + end - 8, 8);
+    if (recordSize > end - UNDO_FILE_HEADER_SIZE || recordSize < UNDO_FILE_RECORD_HEADER + 8) return false;
+    const size_t start = end - recordSize;
+    memcpy(fields, u->map + start, sizeof(fields));
+    memcpy(&group, u->map + start + 32, 4);
+    const size_t dataLen = recordSize - UNDO_FILE_RECORD_HEADER - 8;
+    if (fields[1] + fields[2] != dataLen) return false;
+
+    *r = (UndoRecord) {
+        .pos = fields[0],
+        .removedLen = fields[1],
+        .insertedLen = fields[2],
+        .cursor = fields[3],
+        .group = group,
+        .data = malloc(dataLen + 1),
+        .fileOffset = start,
+    };
+    assert(r->data != NULL);
+    memcpy(r->data, u->map + start + UNDO_FILE_RECORD_HEADER, dataLen);
+    return true;
+}
+
+// brings back the groups right before the ones in memory from the file,
+// a batch of them at a time so walking far back doesn't shift the array for
+// every record, returns false if there's nothing left
+bool undo_file_load(Undo *u) {
+    UndoRecords batch;
+    da_init(&batch);
+    size_t end = u->persisted > 0 ? u->items[0].fileOffset : u->fileEnd;
+    UndoRecord r;
+    while (batch.count < u->base && undo_file_read(u, end, &r))
+    {
+        if (batch.count >= UNDO_FILE_BATCH && r.group != batch.items[batch.count - 1].group)
+        {
+            undo_record_free(&r);
+            break;
+        }
+        da_append(&batch, r);
+        end = r.fileOffset;
+    }
+
+    const size_t n = batch.count;
+    size_t needed = u->count + n;
+    da_reserve(u, needed);
+    memmove(u->items + n, u->items, u->count * sizeof(UndoRecord));
+    for (size_t i=0; i<n; i++)
+    {
+        u->items[n - 1 - i] = batch.items[i];
+        u->bytes += undo_record_bytes(&batch.items[i]);
+    }
+    u->count += n;
+    u->base -= n;
+    u->persisted += n;
+    u->pos += n;
+    if (u->savedPos != SIZE_MAX) u->savedPos += n;
+    da_free(&batch);
+    return n > 0;
+}
+
+// appends the history up to the saved state to the file, called after a save.
+// A replace over a big file makes for huge records, so the writing happens
+// on `undo_writer_thread()`
+void editor_undo_persist(Editor *e) {
+    Undo *u = &e->undo;
+    undo_writer_wait(u);
+    if (u->fd < 0)
+    {
+        // no usable history on disk yet, start over
+        char *path = sidecar_path(e->filename, ".bundo");
+        u->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        free(path);
+        if (u->fd < 0) return;
+        u->base = 0;
+        u->persisted = 0;
+        u->fileEnd = UNDO_FILE_HEADER_SIZE;
+    }
+
+    // undone records don't lead to the saved state anymore
+    if (u->persisted > u->pos)
+    {
+        u->fileEnd = u->items[u->pos].fileOffset;
+        u->persisted = u->pos;
+    }
+    if (u->mapSize > u->fileEnd)
+    {
+        munmap((void *)u->map, u->mapSize);
+        u->map = NULL;
+        u->mapSize = 0;
+    }
+    if (ftruncate(u->fd, u->fileEnd) < 0) return;
+
+    const uint64_t header[4] = { e->diskSize, editor_disk_id(e), u->base + u->persisted, u->group + 1 };
+    memcpy(u->header, header, sizeof(header));
+    for (; u->persisted < u->pos; u->persisted++)
+    {
+        UndoRecord *r = &u->items[u->persisted];
+        // applied swap records keep the buffer from before the edit
+        UndoWrite w = {
+            .head = { r->pos, r->removedLen, r->insertedLen, r->cursor, r->group },
+            .removed = r->swap ? r->other.items + r->pos : r->data,
+            .inserted = r->swap ? r->data : r->data + r->removedLen,
+            .offset = u->fileEnd,
+        };
+        da_append(&u->writes, w);
+        r->fileOffset = u->fileEnd;
+        u->fileEnd += UNDO_FILE_RECORD_HEADER + r->removedLen + r->insertedLen + 8;
+    }
+
+    u->written = 0;
+    u->writeError = 0;
+    u->writing = true;
+    if (pthread_create(&u->writer, NULL, undo_writer_thread, u) != 0)
+    {
+        // no thread, write it right here
+        undo_writer_thread(u);
+        undo_writer_finish(u);
+    }
+}
+
+void undo_clear(Undo *u) {
+    undo_writer_wait(u);
+    for (size_t i=0; i<u->count; i++) undo_record_free(&u->items[i]);
+    u->count = 0;
+    u->pos = 0;
+    u->bytes = 0;
+    u->sealed = true;
+    u->savedPos = 0;
+    undo_file_close(u);
+}
+
+// drops the records that can't be redone anymore
+void undo_truncate(Undo *u) {
+    if (u->count > u->pos) undo_writer_wait(u);
+    if (u->persisted > u->pos)
+    {
+        // the file gets cut there on the next save
+        u->fileEnd = u->items[u->pos].fileOffset;
+        u->persisted = u->pos;
+    }
+    for (size_t i=u->pos; i<u->count; i++)
+    {
+        u->bytes -= undo_record_bytes(&u->items[i]);
+        undo_record_free(&u->items[i]);
+    }
+    if (u->savedPos > u->pos && u->savedPos != SIZE_MAX) u->savedPos = SIZE_MAX;
+    u->count = u->pos;
+}
+
+// drops the oldest groups until the history fits the limit
+// the newest group always stays, however big it is
+void undo_enforce_limit(Undo *u) {
+    size_t drop = 0, bytes = u->bytes;
+    while (bytes > u->limit && drop < u->count)
+    {
+        const uint32_t group = u->items[drop].group;
+        size_t end = drop;
+        size_t groupBytes = 0;
+        for (; end < u->count && u->items[end].group == group; end++)
+            groupBytes += undo_record_bytes(&u->items[end]);
+        if (end == u->count) break;
+        drop = end;
+        bytes -= groupBytes;
+    }
+    if (drop == 0) return;
+
+    undo_writer_wait(u);
+    for (size_t i=0; i<drop; i++) undo_record_free(&u->items[i]);
+    memmove(u->items, u->items + drop, (u->count - drop) * sizeof(UndoRecord));
+    u->count -= drop;
+    u->pos = u->pos > drop ? u->pos - drop : 0;
+    u->savedPos = u->savedPos != SIZE_MAX && u->savedPos >= drop ? u->savedPos - drop : SIZE_MAX;
+    u->bytes = bytes;
+    if (drop <= u->persisted)
+    {
+        u->base += drop;
+        u->persisted -= drop;
+    }
+    else if (u->fd >= 0) undo_file_close(u); // the file can't be continued anymore
+}
+
+bool undo_is_space(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// merges a single byte insert or delete into the previous record while typing
+// a word, returns false when it starts something new
+bool undo_coalesce(Undo *u, size_t pos, size_t removeLen, const char *removed, const char *text, size_t len, double now) {
+    if (u->pos == 0 || u->pos != u->count || u->count <= u->persisted) return false;
+    UndoRecord *r = &u->items[u->count - 1];
+    if (r->swap || now - r->time > UNDO_COALESCE_TIME) return false;
+
+    if (removeLen == 0 && len == 1 && r->removedLen == 0 && r->insertedLen > 0 && pos == r->pos + r->insertedLen)
+    {
+        // typing: a new word after whitespace starts a new group
+        const char prev = r->data[r->insertedLen - 1];
+        if (text[0] == '\n' || text[0] == '\r' || (undo_is_space(prev) && !undo_is_space(text[0]))) return false;
+        r->data = realloc(r->data, r->insertedLen + 1);
+        r->data[r->insertedLen++] = text[0];
+    }
+    else if (len == 0 && removeLen == 1 && r->insertedLen == 0 && r->removedLen > 0 && pos + 1 == r->pos)
+    {
+        // backspace: stop at the start of a word
+        if (removed[0] == '\n' || (undo_is_space(removed[0]) && !undo_is_space(r->data[0]))) return false;
+        r->data = realloc(r->data, r->removedLen + 1);
+        memmove(r->data + 1, r->data, r->removedLen);
+        r->data[0] = removed[0];
+        r->removedLen++;
+        r->pos--;
+    }
+    else if (len == 0 && removeLen == 1 && r->insertedLen == 0 && r->removedLen > 0 && pos == r->pos)
+    {
+        // delete: same the other way
+        if (removed[0] == '\n' || (undo_is_space(removed[0]) && !undo_is_space(r->data[r->removedLen - 1]))) return false;
+        r->data = realloc(r->data, r->removedLen + 1);
+        r->data[r->removedLen++] = removed[0];
+    }
+    else return false;
+
+    r->time = now;
+    u->bytes++;
+    return true;
+}
+
+void undo_push(Undo *u, UndoRecord r) {
+    undo_truncate(u);
+    if (u->sealed) u->group++;
+    u->sealed = false;
+    r.group = u->group;
+    r.time = GetTime();
+    da_append(u, r);
+    u->pos = u->count;
+    u->bytes += undo_record_bytes(&r);
+    undo_enforce_limit(u);
+}
+
+// records buffer[pos, pos+removeLen) being replaced by text[0, len), before it happens
+void editor_undo_record(Editor *e, size_t pos, size_t removeLen, const char *text, size_t len) {
+    Undo *u = &e->undo;
+    const char *removed = e->buffer.items + pos;
+    if (undo_coalesce(u, pos, removeLen, removed, text, len, GetTime()))
+    {
+        u->sealed = false;
+        return;
+    }
+
+    UndoRecord r = {
+        .pos = pos,
+        .removedLen = removeLen,
+        .insertedLen = len,
+        .data = malloc(removeLen + len + 1),
+        .cursor = e->c.pos,
+    };
+    assert(r.data != NULL);
+    memcpy(r.data, removed, removeLen);
+    if (len > 0) memcpy(r.data + removeLen, text, len);
+    undo_push(u, r);
+}
+
+// replaces a large part of the buffer by building the (small) result in a new
+// buffer and handing the old one to the undo history, so a select all +
+// delete of a huge file copies nothing
+void editor_buffer_replace_shared(Editor *e, size_t pos, size_t removeLen, const char *text, size_t len) {
+    editor_buffer_changing(e, pos, pos + removeLen);
+    Buffer old = e->buffer;
+    const size_t tailLen = old.count - (pos + removeLen);
+
+    Buffer fresh;
+    da_init(&fresh);
+    const size_t needed = old.count - removeLen + len;
+    const size_t capacity = needed > 0 ? needed : 1;
+    da_reserve(&fresh, capacity);
+    memcpy(fresh.items, old.items, pos);
+    if (len > 0) memcpy(fresh.items + pos, text, len);
+    memcpy(fresh.items + pos + len, old.items + pos + removeLen, tailLen);
+    fresh.count = needed;
+
+    UndoRecord r = {
+        .pos = pos,
+        .removedLen = removeLen,
+        .insertedLen = len,
+        .data = malloc(len + 1), // only for the history file
+        .cursor = e->c.pos,
+        .swap = true,
+        .other = old,
+    };
+    assert(r.data != NULL);
+    if (len > 0) memcpy(r.data, text, len);
+    e->buffer = fresh;
+    if (e->origin.runs.count > 0)
+        origin_runs_replace(&e->origin.runs, pos, removeLen, len);
+    lines_splice(&e->lines, e->buffer.items, pos, removeLen, len);
+    undo_push(&e->undo, r);
+}
+
+// replaces every needle[0, m) with text[0, len) in a single pass, returns how
+// many. The result is built in a new buffer and the old one goes to the undo
+// history whole, like `editor_buffer_replace_shared()`, so it is one swap to undo
+size_t editor_replace_all(Editor *e, const char *needle, size_t m, const char *text, size_t len) {
+    size_t hit = search_forward(e->buffer.items, e->buffer.count, needle, m);
+    if (hit == SEARCH_NOT_FOUND) return 0;
+    editor_buffer_changing(e, hit, e->buffer.count);
+    editor_buffer_make_writable(e); // the history can't share it with the save
+    const Buffer old = e->buffer;
+    const size_t first = hit;
+
+    Buffer fresh;
+    da_init(&fresh);
+    const size_t capacity = old.count + 1; // enough unless the text grows
+    da_reserve(&fresh, capacity);
+    size_t pos = 0;
+    size_t count = 0;
+    size_t cursor = e->c.pos;
+    while (hit != SEARCH_NOT_FOUND)
+    {
+        const size_t needed = fresh.count + (hit - pos) + len + (old.count - hit - m);
+        if (needed > fresh.size)
+        {
+            const size_t grown = fresh.size*2 > needed ? fresh.size*2 : needed;
+            da_reserve(&fresh, grown);
+        }
+        memcpy(fresh.items + fresh.count, old.items + pos, hit - pos);
+        fresh.count += hit - pos;
+        // a cursor inside a match ends up at the start of its replacement
+        if (hit + m <= e->c.pos) cursor = cursor - m + len;
+        else if (hit < e->c.pos) cursor = fresh.count;
+        memcpy(fresh.items + fresh.count, text, len);
+        fresh.count += len;
+
+        pos = hit + m;
+        count++;
+        hit = search_forward(old.items + pos, old.count - pos, needle, m);
+        if (hit != SEARCH_NOT_FOUND) hit += pos;
+    }
+    const size_t removeLen = pos - first;
+    const size_t insertedLen = fresh.count - first;
+    memcpy(fresh.items + fresh.count, old.items + pos, old.count - pos);
+    fresh.count += old.count - pos;
+
+    editor_journal_record(e, first, removeLen, fresh.items + first, insertedLen);
+    UndoRecord r = {
+        .pos = first,
+        .removedLen = removeLen,
+        .insertedLen = insertedLen,
+        .data = malloc(insertedLen + 1), // only for the history file
+        .cursor = e->c.pos,
+        .swap = true,
+        .other = old,
+    };
+    assert(r.data != NULL);
+    memcpy(r.data, fresh.items + first, insertedLen);
+    e->buffer = fresh;
+    if (e->origin.runs.count > 0)
+        origin_runs_replace(&e->origin.runs, first, removeLen, insertedLen);
+    editor_calculate_lines(e);
+    undo_push(&e->undo, r);
+    e->modified = true;
+    e->c.pos = cursor;
+    return count;
+}
+
+// every modification made by the user goes through here
+void editor_buffer_replace(Editor *e, size_t pos, size_t removeLen, const char *text, size_t len) {
+    editor_journal_record(e, pos, removeLen, text, len);
+    if (!e->undo.applying && removeLen >= UNDO_SHARE_THRESHOLD && removeLen >= e->buffer.count / 2 && !editor_buffer_in_save(e))
+        editor_buffer_replace_shared(e, pos, removeLen, text, len);
+    else
+    {
+        if (!e->undo.applying) editor_undo_record(e, pos, removeLen, text, len);
+        editor_buffer_splice(e, pos, removeLen, text, len);
+    }
+    e->modified = true;
+}
+
+// `editor_buffer_replace()` for a batch of edits, see `editor_buffer_splice_many()`
+// the journal and the history get one record per edit, at the position it has
+// when they're applied front to back, so they replay like separate edits
+void editor_buffer_replace_many(Editor *e, const Edit *edits, size_t n) {
+    size_t shift = 0;
+    for (size_t k=0; k<n; k++)
+    {
+        const Edit *ed = &edits[k];
+        if (ed->removeLen == 0 && ed->len == 0) continue;
+        const size_t pos = ed->pos + shift;
+        editor_journal_record(e, pos, ed->removeLen, ed->text, ed->len);
+        if (!e->undo.applying)
+        {
+            UndoRecord r = {
+                .pos = pos,
+                .removedLen = ed->removeLen,
+                .insertedLen = ed->len,
+                .data = malloc(ed->removeLen + ed->len + 1),
+                .cursor = e->c.pos,
+            };
+            assert(r.data != NULL);
+            memcpy(r.data, e->buffer.items + ed->pos, ed->removeLen);
+            if (ed->len > 0) memcpy(r.data + ed->removeLen, ed->text, ed->len);
+            undo_push(&e->undo, r);
+        }
+        shift = shift - ed->removeLen + ed->len;
+    }
+    editor_buffer_splice_many(e, edits, n);
+    e->modified = true;
+}
+
+// applies a record backwards (undo) or forwards (redo)
+void editor_undo_apply(Editor *e, UndoRecord *r, bool forward) {
+    const size_t removeLen = forward ? r->removedLen : r->insertedLen;
+    const size_t len = forward ? r->insertedLen : r->removedLen;
+    if (r->swap)
+    {
+        // the record holds the whole buffer of the other side
+        editor_buffer_changing(e, r->pos, e->buffer.count);
+        editor_buffer_make_writable(e);
+        editor_journal_record(e, r->pos, removeLen, r->other.items + r->pos, len);
+        e->undo.bytes -= undo_record_bytes(r);
+        Buffer tmp = e->buffer;
+        e->buffer = r->other;
+        r->other = tmp;
+        e->undo.bytes += undo_record_bytes(r);
+        e->origin.runs.count = 0; // nothing is known to match the file anymore
+        editor_calculate_lines(e);
+        e->modified = true;
+        return;
+    }
+    const char *text = forward ? r->data + r->removedLen : r->data;
+    e->undo.applying = true;
+    editor_buffer_replace(e, r->pos, removeLen, text, len);
+    e->undo.applying = false;
+}
+
+void editor_insert_char_at_cursor(Editor *e, char c) {
+    editor_buffer_replace(e, e->c.pos, 0, &c, 1);
+
+    // move cursor right by one character
+    e->c.pos++;
+}
+
+void editor_remove_char_before_cursor(Editor *e) {
+    if (e->c.pos == 0) return;
+
+    // a "\r\n" goes as a whole
+    const size_t newline = buffer_newline_before(&e->buffer, e->c.pos);
+    const size_t len = newline ? newline : 1;
+    editor_buffer_replace(e, e->c.pos - len, len, NULL, 0);
+    e->c.pos -= len;
+}
+
+void editor_remove_char_at_cursor(Editor *e) {
+    if (e->buffer.count == 0) return;
+    if (e->c.pos > e->buffer.count - 1) return;
+
+    const size_t newline = buffer_newline_at(&e->buffer, e->c.pos);
+    editor_buffer_replace(e, e->c.pos, newline ? newline : 1, NULL, 0);
+}
+
+// inserts a line ending in the style of the file
+void editor_insert_newline_at_cursor(Editor *e) {
+    const char *newline = e->crlf ? "\r\n" : "\n";
+    const size_t len = strlen(newline);
+    editor_buffer_replace(e, e->c.pos, 0, newline, len);
+    e->c.pos += len;
+}
+
+void editor_select(Editor *e, size_t startingPos) {
+    if (e->buffer.count == 0) return;
+    Selection *s = &e->selection;
+    if (!s->exists)
+    {
+        *s = (Selection) {
+            .start = startingPos,
+            .end = e->c.pos,
+            .exists = true,
+        };
+    } else
+    {
+        s->end = e->c.pos;
+    }
+    LOG("Selection After %lu - %lu", s->start, s->end);
+}
+
+void editor_selection_clear(Editor *e) {
+    e->selection = (Selection) {
+        .start = 0,
+        .end = 0,
+        .exists = false,
+    };
+    LOG("Selection cleared");
+}
+
+void editor_selection_delete(Editor *e) {
+    Selection *s = &e->selection;
+    size_t start, end;
+    if (s->start <= s->end) {
+        start = s->start;
+        end = s->end;
+    } else {
+        start = s->end;
+        end = s->start;
+    }
+
+    editor_buffer_replace(e, start, end - start, NULL, 0);
+
+    e->c.pos = start;
+    editor_selection_clear(e);
+}
+
+void editor_select_all(Editor *e) {
+    const Line firstLine = e->lines.items[0];
+    const Line lastLine  = e->lines.items[e->lines.count - 1];
+
+    e->selection = (Selection) {
+        .start = firstLine.start,
+        .end   = lastLine.end,
+        .exists = true,
+    };
+    LOG("Selected all");
+}
+
+// the range goes straight to the buffer, the line index is spliced like for any edit
+void editor_remove_word_before_cursor(Editor *e) {
+    const size_t start = editor_word_prev(e, e->c.pos);
+    editor_buffer_replace(e, start, e->c.pos - start, NULL, 0);
+    e->c.pos = start;
+}
+
+void editor_remove_word_after_cursor(Editor *e) {
+    const size_t end = editor_word_next(e, e->c.pos);
+    editor_buffer_replace(e, e->c.pos, end - e->c.pos, NULL, 0);
+}
+
+// -------------------
+// Multiple cursors
+// the main cursor plus `Editor.carets`, while there are extra ones every edit
+// goes to all of them as one batch, see `editor_carets_edit()`
+
+typedef enum {
+    CARET_INSERT,       // text replaces the selections or goes in at the cursors
+    CARET_INSERT_LINES, // same, but each cursor gets its own line when there are as many
+    CARET_NEWLINE,      // a line ending, indented like the line it splits
+    CARET_BACKSPACE,
+    CARET_DELETE,
+} CaretEditKind;
+
+size_t caret_lo(Caret c) { return c.pos < c.anchor ? c.pos : c.anchor; }
+size_t caret_hi(Caret c) { return c.pos > c.anchor ? c.pos : c.anchor; }
+
+int caret_compare(const void *a, const void *b) {
+    const size_t x = caret_lo(*(const Caret *)a), y = caret_lo(*(const Caret *)b);
+    return x < y ? -1 : x > y;
+}
+
+// sorts the carets and merges the ones that overlap or sit at the same spot
+void carets_normalize(Carets *cs) {
+    if (cs->count < 2) return;
+    qsort(cs->items, cs->count, sizeof(Caret), caret_compare);
+    size_t w = 1;
+    for (size_t i=1; i<cs->count; i++)
+    {
+        Caret *prev = &cs->items[w - 1];
+        const Caret c = cs->items[i];
+        if (caret_lo(c) > caret_lo(*prev) && caret_lo(c) >= caret_hi(*prev))
+        {
+            cs->items[w++] = c;
+            continue;
+        }
+        const size_t lo = caret_lo(*prev);
+        const size_t hi = caret_hi(c) > caret_hi(*prev) ? caret_hi(c) : caret_hi(*prev);
+        *prev = lo == hi ? (Caret){ lo, lo } : (Caret){ hi, lo };
+    }
+    cs->count = w;
+}
+
+void editor_carets_clear(Editor *e) {
+    e->carets.count = 0;
+}
+
+Caret editor_main_caret(Editor *e) {
+    if (!e->selection.exists) return (Caret){ e->c.pos, e->c.pos };
+    return (Caret){ e->selection.end, e->selection.start };
+}
+
+// drops the extra carets that ended up on the main cursor
+void editor_carets_normalize(Editor *e) {
+    carets_normalize(&e->carets);
+    const Caret main = editor_main_caret(e);
+    size_t w = 0;
+    for (size_t i=0; i<e->carets.count; i++)
+    {
+        const Caret c = e->carets.items[i];
+        const bool overlaps = caret_lo(c) < caret_hi(main) && caret_lo(main) < caret_hi(c);
+        if (c.pos != main.pos && !overlaps) e->carets.items[w++] = c;
+    }
+    e->carets.count = w;
+}
+
+// selects the next match of the selection and keeps a cursor on the current one,
+// with nothing selected it selects the word at the cursor first
+void editor_carets_add_next_match(Editor *e) {
+    const char *buf = e->buffer.items;
+    const size_t count = e->buffer.count;
+    const Caret main = editor_main_caret(e);
+    const size_t lo = caret_lo(main), hi = caret_hi(main);
+    if (lo == hi)
+    {
+        const uint8_t *classes = e->wordClasses;
+        size_t start = lo, end = hi;
+        if (start > 0 && classes[(unsigned char)buf[start - 1]] == WORD_IDENT) start = word_run_start(classes, buf, 0, start);
+        if (end < count && classes[(unsigned char)buf[end]] == WORD_IDENT) end = word_run_end(classes, buf, end, count);
+        if (start == end) return;
+        e->selection = (Selection) { .start = start, .end = end, .exists = true };
+        e->c.pos = end;
+        return;
+    }
+
+    size_t hit = search_forward(buf + hi, count - hi, buf + lo, hi - lo);
+    if (hit != SEARCH_NOT_FOUND) hit += hi;
+    else hit = search_forward(buf, count, buf + lo, hi - lo);
+    for (size_t i=0; i<e->carets.count && hit != lo; i++)
+        if (caret_lo(e->carets.items[i]) == hit) hit = lo; // wrapped around to one of them
+    if (hit == lo)
+    {
+        notification_issue(&e->notif, "No more matches", 1);
+        return;
+    }
+    da_append(&e->carets, main);
+    e->selection = (Selection) { .start = hit, .end = hit + (hi - lo), .exists = true };
+    e->c.pos = hit + (hi - lo);
+    editor_carets_normalize(e);
+}
+
+// a cursor at the end of every line the selection touches
+void editor_carets_split_lines(Editor *e) {
+    const Caret main = editor_main_caret(e);
+    const size_t first = lines_find_row(e->lines, caret_lo(main));
+    const size_t last = lines_find_row(e->lines, caret_hi(main));
+    if (first == last) return;
+
+    editor_carets_clear(e);
+    const size_t capacity = last - first;
+    da_reserve(&e->carets, capacity);
+    for (size_t row=first; row<last; row++)
+    {
+        const size_t end = e->lines.items[row].end;
+        da_append(&e->carets, ((Caret){ end, end }));
+    }
+    e->c.pos = caret_hi(main);
+    editor_selection_clear(e);
+    editor_carets_normalize(e);
+    notification_issue(&e->notif, TextFormat("%zu cursors", e->carets.count + 1), 1);
+}
+
+// moves the extra carets like `move` moves the main cursor
+void editor_carets_move(Editor *e, void (*move)(Editor *), bool select) {
+    const Cursor main = e->c;
+    for (size_t i=0; i<e->carets.count; i++)
+    {
+        Caret *c = &e->carets.items[i];
+        e->c = (Cursor) { .pos = c->pos };
+        e->c.row = cursor_get_row(&e->c, e->lines);
+        e->c.col = cursor_get_col(&e->c, e->lines);
+        move(e);
+        c->pos = e->c.pos;
+        if (!select) c->anchor = c->pos;
+    }
+    e->c = main;
+    editor_carets_normalize(e);
+}
+
+// applies the edit at every cursor as one batch, the buffer and the line
+// index get updated once however many cursors there are
+void editor_carets_edit(Editor *e, CaretEditKind kind, const char *text, size_t len) {
+    Carets all;
+    da_init(&all);
+    const size_t capacity = e->carets.count + 1;
+    da_reserve(&all, capacity);
+    memcpy(all.items, e->carets.items, e->carets.count * sizeof(Caret));
+    all.count = e->carets.count;
+    const Caret main = editor_main_caret(e);
+    da_append(&all, main);
+    carets_normalize(&all);
+
+    // line ending plus the widest indentation, each cursor takes what it needs
+    Buffer newline;
+    da_init(&newline);
+    if (kind == CARET_NEWLINE)
+    {
+        const char *ending = e->crlf ? "\r\n" : "\n";
+        for (size_t i=0; ending[i]; i++) da_append(&newline, ending[i]);
+        size_t widest = 0;
+        for (size_t i=0; i<all.count; i++)
+        {
+            const Line line = e->lines.items[lines_find_row(e->lines, caret_lo(all.items[i]))];
+            size_t spaces = 0;
+            while (line.start + spaces < line.end && e->buffer.items[line.start + spaces] == ' ') spaces++;
+            if (spaces > widest) widest = spaces;
+        }
+        for (size_t i=0; i<widest; i++) da_append(&newline, ' ');
+    }
+
+    // a block copied earlier gets pasted back a row per cursor
+    Edits lines;
+    da_init(&lines);
+    if (kind == CARET_INSERT_LINES)
+    {
+        size_t start = 0;
+        for (size_t i=0; i<=len; i++)
+        {
+            if (i < len && text[i] != '\n') continue;
+            const size_t end = i > start && text[i - 1] == '\r' ? i - 1 : i;
+            da_append(&lines, ((Edit){ .text = text + start, .len = end - start }));
+            start = i + 1;
+        }
+        if (lines.count == all.count + 1 && lines.items[lines.count - 1].len == 0) lines.count--; // trailing newline
+        if (lines.count != all.count) lines.count = 0;
+    }
+
+    Edits edits;
+    da_init(&edits);
+    da_reserve(&edits, all.count);
+    size_t prevEnd = 0;
+    for (size_t i=0; i<all.count; i++)
+    {
+        const Caret c = all.items[i];
+        size_t lo = caret_lo(c), hi = caret_hi(c);
+        const bool selected = lo < hi;
+        Edit ed = { .pos = lo, .text = text, .len = len };
+        if (lines.count > 0)
+        {
+            ed.text = lines.items[i].text;
+            ed.len = lines.items[i].len;
+        }
+        else if (kind == CARET_NEWLINE)
+        {
+            const Line line = e->lines.items[lines_find_row(e->lines, lo)];
+            size_t spaces = 0;
+            while (line.start + spaces < line.end && e->buffer.items[line.start + spaces] == ' ') spaces++;
+            ed.text = newline.items;
+            ed.len = (e->crlf ? 2 : 1) + spaces;
+        }
+        else if (kind == CARET_BACKSPACE || kind == CARET_DELETE)
+        {
+            ed.len = 0;
+            if (!selected && kind == CARET_BACKSPACE && lo > 0)
+            {
+                const size_t newline = buffer_newline_before(&e->buffer, lo);
+                lo -= newline ? newline : 1;
+            }
+            else if (!selected && kind == CARET_DELETE && hi < e->buffer.count)
+            {
+                const size_t newline = buffer_newline_at(&e->buffer, hi);
+                hi += newline ? newline : 1;
+            }
+        }
+        // a cursor right after another can't take away what that one did
+        if (lo < prevEnd) lo = prevEnd;
+        if (hi < lo) hi = lo;
+        ed.pos = lo;
+        ed.removeLen = hi - lo;
+        da_append(&edits, ed);
+        prevEnd = hi;
+    }
+    editor_buffer_replace_many(e, edits.items, edits.count);
+
+    // every cursor ends up after what it inserted
+    size_t shift = 0;
+    size_t mainPos = 0;
+    for (size_t i=0; i<edits.count; i++)
+    {
+        const Edit *ed = &edits.items[i];
+        const size_t pos = ed->pos + shift + ed->len;
+        if (caret_lo(all.items[i]) <= caret_lo(main) && caret_lo(main) <= caret_hi(all.items[i])) mainPos = pos;
+        all.items[i] = (Caret){ pos, pos };
+        shift = shift - ed->removeLen + ed->len;
+    }
+    e->c.pos = mainPos;
+    editor_selection_clear(e);
+    editor_carets_clear(e);
+    for (size_t i=0; i<all.count; i++) da_append(&e->carets, all.items[i]);
+    editor_carets_normalize(e);
+
+    da_free(&newline);
+    da_free(&lines);
+    da_free(&edits);
+    da_free(&all);
+}
+
+// byte range of a column block on one row, byte columns clamped to the line
+// and moved back to the start of a utf8 sequence
+size_t block_column(Editor *e, Line line, size_t col) {
+    size_t pos = line.start + (col < line.end - line.start ? col : line.end - line.start);
+    while (pos > line.start && (e->buffer.items[pos] & 0xC0) == 0x80) pos--;
+    return pos;
+}
+
+// rows [top, bottom] and byte columns [lo, hi) of the column block
+void editor_block_bounds(Editor *e, size_t *top, size_t *bottom, size_t *lo, size_t *hi) {
+    const Selection s = e->selection;
+    const size_t startRow = lines_find_row(e->lines, s.start), endRow = lines_find_row(e->lines, s.end);
+    const size_t startCol = s.start - e->lines.items[startRow].start, endCol = s.end - e->lines.items[endRow].start;
+    *top = startRow < endRow ? startRow : endRow;
+    *bottom = startRow < endRow ? endRow : startRow;
+    *lo = startCol < endCol ? startCol : endCol;
+    *hi = startCol < endCol ? endCol : startCol;
+}
+
+// turns a column block into a cursor per row, selecting its part of the row,
+// the main cursor stays on the row of the selection end
+void editor_block_to_carets(Editor *e) {
+    const Selection s = e->selection;
+    const size_t startRow = lines_find_row(e->lines, s.start);
+    const size_t endRow = lines_find_row(e->lines, s.end);
+    const size_t startCol = s.start - e->lines.items[startRow].start;
+    const size_t endCol = s.end - e->lines.items[endRow].start;
+    const size_t first = startRow < endRow ? startRow : endRow;
+    const size_t last = startRow < endRow ? endRow : startRow;
+
+    editor_carets_clear(e);
+    const size_t capacity = last - first + 1;
+    da_reserve(&e->carets, capacity);
+    Caret main = {0};
+    for (size_t row=first; row<=last; row++)
+    {
+        const Line line = e->lines.items[row];
+        const Caret c = { block_column(e, line, endCol), block_column(e, line, startCol) };
+        if (row == endRow) main = c;
+        else da_append(&e->carets, c);
+    }
+    e->c.pos = main.pos;
+    e->selection = (Selection) { .start = main.anchor, .end = main.pos, .exists = main.anchor != main.pos };
+    editor_carets_normalize(e);
+}
+
+// `editor_update_edits()` while there are extra cursors
+void editor_carets_update_edits(Editor *e, char key) {
+    if (e->inputs.enter) editor_carets_edit(e, CARET_NEWLINE, NULL, 0);
+    if (e->inputs.tab) editor_carets_edit(e, CARET_INSERT, "    ", 4);
+    if (e->inputs.backspace) editor_carets_edit(e, CARET_BACKSPACE, NULL, 0);
+    if (e->inputs.delete) editor_carets_edit(e, CARET_DELETE, NULL, 0);
+    if (key) editor_carets_edit(e, CARET_INSERT, &key, 1);
+}
+
+void editor_copy(Editor *e) {
+    //get selected text or current line
+    char *text = NULL;
+    if (e->selection.exists && e->selection.block)
+    {
+        // its part of every row, a line each
+        size_t top, bottom, lo, hi;
+        editor_block_bounds(e, &top, &bottom, &lo, &hi);
+        Buffer joined;
+        da_init(&joined);
+        for (size_t row=top; row<=bottom; row++)
+        {
+            const Line line = e->lines.items[row];
+            const size_t from = block_column(e, line, lo), to = block_column(e, line, hi);
+            da_reserve(&joined, joined.count + (to - from) + 2);
+            memcpy(joined.items + joined.count, e->buffer.items + from, to - from);
+            joined.count += to - from;
+            joined.items[joined.count++] = '\n';
+        }
+        joined.items[joined.count - 1] = '\0';
+        text = joined.items;
+    }
+    else if (e->selection.exists)
+    {
+        size_t start, end = 0;
+
+        if (e->selection.end > e->selection.start)
+        {
+            start = e->selection.start;
+            end = e->selection.end;
+        }
+        else
+        {
+            start = e->selection.end;
+            end = e->selection.start;
+        }
+
+        const size_t length = end - start;
+        text = malloc(sizeof(char) * (length + 1));
+        strncpy(text, &e->buffer.items[start], length);
+        text[length] = '\0';
+    }
+    else
+    {
+        Line currentLine = e->lines.items[e->c.row];
+        const size_t length = currentLine.end - currentLine.start;
+        text = malloc(sizeof(char) * (length + 1));
+        strncpy(text, &e->buffer.items[currentLine.start], length);
+        text[length] = '\0';
+    }
+
+    //put it into clipboard lol
+    SetClipboardText(text);
+    free(text);
+    LOG("Copied text");
+}
+
+void editor_cut(Editor *e) {
+    editor_copy(e);
+    if (e->selection.exists && e->selection.block)
+    {
+        editor_block_to_carets(e);
+        editor_carets_edit(e, CARET_INSERT, NULL, 0);
+    }
+    else if (e->selection.exists)
+        editor_selection_delete(e);
+    else
+    {   // delete current line
+        Line currentLine = e->lines.items[e->c.row];
+        e->selection = (Selection) {
+            .exists = true,
+            .start  = currentLine.start,
+            .end    = currentLine.end,
+        };
+        editor_selection_delete(e);
+    }
+}
+
+void editor_paste(Editor *e) {
+    const char *text = GetClipboardText();
+    if (text == NULL) return;
+
+    if (e->selection.exists && e->selection.block)
+        editor_block_to_carets(e);
+    if (e->selection.exists && e->carets.count == 0)
+        editor_selection_delete(e);
+
+    // whole clipboard goes in as one edit
+    size_t len = strlen(text);
+    Buffer converted;
+    da_init(&converted);
+    if (e->crlf)
+    {
+        // keep the line endings of the file consistent
+        for (size_t i=0; i<len; i++)
+        {
+            if (text[i] == '\n' && (i == 0 || text[i-1] != '\r')) da_append(&converted, '\r');
+            da_append(&converted, text[i]);
+        }
+        text = converted.items;
+        len = converted.count;
+    }
+    if (e->carets.count > 0) editor_carets_edit(e, CARET_INSERT_LINES, text, len);
+    else
+    {
+        editor_buffer_replace(e, e->c.pos, 0, text, len);
+        e->c.pos += len;
+    }
+    da_free(&converted);
+    LOG("Pasted into editor");
+}
+
+// whether b can be applied together with a, the record before it: that is
+// what a batch edit leaves behind, records sorted and apart, so the position
+// of each holds both when they're applied one by one and all at once
+bool undo_records_apart(const UndoRecord *a, const UndoRecord *b) {
+    return !a->swap && !b->swap && a->group == b->group && a->pos < b->pos && a->pos + a->insertedLen <= b->pos;
+}
+
+// applies records [lo, hi), which are apart, all at once
+void editor_undo_apply_batch(Editor *e, size_t lo, size_t hi, bool forward) {
+    Undo *u = &e->undo;
+    Edits edits;
+    da_init(&edits);
+    const size_t capacity = hi - lo;
+    da_reserve(&edits, capacity);
+    size_t shift = 0; // redo wants the positions from before the earlier records
+    for (size_t i=lo; i<hi; i++)
+    {
+        const UndoRecord *r = &u->items[i];
+        if (forward) da_append(&edits, ((Edit){ r->pos - shift, r->removedLen, r->data + r->removedLen, r->insertedLen }));
+        else da_append(&edits, ((Edit){ r->pos, r->insertedLen, r->data, r->removedLen }));
+        shift = shift - r->removedLen + r->insertedLen;
+    }
+    u->applying = true;
+    editor_buffer_replace_many(e, edits.items, edits.count);
+    u->applying = false;
+    da_free(&edits);
+}
+
+void editor_undo(Editor *e) {
+    Undo *u = &e->undo;
+    undo_writer_wait(u); // swap records trade their buffer with the editor's
+    if (u->pos == 0 && !undo_file_load(u))
+    {
+        notification_issue(&e->notif, "Nothing to undo", 1);
+        return;
+    }
+    const uint32_t group = u->items[u->pos - 1].group;
+    while (u->pos > 0 && u->items[u->pos - 1].group == group)
+    {
+        const UndoRecord *r = &u->items[u->pos - 1];
+        if (r->pos + r->insertedLen > e->buffer.count)
+        {
+            // history file doesn't match after all
+            undo_clear(u);
+            notification_issue(&e->notif, "Undo history doesn't match the file, dropped it", 2);
+            break;
+        }
+        size_t lo = u->pos - 1;
+        while (lo > 0 && undo_records_apart(&u->items[lo - 1], &u->items[lo])) lo--;
+        if (u->pos - lo > 1) editor_undo_apply_batch(e, lo, u->pos, false);
+        else editor_undo_apply(e, &u->items[lo], false);
+        u->pos = lo;
+        e->c.pos = u->items[u->pos].cursor;
+    }
+    u->sealed = true;
+    e->modified = u->pos != u->savedPos;
+    editor_selection_clear(e);
+}
+
+void editor_redo(Editor *e) {
+    Undo *u = &e->undo;
+    undo_writer_wait(u);
+    if (u->pos == u->count)
+    {
+        notification_issue(&e->notif, "Nothing to redo", 1);
+        return;
+    }
+    const uint32_t group = u->items[u->pos].group;
+    while (u->pos < u->count && u->items[u->pos].group == group)
+    {
+        size_t hi = u->pos + 1;
+        while (hi < u->count && undo_records_apart(&u->items[hi - 1], &u->items[hi])) hi++;
+        if (hi - u->pos > 1) editor_undo_apply_batch(e, u->pos, hi, true);
+        else editor_undo_apply(e, &u->items[u->pos], true);
+        const UndoRecord *r = &u->items[hi - 1];
+        e->c.pos = r->pos + r->insertedLen;
+        u->pos = hi;
+    }
+    u->sealed = true;
+    e->modified = u->pos != u->savedPos;
+    editor_selection_clear(e);
+}
+
+void editor_set_font_size(Editor *e, int newFontSize) {
+    if (newFontSize <= 0) return;
+    e->fontSize = newFontSize;
+    SetTextLineSpacing(e->fontSize);
+    LOG("font size changed to %d", e->fontSize);
+}
+
+// stops watching the open file, see `editor_watch_start()`
+void editor_watch_stop(Editor *e) {
+    Watch *w = &e->watch;
+    if (w->fd >= 0) close(w->fd);
+    if (w->fileFd >= 0) close(w->fileFd);
+    w->fd = -1;
+    w->fileFd = -1;
+    w->gone = false;
+}
+
+// starts loading the file on the loader thread and returns right away
+// the buffer and lines fill up progressively, see `loader_thread()`
+void editor_load_file(Editor *e, const char *filename) {
+    LOG("Opening file: %s", filename);
+    editor_loader_stop(e);
+    editor_journal_close(e);
+    // the watch is armed again once the new file is loaded
+    editor_watch_stop(e);
+    e->watch.pending = false;
+    e->journal.disabled = false;
+    e->journal.checkPending = false;
+    e->filename = filename;
+    e->gotoPending = false;
+    SetWindowTitle(TextFormat("%s | the bingchillin text editor", e->filename));
+    editor_syntax_reset(e);
+    editor_brackets_reset(e);
+    editor_blank_lines_reset(e);
+    editor_words_reset(e);
+
+    e->buffer.count = 0;
+    editor_carets_clear(e);
+    e->diskHashes.count = 0;
+    e->diskSize = 0;
+    e->modified = false;
+    e->compressed = false;
+    e->encoding = ENCODING_UTF8;
+    e->crlf = false;
+    undo_clear(&e->undo);
+    regex_search_clear(&e->regex);
+    if (e->prompt.kind == PROMPT_REGEX) prompt_close(&e->prompt);
+    e->c = (Cursor) {0};
+    editor_selection_clear(e);
+    editor_calculate_lines(e);
+
+    editor_origin_reset(e, -1, 0);
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        perror("Error opening file");
+        //exit(1);
+        return;
+    }
+
+    // get size of the file
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        perror("Error opening file");
+        close(fd);
+        return;
+    }
+    size_t size = st.st_size;
+    LOG("size of file(%s):%zu\n", filename, size);
+
+    unsigned char magic[2];
+    e->compressed = pread(fd, magic, 2, 0) == 2 && magic[0] == 0x1F && magic[1] == 0x8B;
+    if (e->compressed)
+    {
+        // the gzip trailer has the decompressed size (mod 4GiB) of the last member
+        uint32_t isize = 0;
+        unsigned char trailer[4];
+        if (size >= 4 && pread(fd, trailer, 4, size - 4) == 4)
+            isize = trailer[0] | trailer[1] << 8 | trailer[2] << 16 | (uint32_t)trailer[3] << 24;
+        const size_t guess = isize >= size ? isize : size * 4;
+        da_reserve(&e->buffer, guess);
+        e->watch.follow = false; // appends to a compressed file can't be followed
+        LOG("%s is gzip compressed, expecting about %zu bytes", filename, guess);
+    }
+    else
+    {
+        // allocate that much memory in the buffer
+        // NOTE: the loader thread relies on this never being reallocated while it runs
+        da_reserve(&e->buffer, size);
+
+        // once loaded, the whole buffer matches the file
+        editor_origin_reset(e, dup(fd), size);
+    }
+
+    Loader *l = &e->loader;
+    *l = (Loader) {
+        .active = true,
+        .fd = fd,
+        .gzip = e->compressed,
+        .total = size,
+        .startTime = GetTime(),
+    };
+    atomic_init(&l->done, false);
+    atomic_init(&l->cancel, false);
+
+    if (pthread_create(&l->thread, NULL, loader_thread, e) != 0)
+    {
+        // fall back to loading on this thread
+        loader_thread(e);
+        close(fd);
+        l->fd = -1;
+        l->active = false;
+        editor_loader_finish(e);
+    }
+}
+
+// -------------------
+// File watching
+// inotify tells us when the open file changes on disk
+
+// starts watching the current file, `consumed` bytes of it are already in the buffer
+bool editor_watch_start(Editor *e, size_t consumed) {
+    Watch *w = &e->watch;
+    editor_watch_stop(e);
+    if (e->filename == NULL) return false;
+
+    struct stat st;
+    w->fileFd = open(e->filename, O_RDONLY);
+    if (w->fileFd < 0 || fstat(w->fileFd, &st) < 0)
+    {
+        editor_watch_stop(e);
+        return false;
+    }
+    w->ino = st.st_ino;
+    w->followPos = consumed;
+
+    w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (w->fd < 0)
+    {
+        perror("inotify_init1");
+        editor_watch_stop(e);
+        return false;
+    }
+    w->wd = inotify_add_watch(w->fd, e->filename,
+                              IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+    if (w->wd < 0)
+    {
+        perror("inotify_add_watch");
+        editor_watch_stop(e);
+        return false;
+    }
+    return true;
+}
+
+// appends bytes that were written to the followed file since the last call
+// only the new bytes are read and only the new lines get indexed
+// returns false if the file got shorter, meaning it has to be reloaded
+bool editor_follow_read(Editor *e) {
+    Watch *w = &e->watch;
+    struct stat st;
+    if (fstat(w->fileFd, &st) < 0) return true;
+    const size_t size = st.st_size;
+    if (size < w->followPos) return false;
+    if (size == w->followPos) return true;
+
+    const bool stickToEnd = e->c.pos == e->buffer.count;
+    const size_t oldCount = e->buffer.count;
+
+    editor_buffer_changing(e, oldCount, oldCount);
+    editor_buffer_make_writable(e);
+    size_t wanted = oldCount + (size - w->followPos);
+    if (wanted > e->buffer.size)
+    {
+        const size_t newSize = wanted > e->buffer.size*2 ? wanted : e->buffer.size*2;
+        da_reserve(&e->buffer, newSize);
+    }
+
+    // straight from the file into the buffer
+    while (w->followPos < size)
+    {
+        ssize_t n = pread(w->fileFd, e->buffer.items + e->buffer.count, size - w->followPos, w->followPos);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        e->buffer.count += n;
+        w->followPos += n;
+    }
+    const size_t added = e->buffer.count - oldCount;
+    if (added == 0) return true;
+
+    // extend the line index from the open trailing line
+    const Line last = e->lines.items[e->lines.count - 1];
+    da_remove(&e->lines);
+    size_t lineStart = lines_index_range(&e->lines, e->buffer.items, last.start, oldCount, e->buffer.count);
+    da_append(&e->lines, ((Line){ lineStart, e->buffer.count }));
+
+    // the appended bytes match the file too
+    struct stat originSt;
+    Origin *o = &e->origin;
+    if (o->fd >= 0 && fstat(o->fd, &originSt) == 0 && originSt.st_ino == w->ino)
+    {
+        OriginRun *lastRun = o->runs.count > 0 ? &o->runs.items[o->runs.count - 1] : NULL;
+        const size_t filePos = w->followPos - added;
+        if (lastRun != NULL && lastRun->pos + lastRun->len == oldCount && lastRun->origin + lastRun->len == filePos)
+            lastRun->len += added;
+        else
+            da_append(&o->runs, ((OriginRun){ oldCount, filePos, added }));
+        o->size = originSt.st_size;
+        o->mtime = originSt.st_mtim;
+    }
+
+    block_hashes_update(&e->diskHashes, e->buffer.items, e->buffer.count, oldCount);
+    e->diskSize = w->followPos;
+    editor_journal_retarget(e); // same edits, on top of the longer file
+
+    if (stickToEnd) e->c.pos = e->buffer.count;
+    return true;
+}
+
+void editor_follow_toggle(Editor *e) {
+    Watch *w = &e->watch;
+    if (!editor_file_is_raw(e))
+    {
+        notification_issue(&e->notif, "Can only follow uncompressed utf8 files", 1);
+        return;
+    }
+    w->follow = !w->follow;
+    notification_issue(&e->notif, w->follow ? "Following file" : "Stopped following file", 1);
+}
+
+// reloads the file from scratch, keeping the cursor at the end when it was there
+void editor_follow_reload(Editor *e, const char *reason) {
+    LOG("Reloading %s: %s", e->filename, reason);
+    e->watch.stickToEnd = e->c.pos == e->buffer.count;
+    editor_load_file(e, e->filename);
+}
+
+// maps a buffer position across buffer[pos, pos+removeLen) becoming `len` bytes
+size_t position_map(size_t at, size_t pos, size_t removeLen, size_t len) {
+    if (at < pos) return at;
+    if (at >= pos + removeLen) return at - removeLen + len;
+    return pos;
+}
+
+// brings the unmodified buffer in line with the file on disk
+// the changed range is narrowed down with block hashes and only that range
+// gets replaced, so the line index and cursor are kept everywhere else
+void editor_reload_changes(Editor *e) {
+    editor_carets_clear(e);
+    int fd = open(e->filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        if (fd >= 0) close(fd);
+        return;
+    }
+    const size_t size = st.st_size;
+    const char *data = "";
+    if (size > 0)
+    {
+        void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED)
+        {
+            close(fd);
+            return;
+        }
+        data = mapped;
+    }
+    const char *buf = e->buffer.items;
+    const size_t count = e->buffer.count;
+    const size_t common = size < count ? size : count;
+
+    // common prefix: hash the new file block by block until one differs
+    size_t prefix = 0;
+    for (size_t i=0; i<e->diskHashes.count && prefix + DISK_BLOCK_SIZE <= common; i++)
+    {
+        if (hash_bytes(data + prefix, DISK_BLOCK_SIZE) != e->diskHashes.items[i]) break;
+        prefix += DISK_BLOCK_SIZE;
+    }
+    while (prefix < common && data[prefix] == buf[prefix]) prefix++;
+
+    // common suffix: block offsets don't line up from the end after an insert,
+    // so the blocks there are compared directly
+    size_t suffix = 0;
+    const size_t maxSuffix = common - prefix;
+    while (suffix + DISK_BLOCK_SIZE <= maxSuffix &&
+           memcmp(data + size - suffix - DISK_BLOCK_SIZE, buf + count - suffix - DISK_BLOCK_SIZE, DISK_BLOCK_SIZE) == 0)
+        suffix += DISK_BLOCK_SIZE;
+    while (suffix < maxSuffix && data[size - suffix - 1] == buf[count - suffix - 1]) suffix++;
+
+    const size_t removeLen = count - prefix - suffix;
+    const size_t len = size - prefix - suffix;
+    if (removeLen > 0 || len > 0)
+    {
+        // keep the view where it was unless the change happened above it
+        size_t firstRow, lastRow;
+        editor_visible_rows(e, &firstRow, &lastRow);
+        const size_t oldLineCount = e->lines.count;
+        const bool aboveView = prefix < e->lines.items[firstRow < e->lines.count ? firstRow : 0].start;
+
+        e->c.pos = position_map(e->c.pos, prefix, removeLen, len);
+        if (e->selection.exists)
+        {
+            e->selection.start = position_map(e->selection.start, prefix, removeLen, len);
+            e->selection.end = position_map(e->selection.end, prefix, removeLen, len);
+        }
+        editor_buffer_splice(e, prefix, removeLen, data + prefix, len);
+
+        if (aboveView)
+            e->scrollY -= ((int)e->lines.count - (int)oldLineCount) * e->fontSize;
+        LOG("Reloaded %s: replaced %zu bytes at %zu with %zu bytes", e->filename, removeLen, prefix, len);
+        notification_issue(&e->notif, TextFormat("Reloaded %s (changed on disk)", e->filename), 1);
+    }
+
+    block_hashes_update(&e->diskHashes, e->buffer.items, e->buffer.count, prefix);
+    if (size > 0) munmap((void *)data, size);
+    editor_origin_reset(e, fd, size);
+    e->diskSize = size;
+    e->modified = false;
+    undo_clear(&e->undo); // the history doesn't apply to the new contents
+    editor_journal_discard(e);
+    editor_watch_start(e, size);
+}
+
+// how long an in-place write has to be quiet before reloading
+#define WATCH_SETTLE_TIME 0.2
+
+// called every frame
+void editor_watch_poll(Editor *e) {
+    Watch *w = &e->watch;
+    if (editor_is_loading(e) || e->filename == NULL) return;
+
+    if (w->fd < 0 && !w->gone)
+    {
+        // (re)arm once the file is loaded
+        if (!editor_watch_start(e, e->buffer.count))
+        {
+            w->gone = true; // doesn't exist (yet)
+            return;
+        }
+        if (w->stickToEnd) e->c.pos = e->buffer.count;
+        w->stickToEnd = false;
+        if (w->follow) editor_follow_read(e); // whatever got appended while loading
+        return;
+    }
+
+    bool changed = false;
+    bool closed = false;
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    while (w->fd >= 0 && (n = read(w->fd, events, sizeof(events))) > 0)
+    {
+        for (char *p = events; p < events + n; )
+        {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            if (ev->mask & (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB)) changed = true;
+            if (ev->mask & IN_CLOSE_WRITE) closed = true;
+            if (ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED)) w->gone = true;
+            p += sizeof(*ev) + ev->len;
+        }
+    }
+    if (e->saver.active) return; // our own save, the watch gets re-armed after it
+
+    if (w->follow)
+    {
+        if (changed && w->fileFd >= 0 && !editor_follow_read(e))
+        {
+            editor_follow_reload(e, "file truncated");
+            return;
+        }
+
+        if (w->gone)
+        {
+            // log rotation: finish the old file, then wait for a new one at the same path
+            if (w->fileFd >= 0)
+            {
+                editor_follow_read(e);
+                close(w->fileFd);
+                w->fileFd = -1;
+            }
+            struct stat st;
+            if (stat(e->filename, &st) == 0 && st.st_ino != w->ino)
+                editor_follow_reload(e, "file rotated");
+        }
+        return;
+    }
+
+    // rewritten in place: wait for the writer to finish
+    if (changed)
+    {
+        w->pending = true;
+        w->lastEvent = GetTime();
+    }
+    bool reload = w->pending && (closed || GetTime() - w->lastEvent > WATCH_SETTLE_TIME);
+
+    // replaced by rename: the new file shows up under the same path
+    // NOTE: the old inode stays alive while we hold it open, so the rename
+    // may only show up as an attribute change (link count) on it
+    struct stat st;
+    if ((w->gone || changed) && stat(e->filename, &st) == 0 && st.st_ino != w->ino)
+        reload = true;
+
+    if (!reload) return;
+    w->pending = false;
+    if (e->modified)
+    {
+        notification_issue(&e->notif, "File changed on disk, keeping unsaved edits", 2);
+        editor_watch_start(e, w->followPos);
+        return;
+    }
+    if (!editor_file_is_raw(e)) editor_follow_reload(e, "changed on disk"); // nothing to diff against
+    else editor_reload_changes(e);
+}
+
+// copies len bytes at `offset` of `in` to the current position of `out`
+// without passing them through userspace where the kernel allows it
+// (copy_file_range shares the extents on reflink capable filesystems)
+// returns 0 or an errno value
+int copy_file_span(int in, off_t offset, int out, size_t len) {
+    bool useCopyRange = true;
+    bool useSendfile = true;
+    while (len > 0)
+    {
+        ssize_t n = -1;
+        if (useCopyRange)
+        {
+            n = copy_file_range(in, &offset, out, NULL, len, 0);
+            if (n < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP))
+            {
+                useCopyRange = false;
+                continue;
+            }
+        }
+        else if (useSendfile)
+        {
+            n = sendfile(out, in, &offset, len);
+            if (n < 0 && (errno == EINVAL || errno == ENOSYS))
+            {
+                useSendfile = false;
+                continue;
+            }
+        }
+        else
+        {
+            char chunk[64*1024];
+            n = pread(in, chunk, len < sizeof(chunk) ? len : sizeof(chunk), offset);
+            for (ssize_t done=0; done<n; )
+            {
+                ssize_t w = write(out, chunk + done, n - done);
+                if (w < 0)
+                {
+                    if (errno == EINTR) continue;
+                    return errno;
+                }
+                done += w;
+            }
+            if (n > 0) offset += n;
+        }
+
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            return errno;
+        }
+        if (n == 0) return EIO; // original got shorter under us
+        len -= n;
+    }
+    return 0;
+}
+
+// writes every span to `fd` in order, retrying short writes
+// runs of in-memory spans go out with a single writev
+// returns 0 or an errno value
+int write_spans(int fd, SaveSpan *spans, size_t count) {
+    struct iovec iov[IOV_MAX];
+    size_t i = 0;
+    size_t skip = 0; // bytes of spans[i] that were already written
+    while (i < count)
+    {
+        if (spans[i].data == NULL)
+        {
+            int err = copy_file_span(spans[i].fd, spans[i].offset, fd, spans[i].len);
+            if (err != 0) return err;
+            i++;
+            continue;
+        }
+
+        int n = 0;
+        for (size_t j=i; j<count && n<IOV_MAX && spans[j].data != NULL; j++, n++)
+            iov[n] = (struct iovec){ (char *)spans[j].data, spans[j].len };
+        iov[0].iov_base = (char *)iov[0].iov_base + skip;
+        iov[0].iov_len -= skip;
+
+        ssize_t written = writev(fd, iov, n);
+        if (written < 0)
+        {
+            if (errno == EINTR) continue;
+            return errno;
+        }
+        // drop the spans that were fully written and remember the partial one
+        written += skip;
+        skip = 0;
+        while (i < count && spans[i].data != NULL && (size_t)written >= spans[i].len)
+        {
+            written -= spans[i].len;
+            i++;
+        }
+        skip = written;
+    }
+    return 0;
+}
+
+// fsyncs the directory containing `path` so a rename inside it is durable
+int fsync_parent_dir(const char *path) {
+    // NOTE: runs on the save thread, so no TextFormat() here
+    const char *slash = strrchr(path, '/');
+    char *dir = slash == NULL ? strdup(".") : slash == path ? strdup("/") : strndup(path, slash - path);
+
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    free(dir);
+    if (fd < 0) return errno;
+    int err = fsync(fd) < 0 ? errno : 0;
+    close(fd);
+    return err;
+}
+
+// crash safe save: the spans go to a temp file in the same directory
+// which gets fsynced and renamed over `path`, so at any point in time
+// `path` holds either the old or the new contents
+// returns 0 or an errno value
+int save_spans_atomic(const char *path, SaveSpan *spans, size_t count) {
+    // write through symlinks instead of replacing them
+    char *target = realpath(path, NULL);
+    if (target == NULL) target = strdup(path);
+
+    const char *slash = strrchr(target, '/');
+    char *tmpPath = malloc(strlen(target) + 16);
+    if (slash == NULL)
+        sprintf(tmpPath, ".%s.XXXXXX", target);
+    else
+        sprintf(tmpPath, "%.*s/.%s.XXXXXX", (int)(slash - target), target, slash + 1);
+
+    int err = 0;
+    int fd = mkstemp(tmpPath);
+    if (fd < 0)
+    {
+        err = errno;
+        goto done;
+    }
+
+    // keep the permissions (and owner, when allowed) of the original
+    struct stat st;
+    if (stat(target, &st) == 0)
+    {
+        fchmod(fd, st.st_mode & 07777);
+        if (fchown(fd, st.st_uid, st.st_gid) < 0) { /* not our file, keep ours */ }
+    }
+    else
+    {
+        mode_t mask = umask(0);
+        umask(mask);
+        fchmod(fd, 0666 & ~mask);
+    }
+
+    err = write_spans(fd, spans, count);
+    if (err == 0 && fsync(fd) < 0) err = errno;
+    if (close(fd) < 0 && err == 0) err = errno;
+    if (err == 0 && rename(tmpPath, target) < 0) err = errno;
+
+    if (err != 0)
+        unlink(tmpPath);
+    else
+        err = fsync_parent_dir(target);
+
+done:
+    free(tmpPath);
+    free(target);
+    return err;
+}
+
+// NOTE: a single write() moves at most ~2GB, so big buffers are split
+#define SAVE_SPAN_SIZE (1024*1024*1024)
+
+// splits snapshot[pos, end) into spans small enough for one write()
+void save_spans_append_memory(SaveSpans *spans, const char *snapshot, size_t pos, size_t end) {
+    for (; pos<end; pos+=SAVE_SPAN_SIZE)
+    {
+        size_t len = end - pos;
+        if (len > SAVE_SPAN_SIZE) len = SAVE_SPAN_SIZE;
+        da_append(spans, ((SaveSpan){ .data = snapshot + pos, .len = len }));
+    }
+}
+
+// true if the file behind `fd` still looks the way it did when it was read
+bool origin_unchanged(int fd, off_t size, struct timespec mtime) {
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) return false;
+    return st.st_size == size &&
+           st.st_mtim.tv_sec == mtime.tv_sec &&
+           st.st_mtim.tv_nsec == mtime.tv_nsec;
+}
+
+// gzip compresses data[0, len) into `out`, returns 0 or an errno value
+int gzip_compress(Buffer *out, const char *data, size_t len) {
+    z_stream z = {0};
+    if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return ENOMEM;
+
+    size_t pos = 0;
+    int ret;
+    do
+    {
+        // avail_in and avail_out are only 32 bits wide
+        if (z.avail_in == 0 && pos < len)
+        {
+            size_t n = len - pos;
+            if (n > SAVE_SPAN_SIZE) n = SAVE_SPAN_SIZE;
+            z.next_in = (unsigned char *)data + pos;
+            z.avail_in = n;
+            pos += n;
+        }
+        if (out->size - out->count < LOADER_CHUNK_SIZE)
+        {
+            size_t newSize = out->size * 2;
+            if (newSize < out->count + LOADER_CHUNK_SIZE) newSize = out->count + LOADER_CHUNK_SIZE;
+            da_reserve(out, newSize);
+        }
+        size_t room = out->size - out->count;
+        if (room > SAVE_SPAN_SIZE) room = SAVE_SPAN_SIZE;
+        z.next_out = (unsigned char *)out->items + out->count;
+        z.avail_out = room;
+        ret = deflate(&z, pos == len ? Z_FINISH : Z_NO_FLUSH);
+        out->count += room - z.avail_out;
+    } while (ret == Z_OK || ret == Z_BUF_ERROR);
+
+    deflateEnd(&z);
+    return ret == Z_STREAM_END ? 0 : EIO;
+}
+
+void *saver_thread(void *arg) {
+    Saver *sv = arg;
+
+    SaveSpans spans;
+    da_init(&spans);
+    Buffer encoded;
+    da_init(&encoded);
+    Buffer compressed;
+    da_init(&compressed);
+    if (sv->gzip || sv->encoding != ENCODING_UTF8)
+    {
+        // nothing to reuse from the original, the whole snapshot gets converted
+        const char *data = sv->snapshot;
+        size_t len = sv->count;
+        if (sv->encoding != ENCODING_UTF8)
+        {
+            sv->lossy = text_encode(sv->encoding, data, len, &encoded);
+            data = encoded.items;
+            len = encoded.count;
+        }
+        if (sv->gzip)
+        {
+            sv->error = gzip_compress(&compressed, data, len);
+            data = compressed.items;
+            len = compressed.count;
+        }
+        save_spans_append_memory(&spans, data, 0, len);
+    }
+    else
+    {
+        // unchanged runs are copied from the original, the rest is written
+        const bool reuse = origin_unchanged(sv->originFd, sv->originSize, sv->originMtime);
+        size_t pos = 0;
+        for (size_t i=0; reuse && i<sv->runs.count; i++)
+        {
+            const OriginRun run = sv->runs.items[i];
+            save_spans_append_memory(&spans, sv->snapshot, pos, run.pos);
+            da_append(&spans, ((SaveSpan){ .fd = sv->originFd, .offset = run.origin, .len = run.len }));
+            sv->copied += run.len;
+            pos = run.pos + run.len;
+        }
+        save_spans_append_memory(&spans, sv->snapshot, pos, sv->count);
+    }
+
+    if (sv->error == 0)
+        sv->error = save_spans_atomic(sv->path, spans.items, spans.count);
+    da_free(&spans);
+    da_free(&encoded);
+    da_free(&compressed);
+
+    // lets the watch tell later changes on disk apart from this save
+    if (sv->error == 0)
+        block_hashes_update(&sv->hashes, sv->snapshot, sv->count, 0);
+
+    atomic_store(&sv->done, true);
+    return NULL;
+}
+
+// releases the snapshot and reports how the save went
+void editor_saver_finish(Editor *e) {
+    Saver *sv = &e->saver;
+    sv->active = false;
+    if (sv->ownsSnapshot) free(sv->snapshot);
+    sv->snapshot = NULL;
+    if (sv->originFd >= 0) close(sv->originFd);
+    da_free(&sv->runs);
+
+    if (sv->error != 0)
+    {
+        LOG("Cannot save %s: %s", sv->path, strerror(sv->error));
+        notification_issue(&e->notif, TextFormat("Error saving %s: %s", sv->path, strerror(sv->error)), 2);
+    }
+    else
+    {
+        LOG("Saved %zu bytes in %.3fs (%zu copied from the original)",
+            sv->count, GetTime() - sv->startTime, sv->copied);
+        if (sv->lossy > 0)
+            notification_issue(&e->notif, TextFormat("Saved to file: %s (%zu characters not representable in %s were replaced by '?')",
+                                                     sv->path, sv->lossy, encoding_name(sv->encoding)), 3);
+        else
+            notification_issue(&e->notif, TextFormat("Saved to file: %s", sv->path), 1);
+
+        // with no edits during the save the new file is the origin now,
+        // otherwise the runs keep pointing into the old (still open) file
+        if (!sv->ownsSnapshot && !sv->gzip && sv->encoding == ENCODING_UTF8)
+        {
+            int fd = open(sv->path, O_RDONLY);
+            editor_origin_reset(e, fd, fd >= 0 ? sv->count : 0);
+        }
+
+        if (!sv->ownsSnapshot)
+        {
+            e->modified = false;
+            e->undo.savedPos = e->undo.pos;
+        }
+        else e->undo.savedPos = SIZE_MAX;
+
+        // the save replaced the watched file
+        BlockHashes tmp = e->diskHashes;
+        e->diskHashes = sv->hashes;
+        sv->hashes = tmp;
+        e->diskSize = sv->count;
+        editor_watch_start(e, sv->count);
+        if (!sv->ownsSnapshot) editor_undo_persist(e);
+
+        // edits made while saving still need the journal
+        if (sv->ownsSnapshot) editor_journal_rebase(e, sv->journalMark);
+        else editor_journal_discard(e);
+    }
+    free(sv->path);
+    sv->path = NULL;
+    da_free(&sv->hashes);
+}
+
+// joins a finished (or, with `wait`, a running) save and reports the result
+void editor_saver_poll(Editor *e, bool wait) {
+    Saver *sv = &e->saver;
+    if (!sv->active) return;
+    if (!wait && !atomic_load(&sv->done)) return;
+
+    pthread_join(sv->thread, NULL);
+    editor_saver_finish(e);
+}
+
+// starts saving the current buffer contents on the save thread
+// returns if the save was started
+bool editor_save_file(Editor *e) {
+    if (e->filename == NULL)
+    {
+        notification_issue(&e->notif, "Can not save: File does not exist", 1);
+        return false;
+    }
+    if (e->saver.active)
+    {
+        notification_issue(&e->notif, "Still saving previous changes", 1);
+        return false;
+    }
+
+    Saver *sv = &e->saver;
+    *sv = (Saver) {
+        .active = true,
+        .snapshot = e->buffer.items,
+        .count = e->buffer.count,
+        .path = strdup(e->filename),
+        .journalMark = e->journal.streamPos,
+        .gzip = e->compressed,
+        .encoding = e->encoding,
+        .startTime = GetTime(),
+        .originFd = e->origin.fd >= 0 ? dup(e->origin.fd) : -1,
+        .originSize = e->origin.size,
+        .originMtime = e->origin.mtime,
+    };
+    da_init(&sv->runs);
+    da_init(&sv->hashes);
+    if (sv->originFd >= 0)
+    {
+        da_reserve(&sv->runs, e->origin.runs.count);
+        memcpy(sv->runs.items, e->origin.runs.items, e->origin.runs.count * sizeof(OriginRun));
+        sv->runs.count = e->origin.runs.count;
+    }
+    atomic_init(&sv->done, false);
+    notification_issue(&e->notif, TextFormat("Saving to file: %s", e->filename), 1);
+
+    if (pthread_create(&sv->thread, NULL, saver_thread, sv) != 0)
+    {
+        // no thread, save right here
+        saver_thread(sv);
+        editor_saver_finish(e);
+    }
+    return true;
+}
+
+void editor_deinit(Editor *e) {
+    editor_loader_stop(e);
+    editor_saver_poll(e, true); // never drop a save in progress
+    editor_journal_close(e);
+    editor_origin_reset(e, -1, 0);
+    editor_watch_stop(e);
+    undo_clear(&e->undo);
+    da_free(&e->undo);
+    da_free(&e->undo.writes);
+    regex_search_clear(&e->regex);
+    da_free(&e->regex.matches);
+    pthread_mutex_destroy(&e->regex.lock);
+    syntax_stop(&e->syntax);
+    da_free(&e->syntax.states);
+    da_free(&e->syntax.kinds);
+    da_free(&e->brackets.chunks);
+    da_free(&e->brackets.tree);
+    da_free(&e->blankLines.rows);
+    words_stop(&e->words);
+    da_free(&e->words.entries);
+    da_free(&e->words.text);
+    da_free(&e->words.sorted);
+    da_free(&e->words.recent);
+    da_free(&e->words.touched);
+    free(e->words.slots);
+    free(e->words.best);
+    walker_stop(&e->picker.walker, true);
+    pthread_mutex_destroy(&e->picker.walker.lock);
+    pthread_cond_destroy(&e->picker.walker.wake);
+    da_free(&e->picker.walker.dirs);
+    da_free(&e->picker.walker.rules);
+    da_free(&e->picker.walker.found);
+    file_list_free(&e->picker.list);
+    file_list_free(&e->picker.next);
+    da_free(&e->picker.taken);
+    da_free(&e->picker.query);
+    da_free(&e->picker.matches);
+    da_free(&e->picker.candidates);
+    free(e->picker.chosen);
+    free(e->picker.opened); // `e->filename`, nothing uses it from here on
+    pthread_mutex_destroy(&e->lock);
+    da_free(&e->scratch);
+    da_free(&e->prompt);
+    da_free(&e->find.needle);
+    da_free(&e->carets);
+    da_free(&e->buffer);
+    da_free(&e->lines);
+    da_free(&e->notif);
+#ifndef BUILD_RELEASE
+    UnloadFont(e->font);
+#endif
+}
+
+bool editor_key_pressed(KeyboardKey key) {
+    return IsKeyPressed(key) || IsKeyPressedRepeat(key);
+}
+
+void editor_draw_text(Editor *e, const char* text, Vector2 pos, Color color) {
+    DrawTextEx(e->font, text, pos, e->fontSize, e->fontSpacing, color);
+}
+
+// draws `len` chars of text that isn't null terminated
+void editor_draw_chars(Editor *e, const char *text, size_t len, Vector2 pos, Color color) {
+    if (len == 0) return;
+    da_reserve(&e->scratch, len + 1);
+    memcpy(e->scratch.items, text, len);
+    e->scratch.items[len] = '\0';
+    editor_draw_text(e, e->scratch.items, pos, color);
+}
+
+// draws a row colored by token, returns the state the next row starts in
+LexState editor_draw_row_highlighted(Editor *e, size_t row, LexState state, Vector2 pos) {
+    Syntax *sx = &e->syntax;
+    const Line line = e->lines.items[row];
+    const char *text = &e->buffer.items[line.start];
+    const size_t n = line.end - line.start;
+    da_reserve(&sx->kinds, n + 1);
+    const char *kinds = sx->kinds.items;
+    state = syntax_lex_line(sx->classes, state, text, n, sx->kinds.items);
+
+    const Color colors[] = {
+        [TOKEN_TEXT] = e->colors.text,
+        [TOKEN_KEYWORD] = e->colors.keyword,
+        [TOKEN_NUMBER] = e->colors.number,
+        [TOKEN_STRING] = e->colors.string,
+        [TOKEN_COMMENT] = e->colors.comment,
+        [TOKEN_PREPROC] = e->colors.preproc,
+    };
+    size_t from = 0;
+    for (size_t i=1; i<=n; i++)
+    {
+        if (i < n && kinds[i] == kinds[from]) continue;
+        // same as drawing the row in one go: each char moves on by its width plus the spacing
+        da_reserve(&e->scratch, i - from + 1);
+        memcpy(e->scratch.items, text + from, i - from);
+        e->scratch.items[i - from] = '\0';
+        editor_draw_text(e, e->scratch.items, pos, colors[(int)kinds[from]]);
+        pos.x += MeasureTextEx(e->font, e->scratch.items, e->fontSize, e->fontSpacing).x + e->fontSpacing;
+        from = i;
+    }
+    return state;
+}
+
+// the completion list, under the cursor
+void editor_draw_completion(Editor *e) {
+    const Completion *c = &e->completion;
+    if (!c->active) return;
+    const WordIndex *wi = &e->words;
+    const int padding = 3;
+    int width = 0;
+    for (size_t i=0; i<c->count; i++)
+    {
+        const int w = editor_measure_text(e, word_text(wi, c->items[i]), wi->entries.items[c->items[i]].len);
+        if (w > width) width = w;
+    }
+    const int x = e->leftMargin + e->scrollX + editor_measure_text(e, e->buffer.items + e->lines.items[e->c.row].start, c->start - e->lines.items[e->c.row].start);
+    const int y = e->c.y + e->scrollY + e->fontSize;
+    DrawRectangle(x - padding, y, width + padding*2, e->fontSize*c->count, e->colors.bg);
+    DrawRectangleLines(x - padding, y, width + padding*2, e->fontSize*c->count, e->colors.ui);
+    for (size_t i=0; i<c->count; i++)
+    {
+        const uint32_t id = c->items[i];
+        const Vector2 pos = { x, y + e->fontSize*i };
+        if (i == c->selected) DrawRectangle(x - padding, pos.y, width + padding*2, e->fontSize, Fade(e->colors.selection, 0.3f));
+        editor_draw_chars(e, word_text(wi, id), wi->entries.items[id].len, pos, i == c->selected ? e->colors.cursor : e->colors.text);
+    }
+}
+
+void editor_draw_prompt(Editor *e) {
+    if (e->prompt.kind == PROMPT_NONE) return;
+
+    const int padding = 3;
+    const int height = e->fontSize + padding*2;
+    const int y = GetScreenHeight() - height;
+    DrawRectangle(0, y, GetScreenWidth(), height, e->colors.bg);
+    DrawLine(0, y, GetScreenWidth(), y, e->colors.ui);
+
+    const char *text = TextFormat("%s: %s", e->prompt.label, e->prompt.items);
+    Vector2 pos = { padding, y + padding };
+    editor_draw_text(e, text, pos, e->colors.ui);
+
+    const int cursorX = pos.x + editor_measure_str(e, text) + 1;
+    DrawLine(cursorX, pos.y, cursorX, pos.y + e->fontSize, e->colors.cursor);
+
+    if (e->prompt.kind == PROMPT_REGEX)
+    {
+        const char *status = regex_search_status(&e->regex);
+        Vector2 statusPos = { GetScreenWidth() - editor_measure_str(e, status) - padding, pos.y };
+        editor_draw_text(e, status, statusPos, e->colors.cursor);
+    }
+}
+
+// highlights buffer[pos, pos+len) on `row`, a match running into the next line
+// is only highlighted on its first
+void editor_draw_match(Editor *e, size_t row, size_t pos, size_t len, Color color) {
+    const Line line = e->lines.items[row];
+    const size_t end = pos + len < line.end ? pos + len : line.end;
+    const int x = editor_measure_text(e, &e->buffer.items[line.start], pos - line.start);
+    const int w = editor_measure_text(e, &e->buffer.items[pos], end - pos);
+    DrawRectangle(x + e->scrollX + e->leftMargin, (int)(e->fontSize*row) + e->scrollY, w, e->fontSize, color);
+}
+
+// index of the first extra caret that ends at or after `pos`
+size_t editor_carets_find(Editor *e, size_t pos) {
+    size_t lo = 0, hi = e->carets.count;
+    while (lo < hi)
+    {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (caret_hi(e->carets.items[mid]) < pos) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// selections of the extra cursors in rows [first, last)
+void editor_draw_caret_selections(Editor *e, size_t first, size_t last) {
+    if (e->carets.count == 0 || first >= last) return;
+    const Color color = Fade(e->colors.selection, 0.5f);
+    const size_t bottom = e->lines.items[last - 1].end;
+    for (size_t i=editor_carets_find(e, e->lines.items[first].start); i<e->carets.count; i++)
+    {
+        const size_t lo = caret_lo(e->carets.items[i]), hi = caret_hi(e->carets.items[i]);
+        if (lo > bottom) break;
+        size_t row = lines_find_row(e->lines, lo);
+        if (row < first) row = first;
+        for (; row < last && e->lines.items[row].start <= hi; row++)
+        {
+            const Line line = e->lines.items[row];
+            const size_t start = lo > line.start ? lo : line.start;
+            const size_t end = hi < line.end ? hi : line.end;
+            if (start < end) editor_draw_match(e, row, start, end - start, color);
+        }
+    }
+}
+
+// the extra cursors in rows [first, last)
+void editor_draw_carets(Editor *e, size_t first, size_t last) {
+    if (e->carets.count == 0 || first >= last) return;
+    const size_t bottom = e->lines.items[last - 1].end;
+    for (size_t i=editor_carets_find(e, e->lines.items[first].start); i<e->carets.count; i++)
+    {
+        const size_t pos = e->carets.items[i].pos;
+        if (caret_lo(e->carets.items[i]) > bottom) break;
+        if (pos < e->lines.items[first].start || pos > bottom) continue;
+        const size_t row = lines_find_row(e->lines, pos);
+        const Line line = e->lines.items[row];
+        const int x = editor_measure_text(e, &e->buffer.items[line.start], pos - line.start) + e->leftMargin + e->scrollX + 1;
+        const int y = (int)(e->fontSize*row) + e->scrollY;
+        DrawLine(x, y, x, y + e->fontSize, e->colors.cursor);
+    }
+}
+
+// the column block selection in rows [first, last)
+void editor_draw_block(Editor *e, size_t first, size_t last) {
+    size_t top, bottom, lo, hi;
+    editor_block_bounds(e, &top, &bottom, &lo, &hi);
+    for (size_t row = top > first ? top : first; row <= bottom && row < last; row++)
+    {
+        const Line line = e->lines.items[row];
+        const size_t from = block_column(e, line, lo), to = block_column(e, line, hi);
+        const int x = editor_measure_text(e, &e->buffer.items[line.start], from - line.start);
+        const int w = editor_measure_text(e, &e->buffer.items[from], to - from);
+        DrawRectangleLines(x + e->scrollX + e->leftMargin, (int)(e->fontSize*row) + e->scrollY, w > 0 ? w : 1, e->fontSize, e->colors.selection);
+    }
+}
+
+// highlights the matches of the find bar text in rows [first, last)
+void editor_draw_find_matches(Editor *e, size_t first, size_t last) {
+    const size_t len = e->prompt.count;
+    const bool finding = e->prompt.kind == PROMPT_FIND || e->prompt.kind == PROMPT_REPLACE;
+    if (!finding || len == 0 || first >= last) return;
+
+    const Color color = Fade(e->colors.selection, 0.3f);
+    const size_t end = e->lines.items[last - 1].end;
+    size_t row = first;
+    size_t pos = e->lines.items[first].start;
+    while (pos < end)
+    {
+        size_t hit = search_forward(e->buffer.items + pos, end - pos, e->prompt.items, len);
+        if (hit == SEARCH_NOT_FOUND) break;
+        hit += pos;
+        while (e->lines.items[row].end < hit) row++;
+        editor_draw_match(e, row, hit, len, color);
+        pos = hit + len;
+    }
+}
+
+// highlights the bracket at the cursor and its match
+void editor_draw_brackets(Editor *e, size_t first, size_t last) {
+    size_t pos, match;
+    if (!editor_bracket_at_cursor(e, &pos, &match)) return;
+    const Color color = Fade(e->colors.cursor, 0.3f);
+    const size_t ends[] = { pos, match };
+    for (int i=0; i<2; i++)
+    {
+        const size_t row = lines_find_row(e->lines, ends[i]);
+        if (row >= first && row < last) editor_draw_match(e, row, ends[i], 1, color);
+    }
+}
+
+// highlights the regex matches found so far in rows [first, last)
+void editor_draw_regex_matches(Editor *e, size_t first, size_t last) {
+    RegexSearch *rs = &e->regex;
+    if (e->prompt.kind != PROMPT_REGEX || !rs->valid || rs->stale || first >= last) return;
+
+    const Color color = Fade(e->colors.selection, 0.3f);
+    const size_t end = e->lines.items[last - 1].end;
+    size_t row = first;
+    pthread_mutex_lock(&rs->lock);
+    for (size_t i = regex_search_find(rs, e->lines.items[first].start); i < rs->matches.count; i++)
+    {
+        const RegexMatch m = rs->matches.items[i];
+        if (m.pos >= end) break;
+        while (e->lines.items[row].end < m.pos) row++;
+        editor_draw_match(e, row, m.pos, m.len, color);
+    }
+    pthread_mutex_unlock(&rs->lock);
+}
+
+void inputs_update(Inputs *i) {
+    *i = (Inputs) {0}; // reset
+
+    bool ctrl = IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL);
+    i->select = IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT);
+    i->block = IsKeyDown(KEY_LEFT_ALT) || IsKeyDown(KEY_RIGHT_ALT);
+
+    if (ctrl)
+    {
+        i->zoom_in = editor_key_pressed(KEY_EQUAL);
+        i->zoom_out = editor_key_pressed(KEY_MINUS);
+        i->select_all = IsKeyPressed(KEY_A);
+
+        i->save_file = IsKeyPressed(KEY_S);
+        i->quit = IsKeyPressed(KEY_Q);
+
+        i->copy = IsKeyPressed(KEY_C);
+        i->cut = IsKeyPressed(KEY_X);
+        i->paste = editor_key_pressed(KEY_V);
+
+        i->cursor_right_word = editor_key_pressed(KEY_RIGHT);
+        i->cursor_left_word = editor_key_pressed(KEY_LEFT);
+        i->cursor_next_empty_line = editor_key_pressed(KEY_DOWN);
+        i->cursor_prev_empty_line = editor_key_pressed(KEY_UP);
+
+        i->cursor_file_start = IsKeyPressed(KEY_HOME);
+        i->cursor_file_end = IsKeyPressed(KEY_END);
+        i->cursor_matching_bracket = IsKeyPressed(KEY_M);
+
+        i->backspace_word = IsKeyPressed(KEY_BACKSPACE);
+        i->delete_word = IsKeyPressed(KEY_DELETE);
+    }
+    else
+    {
+        i->cursor_right = editor_key_pressed(KEY_RIGHT);
+        i->cursor_left = editor_key_pressed(KEY_LEFT);
+        i->cursor_up = editor_key_pressed(KEY_UP);
+        i->cursor_down = editor_key_pressed(KEY_DOWN);
+
+        i->cursor_line_start = IsKeyPressed(KEY_HOME);
+        i->cursor_line_end = IsKeyPressed(KEY_END);
+
+        i->backspace = IsKeyPressed(KEY_BACKSPACE);
+        i->delete = IsKeyPressed(KEY_DELETE);
+    }
+
+    i->page_up = editor_key_pressed(KEY_PAGE_UP);
+    i->page_down = editor_key_pressed(KEY_PAGE_DOWN);
+
+    i->enter = editor_key_pressed(KEY_ENTER);
+    i->tab = IsKeyPressed(KEY_TAB);
+    i->escape = IsKeyPressed(KEY_ESCAPE);
+}
+
+// feeds this frame's keyboard input into the prompt
+PromptResult prompt_update(Prompt *p) {
+    if (IsKeyPressed(KEY_ESCAPE))
+    {
+        prompt_close(p);
+        return PROMPT_CANCELLED;
+    }
+    if (editor_key_pressed(KEY_ENTER)) return PROMPT_SUBMITTED;
+
+    PromptResult result = PROMPT_TYPING;
+    if (editor_key_pressed(KEY_BACKSPACE) && p->count > 0)
+    {
+        // drop a whole utf8 sequence
+        do p->count--; while (p->count > 0 && (p->items[p->count] & 0xC0) == 0x80);
+        p->items[p->count] = '\0';
+        result = PROMPT_CHANGED;
+    }
+
+    int key;
+    while ((key = GetCharPressed()) != 0)
+    {
+        int len = 0;
+        const char *utf8 = CodepointToUTF8(key, &len);
+        da_reserve(p, p->count + len + 1);
+        memcpy(p->items + p->count, utf8, len);
+        p->count += len;
+        p->items[p->count] = '\0';
+        result = PROMPT_CHANGED;
+    }
+    return result;
+}
+
+// moves the cursor to `loc`, past the end goes to the end of the file.
+// False while the loader hasn't got that far yet
+bool editor_cursor_to_location(Editor *e, Location loc) {
+    const bool loading = editor_is_loading(e);
+    size_t pos;
+    if (loc.byOffset)
+    {
+        if (loading && loc.offset > e->buffer.count) return false;
+        pos = loc.offset < e->buffer.count ? loc.offset : e->buffer.count;
+    }
+    else
+    {
+        // the last line may still be growing
+        if (loading && loc.line >= e->lines.count) return false;
+        const Line line = e->lines.items[(loc.line < e->lines.count ? loc.line : e->lines.count) - 1];
+        const size_t col = loc.col > 1 ? loc.col - 1 : 0;
+        pos = line.start + (col < line.end - line.start ? col : line.end - line.start);
+    }
+    // not in the middle of a utf8 sequence
+    while (pos > 0 && pos < e->buffer.count && (e->buffer.items[pos] & 0xC0) == 0x80) pos--;
+
+    e->c.pos = pos;
+    editor_selection_clear(e);
+    editor_carets_clear(e);
+    return true;
+}
+
+// goes to `loc` right away, or once the loader gets there, see `editor_update_locked()`
+void editor_goto(Editor *e, Location loc) {
+    e->gotoTarget = loc;
+    e->gotoPending = !editor_cursor_to_location(e, loc);
+    if (e->gotoPending) notification_issue(&e->notif, "Going there once it's loaded", 2);
+}
+
+void editor_goto_update(Editor *e) {
+    PromptResult r = prompt_update(&e->prompt);
+    if (r != PROMPT_SUBMITTED) return;
+    Location loc;
+    if (location_parse(e->prompt.items, &loc))
+        editor_goto(e, loc);
+    else
+        notification_issue(&e->notif, TextFormat("Not a line[:col] or @offset: %s", e->prompt.items), 1);
+    prompt_close(&e->prompt);
+}
+
+void editor_find_open(Editor *e) {
+    prompt_open(&e->prompt, PROMPT_FIND, "Find");
+    e->find = (Find) { .origin = e->c.pos, .needle = e->find.needle };
+}
+
+// selects the match at buffer[pos, pos+len)
+void editor_find_select(Editor *e, size_t pos, size_t len) {
+    e->find.matchPos = pos;
+    e->find.matchLen = len;
+    e->c.pos = pos + len;
+    e->selection = (Selection) {
+        .start = pos,
+        .end = e->c.pos,
+        .exists = true,
+    };
+}
+
+// searches from `from` in the given direction, wrapping around the buffer
+void editor_find(Editor *e, size_t from, bool forward) {
+    const char *needle = e->prompt.items;
+    const size_t len = e->prompt.count;
+    const char *hay = e->buffer.items;
+    const size_t n = e->buffer.count;
+    if (from > n) from = n;
+
+    size_t hit;
+    if (forward)
+    {
+        hit = search_forward(hay + from, n - from, needle, len);
+        if (hit != SEARCH_NOT_FOUND) hit += from;
+        else hit = search_forward(hay, n, needle, len);
+    }
+    else
+    {
+        // matches starting before `from`
+        const size_t end = from + len - 1 < n ? from + len - 1 : n;
+        hit = search_backward(hay, end, needle, len);
+        if (hit == SEARCH_NOT_FOUND) hit = search_backward(hay, n, needle, len);
+    }
+
+    if (hit != SEARCH_NOT_FOUND)
+    {
+        editor_find_select(e, hit, len);
+        return;
+    }
+    e->find.matchLen = 0;
+    e->c.pos = e->find.origin;
+    editor_selection_clear(e);
+    if (len > 0) notification_issue(&e->notif, TextFormat("Not found: %s", needle), 1);
+}
+
+// typing in the find bar searches from where it was opened, enter goes to
+// the next match and shift+enter to the previous one
+void editor_find_update(Editor *e) {
+    Find *f = &e->find;
+    PromptResult r = prompt_update(&e->prompt);
+    if (r == PROMPT_CANCELLED)
+        f->matchLen = 0; // keep the match selected
+    else if (r == PROMPT_CHANGED)
+        editor_find(e, f->origin, true);
+    else if (r == PROMPT_SUBMITTED)
+    {
+        const bool shift = IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT);
+        if (shift) editor_find(e, f->matchLen > 0 ? f->matchPos : e->c.pos, false);
+        else editor_find(e, f->matchLen > 0 ? f->matchPos + 1 : e->c.pos, true);
+    }
+}
+
+void editor_replace_open(Editor *e) {
+    prompt_open(&e->prompt, PROMPT_REPLACE, "Replace");
+    e->find = (Find) { .origin = e->c.pos, .needle = e->find.needle };
+}
+
+// the replace bar finds like the find bar, enter then asks for the
+// replacement and replaces every match at once
+void editor_replace_update(Editor *e) {
+    Find *f = &e->find;
+    const PromptKind kind = e->prompt.kind;
+    PromptResult r = prompt_update(&e->prompt);
+    if (r == PROMPT_CANCELLED)
+        f->matchLen = 0;
+    else if (r == PROMPT_CHANGED && kind == PROMPT_REPLACE)
+        editor_find(e, f->origin, true);
+    else if (r == PROMPT_SUBMITTED && kind == PROMPT_REPLACE && e->prompt.count > 0)
+    {
+        f->needle.count = 0;
+        da_reserve(&f->needle, e->prompt.count);
+        memcpy(f->needle.items, e->prompt.items, e->prompt.count);
+        f->needle.count = e->prompt.count;
+        prompt_open(&e->prompt, PROMPT_REPLACE_WITH, "Replace with");
+    }
+    else if (r == PROMPT_SUBMITTED && kind == PROMPT_REPLACE_WITH)
+    {
+        prompt_close(&e->prompt);
+        editor_selection_clear(e);
+        const double start = GetTime();
+        const size_t count = editor_replace_all(e, f->needle.items, f->needle.count, e->prompt.items, e->prompt.count);
+        LOG("Replaced %zu matches in %.3fs", count, GetTime() - start);
+        notification_issue(&e->notif, TextFormat("Replaced %zu", count), 2);
+    }
+}
+
+void editor_regex_open(Editor *e) {
+    prompt_open(&e->prompt, PROMPT_REGEX, "Regex");
+    regex_search_clear(&e->regex);
+    e->find = (Find) { .origin = e->c.pos, .needle = e->find.needle };
+}
+
+// index of the match to go to from `pos`, wrapping around once the whole text
+// was searched, SIZE_MAX if there's none (yet). Call with rs->lock held
+size_t regex_search_next(RegexSearch *rs, size_t pos, bool forward) {
+    const size_t n = rs->matches.count;
+    if (n == 0) return SIZE_MAX;
+    const size_t i = regex_search_find(rs, pos);
+    if (forward && i < n) return i;
+    if (!forward && i > 0) return i - 1;
+    if (!atomic_load(&rs->finished)) return SIZE_MAX;
+    return forward ? 0 : n - 1;
+}
+
+void regex_search_not_found(Editor *e) {
+    const bool finished = atomic_load(&e->regex.finished);
+    notification_issue(&e->notif, finished ? "No matches" : "No matches yet, still searching", 1);
+}
+
+// like the find bar, but the search runs on the regex thread and enter goes to
+// the next match it found so far
+void editor_regex_update(Editor *e) {
+    RegexSearch *rs = &e->regex;
+    Find *f = &e->find;
+    if (rs->stale) regex_search_start(rs, e->buffer.items, e->buffer.count, rs->from);
+
+    PromptResult r = prompt_update(&e->prompt);
+    if (r == PROMPT_CANCELLED)
+    {
+        regex_search_clear(rs);
+        f->matchLen = 0; // keep the match selected
+    }
+    else if (r == PROMPT_CHANGED)
+    {
+        regex_search_set_pattern(rs, e->prompt.items);
+        regex_search_start(rs, e->buffer.items, e->buffer.count, 0);
+        f->matchLen = 0;
+        e->c.pos = f->origin;
+        editor_selection_clear(e);
+    }
+    else if (r == PROMPT_SUBMITTED && rs->valid)
+    {
+        const bool forward = !IsKeyDown(KEY_LEFT_SHIFT) && !IsKeyDown(KEY_RIGHT_SHIFT);
+        const size_t from = f->matchLen > 0 ? f->matchPos + forward : e->c.pos;
+        pthread_mutex_lock(&rs->lock);
+        const size_t i = regex_search_next(rs, from, forward);
+        const RegexMatch m = i != SIZE_MAX ? rs->matches.items[i] : (RegexMatch) {0};
+        pthread_mutex_unlock(&rs->lock);
+        if (i != SIZE_MAX) editor_find_select(e, m.pos, m.len);
+        else regex_search_not_found(e);
+    }
+}
+
+// handles every input that modifies the buffer
+void editor_update_edits(Editor *e) {
+    const Inputs *in = &e->inputs;
+    const char key = GetCharPressed();
+    // a column block is edited as a cursor per row
+    if (e->selection.exists && e->selection.block && (key || in->enter || in->tab || in->backspace || in->delete))
+    {
+        size_t top, bottom, lo, hi;
+        editor_block_bounds(e, &top, &bottom, &lo, &hi);
+        editor_block_to_carets(e);
+        if (lo < hi && (in->backspace || in->delete))
+        {
+            // only what the block covers goes, not line endings of short rows
+            editor_carets_edit(e, CARET_INSERT, NULL, 0);
+            return;
+        }
+    }
+    // deleting words is only done at the main cursor
+    if (in->backspace_word || in->delete_word) editor_carets_clear(e);
+    if (e->carets.count > 0)
+    {
+        editor_carets_update_edits(e, key);
+        return;
+    }
+
+    if (e->inputs.enter) {
+        LOG("Enter key pressed");
+        if (e->selection.exists) editor_selection_delete(e);
+        // finds number of spaces on current line
+        int spaces = 0;
+        {
+            const Line currentLine = e->lines.items[e->c.row];
+            for (; e->buffer.items[currentLine.start + spaces] == ' '; spaces++);
+        }
+        // puts same amount of spaces on the new line
+        editor_insert_newline_at_cursor(e);
+        for (int i = 0; i<spaces; i++) editor_insert_char_at_cursor(e, ' ');
+    }
+
+    if (e->inputs.tab) {   // TODO: implement proper tab behaviour
+        LOG("Tab key pressed");
+        for (int i=0; i<4; i++) editor_insert_char_at_cursor(e, ' ');
+    }
+
+    if (e->inputs.backspace) {
+        LOG("Backspace pressed");
+        if (e->selection.exists)
+            editor_selection_delete(e);
+        else
+            editor_remove_char_before_cursor(e);
+    }
+
+    if (e->inputs.delete) {
+        LOG("Delete pressed");
+        if (e->selection.exists)
+            editor_selection_delete(e);
+        else
+            editor_remove_char_at_cursor(e);
+    }
 
-    char *src = e->buffer.items + e->c.pos + 1;
-    char *dest = e->buffer.items + e->c.pos;
-    size_t len = e->buffer.count - (e->c.pos + 1);
-    memmove(dest, src, len);
+    if (e->inputs.backspace_word) {
+        LOG("Backspace word");
+        if (e->selection.exists)
+            editor_selection_delete(e);
+        else
+            editor_remove_word_before_cursor(e);
+    }
 
-    e->buffer.count--;
+    if (e->inputs.delete_word) {
+        LOG("Delete word");
+        if (e->selection.exists)
+            editor_selection_delete(e);
+        else
+            editor_remove_word_after_cursor(e);
+    }
 
-    editor_calculate_lines(e);
+    if (key) {
+        LOG("%c - character pressed", key);
+        if (e->selection.exists) editor_selection_delete(e);
+        editor_insert_char_at_cursor(e, key);
+    }
 }
 
-void editor_select(Editor *e, size_t startingPos) {
-    if (e->buffer.count == 0) return;
-    Selection *s = &e->selection;
-    if (!s->exists)
-    {
-        *s = (Selection) {
-            .start = startingPos,
-            .end = e->c.pos,
-            .exists = true,
-        };
-    } else
+// looks for a journal left behind by a crash, returns if it can be replayed
+bool editor_journal_pending(Editor *e) {
+    char *path = sidecar_path(e->filename, ".bjournal");
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0) return false;
+
+    char header[JOURNAL_HEADER_SIZE];
+    uint64_t size, id;
+    struct stat st;
+    bool ok = read(fd, header, sizeof(header)) == sizeof(header) &&
+              memcmp(header, JOURNAL_MAGIC, 4) == 0 &&
+              fstat(fd, &st) == 0 && st.st_size > JOURNAL_HEADER_SIZE;
+    close(fd);
+    if (!ok) return false;
+
+    memcpy(&size, header + 8, 8);
+    memcpy(&id, header + 16, 8);
+    if (size != e->diskSize || id != editor_disk_id(e))
     {
-        s->end = e->c.pos;
+        LOG("Ignoring journal, it was written for different file contents");
+        return false;
     }
-    LOG("Selection After %lu - %lu", s->start, s->end);
-}
-
-void editor_selection_clear(Editor *e) {
-    e->selection = (Selection) {
-        .start = 0,
-        .end = 0,
-        .exists = false,
-    };
-    LOG("Selection cleared");
+    return true;
 }
 
-void editor_selection_delete(Editor *e) {
-    Selection *s = &e->selection;
-    int start, end;
-    if (s->start <= s->end) {
-        start = s->start;
-        end = s->end;
-    } else {
-        start = s->end;
-        end = s->start;
+// replays the journal and keeps appending to it
+void editor_journal_replay(Editor *e) {
+    editor_carets_clear(e);
+    char *path = sidecar_path(e->filename, ".bjournal");
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    free(path);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        if (fd >= 0) close(fd);
+        return;
     }
 
-    char* src = e->buffer.items + end;
-    char* dest = e->buffer.items + start;
-    size_t len = e->buffer.count - end;
+    const size_t size = st.st_size - JOURNAL_HEADER_SIZE;
+    char *data = malloc(size);
+    if (pread(fd, data, size, JOURNAL_HEADER_SIZE) != (ssize_t)size)
+    {
+        notification_issue(&e->notif, TextFormat("Could not read the journal: %s", strerror(errno)), 2);
+        free(data);
+        close(fd);
+        return;
+    }
 
-    memmove(dest, src, len);
+    const double start = GetTime();
+    size_t records = 0;
+    const size_t valid = editor_journal_apply(e, data, size, &records);
+    LOG("Replayed %zu journal records in %.3fs", records, GetTime() - start);
+    free(data);
 
-    e->c.pos = start;
-    e->buffer.count -= end - start;
+    e->modified = records > 0;
+    undo_clear(&e->undo); // replayed edits can't be undone
+    e->undo.savedPos = SIZE_MAX;
+    if (e->c.pos > e->buffer.count) e->c.pos = e->buffer.count;
     editor_selection_clear(e);
-    editor_calculate_lines(e);
-}
+    notification_issue(&e->notif, TextFormat("Recovered %zu edits", records), 2);
 
-void editor_select_all(Editor *e) {
-    const Line firstLine = e->lines.items[0];
-    const Line lastLine  = e->lines.items[e->lines.count - 1];
+    // new edits go after the replayed ones, a torn record at the end is cut
+    // off so a later replay doesn't stop there
+    if (valid < size && ftruncate(fd, JOURNAL_HEADER_SIZE + valid) != 0)
+    {
+        LOG("Not journaling, the torn end could not be cut off: %s", strerror(errno));
+        close(fd);
+        return;
+    }
+    lseek(fd, JOURNAL_HEADER_SIZE + valid, SEEK_SET);
+    e->journal.streamPos = valid;
+    journal_start(&e->journal, fd);
+}
 
-    e->selection = (Selection) {
-        .start = firstLine.start,
-        .end   = lastLine.end,
-        .exists = true,
-    };
-    LOG("Selected all");
+// y/n answer to the recovery question
+void editor_recover_update(Editor *e) {
+    const int key = GetCharPressed();
+    if (key == 'y' || key == 'Y' || editor_key_pressed(KEY_ENTER))
+    {
+        prompt_close(&e->prompt);
+        editor_journal_replay(e);
+    }
+    else if (key == 'n' || key == 'N' || IsKeyPressed(KEY_ESCAPE))
+    {
+        prompt_close(&e->prompt);
+        editor_journal_discard(e);
+    }
 }
 
-void editor_remove_word_before_cursor(Editor *e) {
-    int startingPos = e->c.pos;
-    editor_cursor_to_prev_word(e);
-    editor_select(e, startingPos);
-    editor_selection_delete(e);
+// keeps the cursor inside the window
+// NOTE: do not use old e->c.row
+// - update it first `the cursor_update() function`
+void editor_scroll_to_cursor(Editor *e) {
+    const int winWidth = GetScreenWidth();
+    const int winHeight = GetScreenHeight();
+
+    // X offset calculation
+    const int cursorX = e->c.x;
+    const int winRight = winWidth - e->scrollX;
+    const int winLeft = 0 - e->scrollX + e->leftMargin;
+
+    if ( cursorX > winRight )
+        e->scrollX = winWidth-cursorX-1;
+    else if ( cursorX < winLeft )
+        e->scrollX = -cursorX + e->leftMargin;
+
+    // Y offset calulation
+    const int cursorTop = e->c.y;
+    const int cursorBottom = cursorTop + e->fontSize;
+    const int winBottom = winHeight - e->scrollY;
+    const int winTop = 0 - e->scrollY;
+
+    if (cursorBottom > winBottom)
+        e->scrollY = winHeight - cursorBottom;
+    else if (cursorTop < winTop)
+        e->scrollY = -cursorTop;
 }
 
-void editor_remove_word_after_cursor(Editor *e) {
-    int startingPos = e->c.pos;
-    editor_cursor_to_next_word(e);
-    editor_select(e, startingPos);
-    editor_selection_delete(e);
+// the identifier the cursor is at the end of
+size_t editor_completion_prefix(Editor *e) {
+    const char *buf = e->buffer.items;
+    const size_t pos = e->c.pos;
+    if (pos == 0 || e->wordClasses[(unsigned char)buf[pos - 1]] != WORD_IDENT) return pos;
+    return word_run_start(e->wordClasses, buf, 0, pos);
 }
 
-void editor_copy(Editor *e) {
-    //get selected text or current line
-    char *text = NULL;
-    if (e->selection.exists)
+// looks the words up again for what's typed now, closes the list when nothing fits
+void editor_completion_refresh(Editor *e) {
+    Completion *c = &e->completion;
+    WordIndex *wi = &e->words;
+    if (editor_completion_prefix(e) != c->start || c->start == e->c.pos)
     {
-        int start, end = 0;
-
-        if (e->selection.end > e->selection.start)
-        {
-            start = e->selection.start;
-            end = e->selection.end;
-        }
-        else
-        {
-            start = e->selection.end;
-            end = e->selection.start;
-        }
-
-        const int length = end - start;
-        text = malloc(sizeof(char) * (length + 1));
-        strncpy(text, &e->buffer.items[start], length);
-        text[length] = '\0';
+        c->active = false;
+        return;
     }
-    else
+    // stopping the count would only start it over on the next frame
+    if (words_counting(wi))
     {
-        Line currentLine = e->lines.items[e->c.row];
-        const int length = currentLine.end - currentLine.start;
-        text = malloc(sizeof(char) * (length + 1));
-        strncpy(text, &e->buffer.items[currentLine.start], length);
-        text[length] = '\0';
+        c->active = false;
+        notification_issue(&e->notif, "Still indexing words", 1);
+        return;
     }
+    words_stop(wi);
+    if (wi->recent.count > WORDS_RECENT_MAX) words_merge(wi);
+    c->count = words_complete(wi, e->buffer.items + c->start, e->c.pos - c->start, c->items, COMPLETION_ITEMS);
+    if (c->selected >= c->count) c->selected = 0;
+    c->active = c->count > 0;
+}
 
-    //put it into clipboard lol
-    SetClipboardText(text);
-    free(text);
-    LOG("Copied text");
+void editor_completion_accept(Editor *e, uint32_t id) {
+    const WordIndex *wi = &e->words;
+    const size_t typed = e->c.pos - e->completion.start;
+    const size_t len = wi->entries.items[id].len;
+    editor_buffer_replace(e, e->c.pos, 0, word_text(wi, id) + typed, len - typed);
+    e->c.pos += len - typed;
+    e->completion.active = false;
 }
 
-void editor_cut(Editor *e) {
-    editor_copy(e);
-    if (e->selection.exists)
-        editor_selection_delete(e);
-    else
-    {   // delete current line
-        Line currentLine = e->lines.items[e->c.row];
-        e->selection = (Selection) {
-            .exists = true,
-            .start  = currentLine.start,
-            .end    = currentLine.end,
-        };
-        editor_selection_delete(e);
+// Ctrl+Space: completes the identifier before the cursor from the words in
+// the buffer, right away when there's only one
+void editor_complete(Editor *e) {
+    Completion *c = &e->completion;
+    if (editor_is_loading(e))
+    {
+        notification_issue(&e->notif, "File is still loading", 1);
+        return;
+    }
+    if (words_counting(&e->words))
+    {
+        notification_issue(&e->notif, "Still indexing words", 1);
+        return;
     }
+    editor_selection_clear(e);
+    editor_carets_clear(e);
+    c->start = editor_completion_prefix(e);
+    c->selected = 0;
+    editor_completion_refresh(e);
+    if (c->start == e->c.pos) return;
+    if (c->count == 0)
+        notification_issue(&e->notif, "No completions", 1);
+    else if (c->count == 1)
+        editor_completion_accept(e, c->items[0]);
 }
 
-void editor_paste(Editor *e) {
-    const char *text = GetClipboardText();
-
-    if (e->selection.exists) 
-        editor_selection_delete(e);
-
-    for (int i=0; i<strlen(text); i++)
-        editor_insert_char_at_cursor(e, text[i]);
-    // TODO: editor_insert_str_at_cursor() needed?
-    LOG("Pasted into editor");
+// while the list is open Up/Down pick, Enter/Tab accept and Escape closes it,
+// the keys are taken out of the inputs
+void editor_completion_update(Editor *e) {
+    Completion *c = &e->completion;
+    if (!c->active) return;
+    Inputs *in = &e->inputs;
+    if (in->escape)
+    {
+        c->active = false;
+        in->escape = false;
+    }
+    else if (in->cursor_up || in->cursor_down)
+    {
+        c->selected = (c->selected + (in->cursor_down ? 1 : c->count - 1)) % c->count;
+        in->cursor_up = in->cursor_down = false;
+    }
+    else if (in->enter || in->tab)
+    {
+        editor_completion_accept(e, c->items[c->selected]);
+        in->enter = in->tab = false;
+    }
 }
 
-void editor_set_font_size(Editor *e, int newFontSize) {
-    if (newFontSize <= 0) return;
-    e->fontSize = newFontSize;
-    SetTextLineSpacing(e->fontSize);
-    LOG("font size changed to %d", e->fontSize);
+// checks every file against the query again
+void picker_rank_reset(Picker *p) {
+    p->matches.count = 0;
+    p->candidates.count = 0;
+    p->candidatePos = 0;
+    p->filePos = 0;
+    p->topCount = 0;
+    p->selected = 0;
 }
 
-void editor_load_file(Editor *e, const char *filename) {
-    LOG("Opening file: %s", filename);
-    e->filename = filename;
-    SetWindowTitle(TextFormat("%s | the bingchillin text editor", e->filename));
-
-    // get size of the file
-    FILE *f = fopen(filename, "r");
-    if (f == NULL)
+// the query typed so far. When it only got longer the files that didn't match
+// before can't match now, only the matches and files not checked yet are left
+void picker_set_query(Picker *p, const char *query) {
+    const size_t len = strlen(query);
+    bool longer = len >= p->query.count;
+    da_reserve(&p->query, len + 1);
+    p->queryMask = 0;
+    for (size_t i=0; i<len; i++)
     {
-        perror("Error opening file");
-        //exit(1);
+        const char c = tolower((unsigned char)query[i]);
+        if (i < p->query.count && p->query.items[i] != c) longer = false;
+        p->query.items[i] = c;
+        p->queryMask |= picker_char_mask(c);
+    }
+    p->query.items[len] = '\0';
+    p->query.count = len;
+    if (!longer)
+    {
+        picker_rank_reset(p);
         return;
     }
+    for (size_t i=p->candidatePos; i<p->candidates.count; i++) da_append(&p->matches, p->candidates.items[i]);
+    const FileIds swap = p->candidates;
+    p->candidates = p->matches;
+    p->matches = swap;
+    p->matches.count = 0;
+    p->candidatePos = 0;
+    p->topCount = 0;
+    p->selected = 0;
+}
 
-    fseek(f, 0L, SEEK_END);
-    long int size = ftell(f);
-    rewind(f); // set cursor back to beginning?
-    LOG("size of file(%s):%ld\n", filename, size);
-    
-    // allocate that much memory in the buffer
-    da_reserve(&e->buffer, (size_t)size);
-
-    // copy file's contents to buffer
-    fread(e->buffer.items, 1, size, f);
-    e->buffer.count = size;
-
-    // remember to close file
-    fclose(f);
+void picker_consider(Picker *p, uint32_t file) {
+    const PickerFile *f = &p->list.files.items[file];
+    if ((f->mask & p->queryMask) != p->queryMask) return;
+    const int score = picker_score(&p->list, f, p->query.items, p->query.count);
+    if (score == PICKER_NO_MATCH) return;
+    da_append(&p->matches, file);
 
-    editor_calculate_lines(e);
+    // into the best ones, shorter paths first on a tie
+    size_t k = p->topCount < PICKER_ROWS ? p->topCount++ : PICKER_ROWS;
+    for (; k > 0; k--)
+    {
+        const PickerMatch m = p->top[k - 1];
+        if (m.score > score || (m.score == score && p->list.files.items[m.file].len <= f->len)) break;
+        if (k < PICKER_ROWS) p->top[k] = m;
+    }
+    if (k < PICKER_ROWS) p->top[k] = (PickerMatch){ file, score };
 }
 
-void editor_save_file(Editor *e) {
-    if (e->filename == NULL)
+// checks the candidates and then the files not checked yet for about `budget`
+// seconds, returns whether it got through all of them
+bool picker_rank(Picker *p, double budget) {
+    const double start = GetTime();
+    while (p->candidatePos < p->candidates.count)
     {
-        notification_issue(&e->notif, "Can not save: File does not exist", 1);
-        return;
+        size_t end = p->candidatePos + PICKER_STEP;
+        if (end > p->candidates.count) end = p->candidates.count;
+        for (; p->candidatePos < end; p->candidatePos++) picker_consider(p, p->candidates.items[p->candidatePos]);
+        if (GetTime() - start > budget) return false;
     }
-    notification_issue(&e->notif, TextFormat("Saving to file: %s", e->filename), 1);
-
-    // open file for writing
-    FILE *f = fopen(e->filename, "w");
-    if (f == NULL)
+    while (p->filePos < p->list.files.count)
     {
-        perror("Cannot open file for saving");
-        exit(1);
+        size_t end = p->filePos + PICKER_STEP;
+        if (end > p->list.files.count) end = p->list.files.count;
+        for (; p->filePos < end; p->filePos++) picker_consider(p, p->filePos);
+        if (GetTime() - start > budget) return false;
     }
-    // write the buffer to the previously opened file
-    fwrite(e->buffer.items, 1, e->buffer.count, f);
-
-    fclose(f);
+    return true;
 }
 
-bool editor_key_pressed(KeyboardKey key) {
-    return IsKeyPressed(key) || IsKeyPressedRepeat(key);
+// adds what the walk found since the last frame, once it's over a new walk
+// replaces the list
+void picker_poll(Picker *p) {
+    Walker *w = &p->walker;
+    if (!w->running) return;
+    pthread_mutex_lock(&w->lock);
+    const Buffer found = w->found;
+    w->found = p->taken;
+    w->found.count = 0;
+    p->taken = found;
+    const bool done = w->done;
+    pthread_mutex_unlock(&w->lock);
+
+    FileList *to = p->streaming ? &p->list : &p->next;
+    for (size_t i=0; i<p->taken.count;)
+    {
+        const size_t len = strlen(p->taken.items + i);
+        file_list_add(to, p->taken.items + i, len);
+        i += len + 1;
+    }
+    if (!done) return;
+    walker_stop(w, false);
+    p->walkTime = GetTime();
+    LOG("Walked %zu files", to->files.count);
+    if (p->streaming)
+    {
+        p->streaming = false;
+        return;
+    }
+    const FileList swap = p->list;
+    p->list = p->next;
+    p->next = swap;
+    file_list_clear(&p->next);
+    picker_rank_reset(p);
 }
 
-void editor_draw_text(Editor *e, const char* text, Vector2 pos, Color color) {
-    DrawTextEx(e->font, text, pos, e->fontSize, e->fontSpacing, color);
+// lists the files under the working directory, walking it again in the
+// background when the list is older than PICKER_RESCAN_TIME
+void editor_picker_open(Editor *e) {
+    Picker *p = &e->picker;
+    prompt_open(&e->prompt, PROMPT_OPEN, "Open");
+    da_reserve(&p->query, 1);
+    p->query.items[0] = '\0';
+    p->query.count = 0;
+    p->queryMask = 0;
+    picker_rank_reset(p);
+    if (!p->walker.running && (p->list.files.count == 0 || GetTime() - p->walkTime > PICKER_RESCAN_TIME))
+    {
+        p->streaming = p->list.files.count == 0;
+        file_list_clear(&p->next);
+        walker_start(&p->walker);
+    }
 }
 
-void inputs_update(Inputs *i) {
-    *i = (Inputs) {0}; // reset
-
-    bool ctrl = IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL);
-    i->select = IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT);
-
-    if (ctrl)
+// the selected file, or the typed path when nothing matches. It's opened
+// by `editor_picker_open_chosen()`
+void editor_picker_choose(Editor *e) {
+    Picker *p = &e->picker;
+    const char *path = e->prompt.items;
+    if (p->topCount > 0) path = p->list.text.items + p->list.files.items[p->top[p->selected].file].offset;
+    if (*path == '\0') return;
+    if (e->modified)
     {
-        i->zoom_in = editor_key_pressed(KEY_EQUAL);
-        i->zoom_out = editor_key_pressed(KEY_MINUS);
-        i->select_all = IsKeyPressed(KEY_A);
-
-        i->save_file = IsKeyPressed(KEY_S);
-        i->quit = IsKeyPressed(KEY_Q);
-
-        i->copy = IsKeyPressed(KEY_C);
-        i->cut = IsKeyPressed(KEY_X);
-        i->paste = editor_key_pressed(KEY_V);
-
-        i->cursor_right_word = editor_key_pressed(KEY_RIGHT);
-        i->cursor_left_word = editor_key_pressed(KEY_LEFT);
-        i->cursor_next_empty_line = editor_key_pressed(KEY_DOWN);
-        i->cursor_prev_empty_line = editor_key_pressed(KEY_UP);
-
-        i->cursor_file_start = IsKeyPressed(KEY_HOME);
-        i->cursor_file_end = IsKeyPressed(KEY_END);
-
-        i->backspace_word = IsKeyPressed(KEY_BACKSPACE);
-        i->delete_word = IsKeyPressed(KEY_DELETE);
+        notification_issue(&e->notif, "Unsaved changes, save them first", 2);
+        return;
     }
-    else
+    if (e->saver.active)
     {
-        i->cursor_right = editor_key_pressed(KEY_RIGHT);
-        i->cursor_left = editor_key_pressed(KEY_LEFT);
-        i->cursor_up = editor_key_pressed(KEY_UP);
-        i->cursor_down = editor_key_pressed(KEY_DOWN);
+        notification_issue(&e->notif, "Still saving previous changes", 1);
+        return;
+    }
+    free(p->chosen);
+    p->chosen = strdup(path);
+    prompt_close(&e->prompt);
+}
 
-        i->cursor_line_start = IsKeyPressed(KEY_HOME);
-        i->cursor_line_end = IsKeyPressed(KEY_END);
+// Up/Down pick a file, Enter opens it
+void editor_picker_update(Editor *e) {
+    Picker *p = &e->picker;
+    const Inputs *in = &e->inputs;
+    if ((in->cursor_up || in->cursor_down) && p->topCount > 0)
+        p->selected = (p->selected + (in->cursor_down ? 1 : p->topCount - 1)) % p->topCount;
+
+    const PromptResult r = prompt_update(&e->prompt);
+    if (r == PROMPT_CANCELLED) return;
+    // what was shown is what gets opened
+    if (r == PROMPT_SUBMITTED)
+    {
+        editor_picker_choose(e);
+        if (!prompt_is_open(&e->prompt)) return;
+    }
+    if (r == PROMPT_CHANGED) picker_set_query(p, e->prompt.items);
+    picker_poll(p);
+    picker_rank(p, PICKER_FRAME_BUDGET);
+}
 
-        i->backspace = IsKeyPressed(KEY_BACKSPACE);
-        i->delete = IsKeyPressed(KEY_DELETE);
+// the loader thread takes the editor lock, so the chosen file is opened
+// after the frame releases it
+void editor_picker_open_chosen(Editor *e) {
+    Picker *p = &e->picker;
+    if (p->chosen == NULL) return;
+    char *path = p->chosen;
+    p->chosen = NULL;
+    Location loc;
+    const bool hasLocation = location_from_path(path, &loc);
+    e->watch.stickToEnd = false; // the cursor was at the end of another file
+    editor_load_file(e, path);
+    free(p->opened);
+    p->opened = path;
+    if (hasLocation)
+    {
+        pthread_mutex_lock(&e->lock);
+        editor_goto(e, loc);
+        pthread_mutex_unlock(&e->lock);
     }
+}
 
-    i->page_up = editor_key_pressed(KEY_PAGE_UP);
-    i->page_down = editor_key_pressed(KEY_PAGE_DOWN);
+// the best matches above the prompt, how many matched on its right
+void editor_draw_picker(Editor *e) {
+    if (e->prompt.kind != PROMPT_OPEN) return;
+    const Picker *p = &e->picker;
+    const int padding = 3;
+    const int promptY = GetScreenHeight() - e->fontSize - padding*2;
+    const int y = promptY - e->fontSize*p->topCount - padding;
+    DrawRectangle(0, y, GetScreenWidth(), promptY - y, e->colors.bg);
+    DrawLine(0, y, GetScreenWidth(), y, e->colors.ui);
+    for (size_t i=0; i<p->topCount; i++)
+    {
+        const Vector2 pos = { padding, y + padding + e->fontSize*i };
+        if (i == p->selected) DrawRectangle(0, pos.y, GetScreenWidth(), e->fontSize, Fade(e->colors.selection, 0.3f));
+        const PickerFile *f = &p->list.files.items[p->top[i].file];
+        editor_draw_text(e, p->list.text.items + f->offset, pos, i == p->selected ? e->colors.cursor : e->colors.text);
+    }
 
-    i->enter = editor_key_pressed(KEY_ENTER);
-    i->tab = IsKeyPressed(KEY_TAB);
-    i->escape = IsKeyPressed(KEY_ESCAPE);
+    const bool busy = p->walker.running || p->candidatePos < p->candidates.count || p->filePos < p->list.files.count;
+    const char *status = TextFormat("%zu/%zu%s", p->matches.count, p->list.files.count, busy ? " ..." : "");
+    const Vector2 statusPos = { GetScreenWidth() - editor_measure_str(e, status) - padding, promptY + padding };
+    editor_draw_text(e, status, statusPos, e->colors.cursor);
 }
 
-bool editor_update(Editor *e) {
+bool editor_update_locked(Editor *e) {
     inputs_update(&e->inputs);
+    e->undo.sealed = true; // edits of one frame are undone together
+
+    if (e->journal.checkPending)
+    {
+        e->journal.checkPending = false;
+        if (e->undo.count == 0) editor_undo_open(e);
+        if (editor_journal_pending(e))
+            prompt_open(&e->prompt, PROMPT_RECOVER, "Unsaved edits found, replay them? (y/n)");
+    }
+    if (e->prompt.kind == PROMPT_RECOVER)
+    {
+        editor_recover_update(e);
+        return false;
+    }
+    if (e->prompt.kind == PROMPT_FIND || e->prompt.kind == PROMPT_REGEX ||
+        e->prompt.kind == PROMPT_REPLACE || e->prompt.kind == PROMPT_REPLACE_WITH ||
+        e->prompt.kind == PROMPT_GOTO || e->prompt.kind == PROMPT_OPEN)
+    {
+        if (e->prompt.kind == PROMPT_FIND) editor_find_update(e);
+        else if (e->prompt.kind == PROMPT_REGEX) editor_regex_update(e);
+        else if (e->prompt.kind == PROMPT_GOTO) editor_goto_update(e);
+        else if (e->prompt.kind == PROMPT_OPEN) editor_picker_update(e);
+        else editor_replace_update(e);
+        notification_update(&e->notif);
+        editor_cursor_update(e);
+        editor_scroll_to_cursor(e);
+        return false;
+    }
 
     if (IsKeyDown(KEY_LEFT_CONTROL)) {
+        const bool shift = IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT);
+        // these only know about the main cursor
+        if (IsKeyPressed(KEY_A) || IsKeyPressed(KEY_X) || IsKeyPressed(KEY_Z) || IsKeyPressed(KEY_Y) ||
+            IsKeyPressed(KEY_F) || IsKeyPressed(KEY_R))
+            editor_carets_clear(e);
         if (editor_key_pressed(KEY_EQUAL))
             editor_set_font_size(e, e->fontSize + 1);
 
@@ -741,14 +8238,37 @@ bool editor_update(Editor *e) {
 
         if (IsKeyPressed(KEY_A)) editor_select_all(e);
 
-        if (IsKeyPressed(KEY_S)) editor_save_file(e);
         if (IsKeyPressed(KEY_Q)) return true;
-
         if (IsKeyPressed(KEY_C)) editor_copy(e);
-        if (IsKeyPressed(KEY_X)) editor_cut(e);
-        if (editor_key_pressed(KEY_V)) editor_paste(e);
+        if (IsKeyPressed(KEY_T)) editor_follow_toggle(e);
+        if (IsKeyPressed(KEY_F) && !shift) editor_find_open(e);
+        if (IsKeyPressed(KEY_G)) prompt_open(&e->prompt, PROMPT_GOTO, "Go to line[:col] or @offset");
+        if (IsKeyPressed(KEY_SPACE)) editor_complete(e);
+        if (IsKeyPressed(KEY_O)) editor_picker_open(e);
+
+        if (editor_is_loading(e))
+        {
+            if (IsKeyPressed(KEY_S) || IsKeyPressed(KEY_X) || IsKeyPressed(KEY_V) || IsKeyPressed(KEY_Z) || IsKeyPressed(KEY_Y) ||
+                (IsKeyPressed(KEY_F) && shift) || IsKeyPressed(KEY_R))
+                notification_issue(&e->notif, "File is still loading", 1);
+        }
+        else
+        {
+            if (IsKeyPressed(KEY_S)) editor_save_file(e);
+            if (IsKeyPressed(KEY_X)) editor_cut(e);
+            if (editor_key_pressed(KEY_V)) editor_paste(e);
+            if (IsKeyPressed(KEY_F) && shift) editor_regex_open(e);
+            if (IsKeyPressed(KEY_R)) editor_replace_open(e);
+            if (IsKeyPressed(KEY_D)) editor_carets_add_next_match(e);
+            if (IsKeyPressed(KEY_L) && shift) editor_carets_split_lines(e);
+
+            if (editor_key_pressed(KEY_Z) && !shift) editor_undo(e);
+            if (editor_key_pressed(KEY_Y) || (editor_key_pressed(KEY_Z) && shift)) editor_redo(e);
+        }
     }
 
+    editor_completion_update(e);
+
     // -------------------
     // Movement stuff
     size_t startingPos = e->c.pos;
@@ -791,15 +8311,15 @@ bool editor_update(Editor *e) {
         editor_cursor_to_prev_word(e);
     }
 
-    if (e->inputs.cursor_up) {
+    if (e->inputs.cursor_prev_empty_line) {
         cursorMoved = true;
-        LOG("Cursor up");
-        editor_cursor_up(e);
+        LOG("Cursor previous empty line");
+        editor_cursor_to_prev_empty_line(e);
     }
-    if (e->inputs.cursor_down) {
+    if (e->inputs.cursor_next_empty_line) {
         cursorMoved = true;
-        LOG("Cursor down");
-        editor_cursor_down(e);
+        LOG("Cursor next empty line");
+        editor_cursor_to_next_empty_line(e);
     }
 
     if (e->inputs.cursor_line_start) {
@@ -826,6 +8346,12 @@ bool editor_update(Editor *e) {
         editor_cursor_to_last_line(e);
     }
 
+    if (e->inputs.cursor_matching_bracket) {
+        cursorMoved = true;
+        LOG("Cursor matching bracket");
+        editor_cursor_to_matching_bracket(e);
+    }
+
     if(e->inputs.page_up) {
         cursorMoved = true;
         LOG("PageUp key pressed");
@@ -841,69 +8367,53 @@ bool editor_update(Editor *e) {
             editor_cursor_to_last_line(e);
     }
 
-    if (e->inputs.select && cursorMoved) editor_select(e, startingPos);
+    // moving the cursor meanwhile drops a jump waiting for the loader
+    if (cursorMoved)
+        e->gotoPending = false;
+    else if (e->gotoPending && editor_cursor_to_location(e, e->gotoTarget))
+    {
+        LOG("Loader got to the go to target");
+        e->gotoPending = false;
+    }
+
+    if (cursorMoved && e->carets.count > 0)
+    {
+        // the extra cursors follow the simple moves, anything else leaves just the main one
+        const Inputs *in = &e->inputs;
+        if (in->cursor_left) editor_carets_move(e, editor_cursor_left, in->select);
+        else if (in->cursor_right) editor_carets_move(e, editor_cursor_right, in->select);
+        else if (in->cursor_up) editor_carets_move(e, editor_cursor_up, in->select);
+        else if (in->cursor_down) editor_carets_move(e, editor_cursor_down, in->select);
+        else if (in->cursor_line_start) editor_carets_move(e, editor_cursor_to_line_start, in->select);
+        else if (in->cursor_line_end) editor_carets_move(e, editor_cursor_to_line_end, in->select);
+        else editor_carets_clear(e);
+    }
+    if (e->inputs.select && cursorMoved)
+    {
+        editor_select(e, startingPos);
+        e->selection.block = e->inputs.block;
+    }
     else if (cursorMoved) editor_selection_clear(e);
 
     // Movement stuff ends
     // -------------------
 
-    if (e->inputs.enter) {
-        LOG("Enter key pressed");
-        if (e->selection.exists) editor_selection_delete(e);
-        // finds number of spaces on current line
-        int spaces = 0;
-        {
-            const Line currentLine = e->lines.items[e->c.row];
-            for (; e->buffer.items[currentLine.start + spaces] == ' '; spaces++);
-        }
-        // puts same amount of spaces on the new line
-        editor_insert_char_at_cursor(e, '\n');
-        for (int i = 0; i<spaces; i++) editor_insert_char_at_cursor(e, ' ');
-    }
-
-    if (e->inputs.tab) {   // TODO: implement proper tab behaviour
-        LOG("Tab key pressed");
-        for (int i=0; i<4; i++) editor_insert_char_at_cursor(e, ' ');
-    }
-
     if (e->inputs.escape) {
         editor_selection_clear(e);
+        editor_carets_clear(e);
         notification_clear(&e->notif);
     }
 
-    if (e->inputs.backspace) {
-        LOG("Backspace pressed");
-        if (e->selection.exists)
-            editor_selection_delete(e);
-        else
-            editor_remove_char_before_cursor(e);
-    }
-
-    if (e->inputs.delete) {
-        LOG("Delete pressed");
-        if (e->selection.exists)
-            editor_selection_delete(e);
-        else
-            editor_remove_char_at_cursor(e);
-    }
-
-    if (e->inputs.backspace_word) {
-        LOG("Backspace word");
-        editor_remove_word_before_cursor(e);
-    }
-
-    if (e->inputs.delete_word) {
-        LOG("Delete word");
-        editor_remove_word_after_cursor(e);
-    }
-
-
-    char key = GetCharPressed();
-    if (key) {
-        LOG("%c - character pressed", key);
-        if (e->selection.exists) editor_selection_delete(e);
-        editor_insert_char_at_cursor(e, key);
+    if (editor_is_loading(e))
+    {
+        // edits wait until the whole file is in the buffer
+        if (GetCharPressed() || e->inputs.enter || e->inputs.tab || e->inputs.backspace ||
+            e->inputs.delete || e->inputs.backspace_word || e->inputs.delete_word)
+            notification_issue(&e->notif, "File is still loading", 1);
     }
+    else
+        editor_update_edits(e);
+    if (e->completion.active) editor_completion_refresh(e);
 
     notification_update(&e->notif);
     
@@ -911,58 +8421,61 @@ bool editor_update(Editor *e) {
         editor_cursor_update(e);
     }
 
-    { // update editor scroll offset
-      // NOTE: do not use old e->c.row
-      // - update it first `the cursor_update() function`
-
-        const int winWidth = GetScreenWidth();
-        const int winHeight = GetScreenHeight();
-
-        // X offset calculation
-        const int cursorX = e->c.x;
-        const int winRight = winWidth - e->scrollX;
-        const int winLeft = 0 - e->scrollX + e->leftMargin;
-
-        if ( cursorX > winRight )
-            e->scrollX = winWidth-cursorX-1;
-        else if ( cursorX < winLeft )
-            e->scrollX = -cursorX + e->leftMargin;
-
-        // Y offset calulation
-        const int cursorTop = e->c.y;
-        const int cursorBottom = cursorTop + e->fontSize;
-        const int winBottom = winHeight - e->scrollY;
-        const int winTop = 0 - e->scrollY;
-
-        if (cursorBottom > winBottom)
-            e->scrollY = winHeight - cursorBottom;
-        else if (cursorTop < winTop)
-            e->scrollY = -cursorTop;
-    }
+    editor_scroll_to_cursor(e);
     return 0;
 }
 
+bool editor_update(Editor *e) {
+    editor_loader_poll(e);
+    editor_saver_poll(e, false);
+
+    pthread_mutex_lock(&e->lock);
+    editor_watch_poll(e);
+    bool quit = editor_update_locked(e);
+    editor_syntax_update(e);
+    editor_words_update(e);
+    pthread_mutex_unlock(&e->lock);
+    editor_picker_open_chosen(e);
+    return quit;
+}
+
 void editor_draw(Editor *e) {
         BeginDrawing();
         ClearBackground(BG_COLOR);
 
-        { // Render Text Buffer
-            // null terminate buffer before drawing it
-            da_append(&e->buffer, '\0');
+        pthread_mutex_lock(&e->lock);
 
-            Vector2 pos = {
-                e->leftMargin+e->scrollX, 
-                0+e->scrollY,
-            };
-            editor_draw_text(e, e->buffer.items, pos, e->colors.text);
-            // remove \0
-            da_remove(&e->buffer);
+        // only the rows inside the window get drawn
+        size_t firstRow, lastRow;
+        editor_visible_rows(e, &firstRow, &lastRow);
+
+        { // Render Text Buffer
+            // highlighted once the state of the first visible row is known
+            const Syntax *sx = &e->syntax;
+            const bool highlight = sx->enabled && firstRow < atomic_load(&sx->known);
+            LexState state = highlight ? sx->states.items[firstRow] : LEX_NORMAL;
+            for (size_t i=firstRow; i<lastRow; i++)
+            {
+                const Line line = e->lines.items[i];
+                Vector2 pos = {
+                    e->leftMargin+e->scrollX, 
+                    (int)(e->fontSize*i) + e->scrollY,
+                };
+                if (highlight) state = editor_draw_row_highlighted(e, i, state, pos);
+                else editor_draw_chars(e, &e->buffer.items[line.start], line.end - line.start, pos, e->colors.text);
+            }
         }
 
+        editor_draw_find_matches(e, firstRow, lastRow);
+        editor_draw_caret_selections(e, firstRow, lastRow);
+        editor_draw_regex_matches(e, firstRow, lastRow);
+        editor_draw_brackets(e, firstRow, lastRow);
+
         { // Render selection
             const Selection s = e->selection;
 
-            if (s.exists) {
+            if (s.exists && s.block) editor_draw_block(e, firstRow, lastRow);
+            else if (s.exists) {
                 size_t start, end = 0;
                 if (s.start <= s.end) {
                     start = s.start;
@@ -973,9 +8486,10 @@ void editor_draw(Editor *e) {
                     end = s.start;
                 }
 
-                bool selectionFound = false;
+                // selection may have started above the first visible row
+                bool selectionFound = firstRow < lastRow && start < e->lines.items[firstRow].start;
 
-                for (size_t i=0; i<e->lines.count; i++)
+                for (size_t i=firstRow; i<lastRow; i++)
                 {
                     const Line line = e->lines.items[i];
 
@@ -1026,7 +8540,7 @@ void editor_draw(Editor *e) {
             
             // the line numbers
             const char *strLineNum;
-            for (size_t i=0; i<e->lines.count; i++)
+            for (size_t i=firstRow; i<lastRow; i++)
             {
                 strLineNum = TextFormat("%lu", i+1);
                 Vector2 pos = {
@@ -1037,14 +8551,34 @@ void editor_draw(Editor *e) {
                 };
                 editor_draw_text(e, strLineNum, pos, e->colors.ui);
             }
+            // margin fits the widest line number in the file, not just the visible ones
+            strLineNum = TextFormat("%lu", e->lines.count);
             e->leftMargin = strlen(strLineNum) + 2;
             e->leftMargin *= editor_measure_str(e, "a");
         }
 
         { // Render cursor (atleast trying to)
             DrawLine(e->c.x + e->scrollX + 1, e->c.y + e->scrollY, e->c.x + e->scrollX + 1, e->c.y + e->scrollY + e->fontSize, e->colors.cursor);
+            editor_draw_carets(e, firstRow, lastRow);
+        }
+        editor_draw_completion(e);
+
+        if (editor_is_loading(e)) { // Render loading progress
+            const Loader *l = &e->loader;
+            const int percent = l->total ? (int)(l->consumed * 100 / l->total) : 100;
+            const char *progress = TextFormat("Loading %d%%", percent);
+            Vector2 pos = {
+                GetScreenWidth() - editor_measure_str(e, progress) - 5,
+                GetScreenHeight() - e->fontSize - 5,
+            };
+            editor_draw_text(e, progress, pos, e->colors.cursor);
         }
 
+        pthread_mutex_unlock(&e->lock);
+
+        editor_draw_prompt(e);
+        editor_draw_picker(e);
+
         // Render Notification
         if (e->notif.timer > 0.0) {
             int textW = editor_measure_str(e, e->notif.items);
@@ -1065,6 +8599,534 @@ void editor_draw(Editor *e) {
         EndDrawing();
 }
 
+// -------------------
+// Viewer mode
+// read-only, memory mapped, only every VIEWER_CHECKPOINT_LINES-th line
+// start is remembered so huge files open instantly and use little memory
+
+void *viewer_index_thread(void *arg) {
+    Editor *e = arg;
+    Viewer *v = &e->viewer;
+
+    Checkpoints batch; // published every few thousand checkpoints
+    da_init(&batch);
+    size_t line = 0;
+    size_t pos = 0;
+    const char *p;
+    while ((p = memchr(v->data + pos, '\n', v->size - pos)) != NULL)
+    {
+        pos = p - v->data + 1;
+        line++;
+        if (line % VIEWER_CHECKPOINT_LINES == 0)
+            da_append(&batch, pos);
+
+        if (batch.count == 4096 || (line % (VIEWER_CHECKPOINT_LINES*64) == 0))
+        {
+            if (atomic_load(&v->cancel)) break;
+            pthread_mutex_lock(&e->lock);
+            for (size_t i=0; i<batch.count; i++)
+                da_append(&v->checkpoints, batch.items[i]);
+            v->indexedPos = pos;
+            v->lineCount = line + 1;
+            pthread_mutex_unlock(&e->lock);
+            batch.count = 0;
+        }
+        if (pos >= v->size) break;
+    }
+
+    pthread_mutex_lock(&e->lock);
+    for (size_t i=0; i<batch.count; i++)
+        da_append(&v->checkpoints, batch.items[i]);
+    if (!atomic_load(&v->cancel))
+    {
+        v->indexedPos = v->size;
+        v->lineCount = line + 1;
+        v->indexed = true;
+    }
+    pthread_mutex_unlock(&e->lock);
+
+    da_free(&batch);
+    return NULL;
+}
+
+// looks for the needle from `from` to the end and then from the start, a
+// chunk at a time so that it can be cancelled
+void *viewer_find_thread(void *arg) {
+    ViewerFind *f = arg;
+    f->hit = SEARCH_NOT_FOUND;
+    for (int pass=0; pass<2 && f->hit == SEARCH_NOT_FOUND; pass++)
+    {
+        // matches starting before `from` are left for the second pass
+        size_t pos = pass == 0 ? f->from : 0;
+        const size_t end = pass == 0 ? f->size : f->from + f->len - 1 < f->size ? f->from + f->len - 1 : f->size;
+        while (pos < end && !atomic_load(&f->cancel))
+        {
+            const size_t n = end - pos < VIEWER_FIND_CHUNK + f->len - 1 ? end - pos : VIEWER_FIND_CHUNK + f->len - 1;
+            const size_t hit = search_forward(f->data + pos, n, f->needle, f->len);
+            if (hit != SEARCH_NOT_FOUND)
+            {
+                f->hit = pos + hit;
+                break;
+            }
+            pos += VIEWER_FIND_CHUNK;
+        }
+    }
+    atomic_store(&f->done, true);
+    return NULL;
+}
+
+void viewer_find_stop(Viewer *v) {
+    ViewerFind *f = &v->find;
+    if (!f->running) return;
+    atomic_store(&f->cancel, true);
+    pthread_join(f->thread, NULL);
+    f->running = false;
+    free(f->needle);
+    f->needle = NULL;
+}
+
+// maps `filename` and starts indexing it in the background
+bool editor_viewer_open(Editor *e, const char *filename) {
+    Viewer *v = &e->viewer;
+    LOG("Viewing file: %s", filename);
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        perror("Error opening file");
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        perror("Error opening file");
+        close(fd);
+        return false;
+    }
+
+    *v = (Viewer) {
+        .active = true,
+        .fd = fd,
+        .size = st.st_size,
+    };
+    da_init(&v->checkpoints);
+    da_append(&v->checkpoints, 0); // line 0
+    atomic_init(&v->cancel, false);
+
+    if (v->size > 0)
+    {
+        void *data = mmap(NULL, v->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            perror("Error mapping file");
+            close(fd);
+            v->active = false;
+            return false;
+        }
+        v->data = data;
+        v->threadRunning = pthread_create(&v->thread, NULL, viewer_index_thread, e) == 0;
+        if (!v->threadRunning)
+            viewer_index_thread(e);
+    }
+    else
+    {
+        v->indexed = true;
+        v->lineCount = 1;
+    }
+
+    e->filename = filename;
+    SetWindowTitle(TextFormat("%s [view] | the bingchillin text editor", filename));
+    return true;
+}
+
+void editor_viewer_close(Editor *e) {
+    Viewer *v = &e->viewer;
+    if (!v->active) return;
+    regex_search_clear(&e->regex);
+    viewer_find_stop(v);
+    atomic_store(&v->cancel, true);
+    if (v->threadRunning) pthread_join(v->thread, NULL);
+    if (v->data != NULL) munmap((void *)v->data, v->size);
+    close(v->fd);
+    da_free(&v->checkpoints);
+    v->active = false;
+}
+
+// start of the line following the one at `pos`, or `size` if there is none
+size_t viewer_next_line(Viewer *v, size_t pos) {
+    const char *p = memchr(v->data + pos, '\n', v->size - pos);
+    return p == NULL ? v->size : (size_t)(p - v->data) + 1;
+}
+
+// start of the line before the one starting at `pos`
+size_t viewer_prev_line(Viewer *v, size_t pos) {
+    if (pos == 0) return 0;
+    const char *p = memrchr(v->data, '\n', pos - 1);
+    return p == NULL ? 0 : (size_t)(p - v->data) + 1;
+}
+
+// start of the line containing `pos`
+size_t viewer_line_start(Viewer *v, size_t pos) {
+    const char *p = memrchr(v->data, '\n', pos);
+    return p == NULL ? 0 : (size_t)(p - v->data) + 1;
+}
+
+// line index of the line starting at `pos`, counted from the nearest checkpoint
+size_t viewer_line_of(Viewer *v, size_t pos) {
+    if (pos > v->indexedPos) return VIEWER_LINE_UNKNOWN;
+
+    // last checkpoint at or before pos
+    size_t lo = 0, hi = v->checkpoints.count;
+    while (hi - lo > 1)
+    {
+        size_t mid = lo + (hi - lo)/2;
+        if (v->checkpoints.items[mid] <= pos) lo = mid;
+        else hi = mid;
+    }
+
+    size_t line = lo * VIEWER_CHECKPOINT_LINES;
+    for (size_t at = v->checkpoints.items[lo]; at < pos; line++)
+        at = viewer_next_line(v, at);
+    return line;
+}
+
+// byte offset of line `line`, scanning forward from the closest checkpoint
+// returns false if the file has fewer lines
+bool viewer_line_pos(Viewer *v, size_t line, size_t *pos) {
+    size_t k = line / VIEWER_CHECKPOINT_LINES;
+    if (k >= v->checkpoints.count) k = v->checkpoints.count - 1;
+
+    size_t at = v->checkpoints.items[k];
+    for (size_t i = k * VIEWER_CHECKPOINT_LINES; i < line; i++)
+    {
+        const char *p = memchr(v->data + at, '\n', v->size - at);
+        if (p == NULL) return false;
+        at = p - v->data + 1;
+    }
+    *pos = at;
+    return true;
+}
+
+// whether `viewer_line_pos()` finds `line` without scanning past what the
+// index thread already went through
+bool viewer_line_indexed(Viewer *v, size_t line) {
+    return v->indexed || line / VIEWER_CHECKPOINT_LINES + 1 < v->checkpoints.count;
+}
+
+void viewer_scroll_to(Viewer *v, size_t pos) {
+    v->topPos = viewer_line_start(v, pos);
+    v->topLine = viewer_line_of(v, v->topPos);
+}
+
+// scrolls to `gotoLine`, once it's indexed
+void viewer_goto_line(Editor *e) {
+    Viewer *v = &e->viewer;
+    size_t pos;
+    if (!viewer_line_pos(v, v->gotoLine, &pos))
+    {
+        notification_issue(&e->notif, TextFormat("No line %zu", v->gotoLine + 1), 1);
+        return;
+    }
+    v->topPos = pos;
+    v->topLine = v->gotoLine;
+}
+
+// scrolls to the line of `loc` right away, or once the index thread gets
+// there, see `editor_viewer_update()`. The viewer has no column to go to
+void viewer_goto(Editor *e, Location loc) {
+    Viewer *v = &e->viewer;
+    v->gotoPending = false;
+    if (loc.byOffset)
+    {
+        viewer_scroll_to(v, loc.offset < v->size ? loc.offset : v->size);
+        return;
+    }
+    v->gotoLine = loc.line - 1;
+    v->gotoPending = !viewer_line_indexed(v, v->gotoLine);
+    if (v->gotoPending) notification_issue(&e->notif, "Going there once it's indexed", 2);
+    else viewer_goto_line(e);
+}
+
+void viewer_scroll_down(Viewer *v, int rows) {
+    for (int i=0; i<rows; i++)
+    {
+        const char *p = memchr(v->data + v->topPos, '\n', v->size - v->topPos);
+        if (p == NULL) break; // already on the last line
+        v->topPos = p - v->data + 1;
+        if (v->topLine != VIEWER_LINE_UNKNOWN) v->topLine++;
+    }
+}
+
+void viewer_scroll_up(Viewer *v, int rows) {
+    for (int i=0; i<rows && v->topPos > 0; i++)
+    {
+        v->topPos = viewer_prev_line(v, v->topPos);
+        if (v->topLine != VIEWER_LINE_UNKNOWN) v->topLine--;
+    }
+}
+
+// scrolls to what the find thread found
+void viewer_find_finish(Editor *e) {
+    Viewer *v = &e->viewer;
+    ViewerFind *f = &v->find;
+    f->running = false;
+    if (f->hit == SEARCH_NOT_FOUND)
+    {
+        v->matchLen = 0;
+        notification_issue(&e->notif, TextFormat("Not found: %s", f->needle), 1);
+    }
+    else
+    {
+        v->matchPos = f->hit;
+        v->matchLen = f->len;
+        viewer_scroll_to(v, v->matchPos);
+    }
+    free(f->needle);
+    f->needle = NULL;
+}
+
+// joins a finished find, called every frame
+void viewer_find_poll(Editor *e) {
+    ViewerFind *f = &e->viewer.find;
+    if (!f->running || !atomic_load(&f->done)) return;
+    pthread_join(f->thread, NULL);
+    viewer_find_finish(e);
+}
+
+// looks for the next occurence of the prompt text after the previous match,
+// the result shows up in `viewer_find_poll()`
+void viewer_find_next(Editor *e) {
+    Viewer *v = &e->viewer;
+    const size_t len = e->prompt.count;
+    if (len == 0 || v->size == 0) return;
+    viewer_find_stop(v);
+
+    ViewerFind *f = &v->find;
+    size_t from = v->matchLen > 0 ? v->matchPos + 1 : v->topPos;
+    if (from > v->size) from = v->size;
+    *f = (ViewerFind) {
+        .running = true,
+        .data = v->data,
+        .size = v->size,
+        .needle = strndup(e->prompt.items, len),
+        .len = len,
+        .from = from,
+    };
+    atomic_init(&f->done, false);
+    atomic_init(&f->cancel, false);
+    if (pthread_create(&f->thread, NULL, viewer_find_thread, f) != 0)
+    {
+        // no thread, search right here
+        viewer_find_thread(f);
+        viewer_find_finish(e);
+    }
+}
+
+// the regex bar of the viewer, the whole mapping is searched on the regex thread
+void viewer_regex_update(Editor *e, PromptResult r) {
+    Viewer *v = &e->viewer;
+    RegexSearch *rs = &e->regex;
+    if (r == PROMPT_CANCELLED)
+        regex_search_clear(rs);
+    else if (r == PROMPT_CHANGED)
+    {
+        regex_search_set_pattern(rs, e->prompt.items);
+        regex_search_start(rs, v->data, v->size, 0);
+        v->matchLen = 0;
+    }
+    else if (r == PROMPT_SUBMITTED && rs->valid)
+    {
+        const bool forward = !IsKeyDown(KEY_LEFT_SHIFT) && !IsKeyDown(KEY_RIGHT_SHIFT);
+        const size_t from = v->matchLen > 0 ? v->matchPos + forward : v->topPos;
+        pthread_mutex_lock(&rs->lock);
+        const size_t i = regex_search_next(rs, from, forward);
+        const RegexMatch m = i != SIZE_MAX ? rs->matches.items[i] : (RegexMatch) {0};
+        pthread_mutex_unlock(&rs->lock);
+        if (i == SIZE_MAX)
+        {
+            regex_search_not_found(e);
+            return;
+        }
+        v->matchPos = m.pos;
+        v->matchLen = m.len;
+        viewer_scroll_to(v, v->matchPos);
+    }
+}
+
+bool editor_viewer_update(Editor *e) {
+    Viewer *v = &e->viewer;
+    inputs_update(&e->inputs);
+    pthread_mutex_lock(&e->lock);
+
+    const bool ctrl = IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL);
+    const int rows = GetScreenHeight() / e->fontSize;
+
+    if (prompt_is_open(&e->prompt))
+    {
+        PromptResult r = prompt_update(&e->prompt);
+        if (r == PROMPT_SUBMITTED && e->prompt.kind == PROMPT_GOTO)
+        {
+            Location loc;
+            if (!location_parse(e->prompt.items, &loc))
+                notification_issue(&e->notif, TextFormat("Not a line or @offset: %s", e->prompt.items), 1);
+            else viewer_goto(e, loc);
+            prompt_close(&e->prompt);
+        }
+        else if (r == PROMPT_SUBMITTED && e->prompt.kind == PROMPT_FIND)
+            viewer_find_next(e);
+        else if (e->prompt.kind == PROMPT_REGEX || r == PROMPT_CANCELLED)
+        {
+            viewer_find_stop(v);
+            viewer_regex_update(e, r);
+        }
+        else if (r == PROMPT_CHANGED)
+        {
+            viewer_find_stop(v);
+            v->matchLen = 0;
+        }
+    }
+    else
+    {
+        if (ctrl && IsKeyPressed(KEY_Q))
+        {
+            pthread_mutex_unlock(&e->lock);
+            return true;
+        }
+        if (ctrl && editor_key_pressed(KEY_EQUAL)) editor_set_font_size(e, e->fontSize + 1);
+        if (ctrl && editor_key_pressed(KEY_MINUS)) editor_set_font_size(e, e->fontSize - 1);
+        if (ctrl && IsKeyPressed(KEY_G)) prompt_open(&e->prompt, PROMPT_GOTO, "Go to line or @offset");
+        if (ctrl && IsKeyPressed(KEY_F))
+        {
+            const bool shift = IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT);
+            if (shift) prompt_open(&e->prompt, PROMPT_REGEX, "Regex");
+            else prompt_open(&e->prompt, PROMPT_FIND, "Find");
+        }
+        if (e->inputs.escape)
+        {
+            viewer_find_stop(v);
+            v->matchLen = 0;
+            v->gotoPending = false;
+            notification_clear(&e->notif);
+        }
+
+        // scrolling meanwhile drops a jump waiting for the index
+        if (e->inputs.cursor_down || e->inputs.cursor_up || e->inputs.page_down || e->inputs.page_up ||
+            e->inputs.cursor_file_start || e->inputs.cursor_file_end)
+            v->gotoPending = false;
+        if (e->inputs.cursor_down)  viewer_scroll_down(v, 1);
+        if (e->inputs.cursor_up)    viewer_scroll_up(v, 1);
+        if (e->inputs.page_down)    viewer_scroll_down(v, rows - 1);
+        if (e->inputs.page_up)      viewer_scroll_up(v, rows - 1);
+        if (e->inputs.cursor_right) e->scrollX -= editor_measure_str(e, "a");
+        if (e->inputs.cursor_left)  e->scrollX += editor_measure_str(e, "a");
+        if (e->scrollX > 0) e->scrollX = 0;
+
+        if (e->inputs.cursor_file_start)
+        {
+            v->topPos = 0;
+            v->topLine = 0;
+        }
+        if (e->inputs.cursor_file_end && v->size > 0)
+        {
+            viewer_scroll_to(v, v->size - 1);
+            viewer_scroll_up(v, rows - 2);
+        }
+    }
+
+    viewer_find_poll(e);
+    if (v->gotoPending && viewer_line_indexed(v, v->gotoLine))
+    {
+        LOG("Index got to the go to target");
+        v->gotoPending = false;
+        viewer_goto_line(e);
+    }
+
+    // line numbers become known once the index thread passes them
+    if (v->topLine == VIEWER_LINE_UNKNOWN)
+        v->topLine = viewer_line_of(v, v->topPos);
+
+    notification_update(&e->notif);
+    pthread_mutex_unlock(&e->lock);
+    return false;
+}
+
+void editor_viewer_draw(Editor *e) {
+    Viewer *v = &e->viewer;
+    BeginDrawing();
+    ClearBackground(e->colors.bg);
+    pthread_mutex_lock(&e->lock);
+
+    const int rows = GetScreenHeight() / e->fontSize + 1;
+    size_t pos = v->topPos;
+    for (int i=0; i<rows && pos <= v->size; i++)
+    {
+        // NOTE: very long lines only get their beginning drawn
+        size_t limit = v->size - pos;
+        if (limit > VIEWER_MAX_DRAWN_LINE) limit = VIEWER_MAX_DRAWN_LINE;
+        const char *nl = memchr(v->data + pos, '\n', limit);
+        const size_t len = nl == NULL ? limit : (size_t)(nl - (v->data + pos));
+        const size_t drawnLen = nl != NULL && len > 0 && v->data[pos + len - 1] == '\r' ? len - 1 : len;
+
+        Vector2 textPos = { e->leftMargin + e->scrollX, i * e->fontSize };
+        editor_draw_chars(e, v->data + pos, drawnLen, textPos, e->colors.text);
+
+        // search match highlight
+        if (v->matchLen > 0 && v->matchPos >= pos && v->matchPos < pos + len)
+        {
+            const int x = editor_measure_text(e, v->data + pos, v->matchPos - pos);
+            const int w = editor_measure_text(e, v->data + v->matchPos, v->matchLen);
+            DrawRectangleLines(textPos.x + x, textPos.y, w, e->fontSize, e->colors.selection);
+        }
+        if (e->prompt.kind == PROMPT_REGEX && e->regex.valid)
+        {
+            RegexSearch *rs = &e->regex;
+            pthread_mutex_lock(&rs->lock);
+            for (size_t m = regex_search_find(rs, pos); m < rs->matches.count && rs->matches.items[m].pos < pos + len; m++)
+            {
+                const RegexMatch match = rs->matches.items[m];
+                const size_t matchLen = match.pos + match.len < pos + len ? match.len : pos + len - match.pos;
+                const int x = editor_measure_text(e, v->data + pos, match.pos - pos);
+                const int w = editor_measure_text(e, v->data + match.pos, matchLen);
+                DrawRectangle(textPos.x + x, textPos.y, w, e->fontSize, Fade(e->colors.selection, 0.3f));
+            }
+            pthread_mutex_unlock(&rs->lock);
+        }
+
+        // line numbers
+        DrawRectangle(0, textPos.y, e->leftMargin, e->fontSize, e->colors.bg);
+        const char *lineNum = v->topLine == VIEWER_LINE_UNKNOWN ? "~" : TextFormat("%zu", v->topLine + i + 1);
+        editor_draw_text(e, lineNum, (Vector2){ 0, textPos.y }, e->colors.ui);
+
+        if (nl == NULL) nl = memchr(v->data + pos + len, '\n', v->size - pos - len);
+        if (nl == NULL) break; // last line
+        pos = nl - v->data + 1;
+    }
+    DrawLine(e->leftMargin-1, 0, e->leftMargin-1, GetScreenHeight(), e->colors.ui);
+    e->leftMargin = (strlen(TextFormat("%zu", v->lineCount)) + 2) * editor_measure_str(e, "a");
+
+    { // indexing progress & position
+        const char *searching = v->find.running ? "Searching  " : "";
+        const char *status = v->indexed
+            ? TextFormat("%s%zu lines", searching, v->lineCount)
+            : TextFormat("%sIndexing %d%%  %zu+ lines", searching, (int)(v->indexedPos * 100 / v->size), v->lineCount);
+        Vector2 statusPos = {
+            GetScreenWidth() - editor_measure_str(e, status) - 5,
+            GetScreenHeight() - e->fontSize - 5,
+        };
+        editor_draw_text(e, status, statusPos, e->colors.cursor);
+    }
+    pthread_mutex_unlock(&e->lock);
+
+    editor_draw_prompt(e);
+
+    if (e->notif.timer > 0.0)
+    {
+        Vector2 textPos = { 5, GetScreenHeight()/2.0f };
+        editor_draw_text(e, e->notif.items, textPos, e->colors.cursor);
+    }
+    EndDrawing();
+}
+
 int main(int argc, char **argv) {
 #ifdef BUILD_RELEASE
     SetTraceLogLevel(LOG_ERROR);
@@ -1081,17 +9143,55 @@ int main(int argc, char **argv) {
 
     editor_init(&editor);
 
-    if (argc > 1) {
-        editor_load_file(&editor, argv[1]);
+    // usage: bingchillin [--view] [--follow] [--undo-limit MiB] [file[:line[:col]]]
+    bool viewOnly = false;
+    char *filename = NULL;
+    for (int i=1; i<argc; i++)
+    {
+        if (strcmp(argv[i], "--view") == 0 || strcmp(argv[i], "-v") == 0)
+            viewOnly = true;
+        else if (strcmp(argv[i], "--follow") == 0 || strcmp(argv[i], "-f") == 0)
+            editor.watch.follow = true;
+        else if (strcmp(argv[i], "--undo-limit") == 0 && i+1 < argc)
+            editor.undo.limit = strtoull(argv[++i], NULL, 10) * 1024 * 1024;
+        else
+            filename = argv[i];
+    }
+
+    Location loc;
+    const bool hasLocation = filename != NULL && location_from_path(filename, &loc);
+
+    if (filename != NULL && viewOnly) {
+        if (!editor_viewer_open(&editor, filename)) return 1;
+        if (hasLocation) {
+            // the index thread is already going through the file
+            pthread_mutex_lock(&editor.lock);
+            viewer_goto(&editor, loc);
+            pthread_mutex_unlock(&editor.lock);
+        }
+    } else if (filename != NULL) {
+        editor_load_file(&editor, filename);
+        if (hasLocation) {
+            // the loader thread is already filling the buffer
+            pthread_mutex_lock(&editor.lock);
+            editor_goto(&editor, loc);
+            pthread_mutex_unlock(&editor.lock);
+        }
     }
     
     bool shouldQuit = false;
     while(!WindowShouldClose() && !shouldQuit)
     {
-        shouldQuit = editor_update(&editor);
-        editor_draw(&editor);
+        if (editor.viewer.active) {
+            shouldQuit = editor_viewer_update(&editor);
+            editor_viewer_draw(&editor);
+        } else {
+            shouldQuit = editor_update(&editor);
+            editor_draw(&editor);
+        }
     }
 
+    editor_viewer_close(&editor);
     editor_deinit(&editor);
     CloseWindow();
 
@@ -0,0 +1,154 @@
+// `make test`: checks the regex search against known cases and against POSIX
+// regexec() on random patterns
+#define main bingchillin_main
+#include "main.c"
+#undef main
+#include <regex.h>
+
+// finds every match of `pattern` in `text` the way the editor does
+bool regex_find_all(RegexSearch *rs, const char *pattern, const char *text) {
+    regex_search_set_pattern(rs, pattern);
+    if (!rs->valid) return false;
+    rs->data = text;
+    rs->size = strlen(text);
+    rs->from = 0;
+    regex_thread(rs);
+    return true;
+}
+
+// matches have to be leftmost longest like POSIX, even where the match that
+// ends first starts later
+int regex_known_cases(RegexSearch *rs) {
+    const struct {
+        const char *pattern;
+        const char *text;
+        size_t count;
+        RegexMatch last;
+    } cases[] = {
+        { "abcd|bc", "abcd", 1, { 0, 4 } },
+        { "xyz|y", "xyz", 1, { 0, 3 } },
+        { "a.*c|b", "abc", 1, { 0, 3 } },
+        { "ab+c|b", "abbbc", 1, { 0, 5 } },
+        { "c?(c?b?a+)?a", "ac\nbaaaa", 2, { 3, 5 } },
+    };
+    int failed = 0;
+    for (size_t i=0; i<sizeof(cases)/sizeof(cases[0]); i++)
+    {
+        const bool valid = regex_find_all(rs, cases[i].pattern, cases[i].text);
+        const RegexMatch last = rs->matches.count > 0 ? rs->matches.items[rs->matches.count - 1] : (RegexMatch){0};
+        if (!valid || rs->count != cases[i].count || last.pos != cases[i].last.pos || last.len != cases[i].last.len)
+        {
+            printf("FAIL %s on \"%s\": %zu matches, last %zu+%zu\n", cases[i].pattern, cases[i].text, rs->count, last.pos, last.len);
+            failed++;
+        }
+        regex_search_clear(rs);
+    }
+    return failed;
+}
+
+uint64_t rngState = 12345;
+
+uint32_t rng(void) {
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return rngState >> 11;
+}
+
+// random pattern over "abc" appended to `out`. glibc lets '^' match in the
+// middle of a line inside repeated groups, so it is only put at the very start
+void random_pattern(char *out, int depth, bool alternation) {
+    const int parts = 1 + rng()%3;
+    for (int i=0; i<parts; i++)
+    {
+        const int kind = rng()%10;
+        if (kind == 4) strcat(out, ".");
+        else if (kind == 5) strcat(out, "[ab]");
+        else if (kind == 6 && depth < 2)
+        {
+            strcat(out, "(");
+            random_pattern(out, depth + 1, alternation);
+            strcat(out, ")");
+        }
+        else if (kind == 7 && depth == 0 && i == 0 && out[0] == '\0') strcat(out, "^");
+        else if (kind == 8 && i == parts - 1 && rng()%3 == 0) strcat(out, "$");
+        else strncat(out, &"abc"[rng()%3], 1);
+
+        const int repeat = rng()%6;
+        if (repeat == 0) strcat(out, "*");
+        else if (repeat == 1) strcat(out, "+");
+        else if (repeat == 2) strcat(out, "?");
+        else if (repeat == 3 && rng()%2) strcat(out, "{1,2}");
+    }
+    if (alternation && depth < 2 && rng()%3 == 0)
+    {
+        strcat(out, "|");
+        random_pattern(out, depth + 1, alternation);
+    }
+}
+
+// whether the matches agree with regexec() finding them one after the other
+bool regex_matches_posix(RegexSearch *rs, const char *pattern, const char *text) {
+    regex_t r;
+    if (regcomp(&r, pattern, REG_EXTENDED | REG_NEWLINE) != 0) return true;
+    if (!regex_find_all(rs, pattern, text))
+    {
+        regfree(&r);
+        return false;
+    }
+    const size_t len = strlen(text);
+    size_t pos = 0;
+    size_t k = 0;
+    bool same = true;
+    regmatch_t m;
+    while (pos <= len && regexec(&r, text + pos, 1, &m, pos > 0 && text[pos - 1] != '\n' ? REG_NOTBOL : 0) == 0)
+    {
+        const size_t start = pos + m.rm_so;
+        const size_t end = pos + m.rm_eo;
+        // the editor doesn't report empty matches
+        if (end > start)
+        {
+            if (k >= rs->matches.count || rs->matches.items[k].pos != start || rs->matches.items[k].len != end - start)
+                same = false;
+            k++;
+        }
+        pos = end > start ? end : start + 1;
+    }
+    if (k != rs->matches.count) same = false;
+    if (!same)
+    {
+        printf("FAIL %s on \"%s\":", pattern, text);
+        for (size_t i=0; i<rs->matches.count; i++) printf(" %zu+%zu", rs->matches.items[i].pos, rs->matches.items[i].len);
+        printf("\n");
+    }
+    regfree(&r);
+    regex_search_clear(rs);
+    return same;
+}
+
+int main(void)
+{
+    RegexSearch rs = {0};
+    da_init(&rs.matches);
+    pthread_mutex_init(&rs.lock, NULL);
+
+    int failed = regex_known_cases(&rs);
+    for (int alternation=0; alternation<2; alternation++)
+    {
+        for (int i=0; i<20000; i++)
+        {
+            char pattern[256] = {0};
+            random_pattern(pattern, 0, alternation);
+            char text[32];
+            const int len = rng()%30;
+            for (int j=0; j<len; j++) text[j] = "abcab\n"[rng()%6];
+            text[len] = '\0';
+            if (!regex_matches_posix(&rs, pattern, text)) failed++;
+        }
+    }
+
+    da_free(&rs.matches);
+    pthread_mutex_destroy(&rs.lock);
+    printf("%d regex checks failed\n", failed);
+    return failed > 0;
+}